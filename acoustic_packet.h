@@ -0,0 +1,60 @@
+/* campbell, isc license */
+
+/* parser for the header of the acoustic packets emitted by the DAQ, equivalent to the one in
+ parse_acoustic_packets.py, for c code which needs to know about the contents of packets
+ (such as seqnum gaps) without converting the samples */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define ACOUSTIC_PACKET_MAGIC 0x45
+#define ACOUSTIC_PACKET_HEADER_SIZE 16
+
+struct acoustic_packet_header {
+    uint8_t channels;
+    uint16_t seqnum;
+    float sample_rate;
+    uint16_t flags;
+
+    /* timestamp given by the DAQ, in microseconds, which marks the end of the packet, that is
+     the time at which the sample following its last would be acquired, as in pcm2packets.py
+     and parse_acoustic_packets.py. the first sample was acquired samples_per_channel sample
+     periods earlier */
+    uint64_t timestamp_microseconds;
+
+    /* derived from the lowest three bits of flags and the packet size */
+    size_t sizeof_sample;
+    size_t samples_per_channel;
+};
+
+/* returns 0 and populates the given struct if the packet (not including the logging header)
+ is a well-formed acoustic packet, or -1 otherwise */
+static inline int acoustic_packet_parse(struct acoustic_packet_header * header, const unsigned char * packet, const size_t size) {
+    if (size < ACOUSTIC_PACKET_HEADER_SIZE || ACOUSTIC_PACKET_MAGIC != packet[0] || !packet[1]) return -1;
+
+    /* little endian, as is every platform this runs on */
+    uint16_t seqnum, flags, timestamp_lsbs;
+    uint32_t timestamp_msbs;
+    float sample_rate;
+    memcpy(&seqnum, packet + 2, 2);
+    memcpy(&sample_rate, packet + 4, 4);
+    memcpy(&flags, packet + 8, 2);
+    memcpy(&timestamp_lsbs, packet + 10, 2);
+    memcpy(&timestamp_msbs, packet + 12, 4);
+
+    const unsigned dtype = flags & 0x7;
+    const size_t sizeof_sample = (0 == dtype ? 2 : 1 == dtype ? 4 : 3 == dtype ? 4 : 4 == dtype ? 1 : 3);
+    const size_t samples_per_channel = (size - ACOUSTIC_PACKET_HEADER_SIZE) / (packet[1] * sizeof_sample);
+    if (samples_per_channel * sizeof_sample * packet[1] + ACOUSTIC_PACKET_HEADER_SIZE != size) return -1;
+
+    *header = (struct acoustic_packet_header) {
+        .channels = packet[1],
+        .seqnum = seqnum,
+        .sample_rate = sample_rate,
+        .flags = flags,
+        .timestamp_microseconds = (((uint64_t)timestamp_msbs << 16) | timestamp_lsbs) * 16,
+        .sizeof_sample = sizeof_sample,
+        .samples_per_channel = samples_per_channel
+    };
+    return 0;
+}
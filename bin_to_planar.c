@@ -0,0 +1,243 @@
+/* campbell, isc license */
+
+/* converts a logged chunk into a planar archive, in which the samples of each channel are
+ contiguous and start on a page boundary, preceded by a table of the packets they came from,
+ such that the archive can be memory-mapped and any one channel read without touching the
+ others, as by planar_archive.py. invoke as "bin_to_planar input.bin output.planar", where
+ either may be "-" for stdin or stdout, e.g. "gunzip < chunk.bin.gz | bin_to_planar - out".
+ only acoustic packets with the same format as the first are archived, and the rest are
+ counted in the header, as the archive of a chunk is intended to sit alongside the chunk.
+ 24-bit samples are sign-extended to 32 bits, as numpy has no 24-bit type. everything in the
+ archive is little endian, as is every platform this runs on */
+
+#include "acoustic_packet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+/* useful macros */
+#define WARNING_ANSI "\x1B[35;1mwarning:\x1B[0m"
+#define ERROR_ANSI "\x1B[31;1merror:\x1B[0m"
+#define NOPE(...) do { fprintf(stderr, ERROR_ANSI " " __VA_ARGS__); exit(EXIT_FAILURE); } while(0)
+
+/* the packet table and each channel start on a boundary of this many bytes */
+#define PLANAR_ALIGNMENT 4096U
+
+#define PLANAR_VERSION 1
+
+/* at the start of the archive, and mirrored by planar_archive.py */
+struct planar_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t channels;
+
+    /* numpy dtype of each sample, such as "<i2", and the value corresponding to full scale */
+    char dtype[8];
+    float sample_rate;
+    float fullscale;
+
+    uint64_t packets;
+    uint64_t samples_per_channel;
+
+    /* offset of the packet table, of the first sample of the first channel, and between the
+     first samples of consecutive channels */
+    uint64_t packets_offset;
+    uint64_t channels_offset;
+    uint64_t channel_stride;
+
+    /* logged packets not in the archive, being nonacoustic or of a different format */
+    uint64_t packets_skipped;
+};
+
+/* one per archived packet, in the order logged */
+struct planar_packet {
+    uint64_t logged_microseconds;
+    uint64_t timestamp_microseconds;
+
+    /* index within each channel of the first sample of this packet */
+    uint64_t first_sample;
+    uint32_t samples;
+    uint16_t seqnum;
+    uint16_t flags;
+};
+
+static size_t aligned(const size_t size) {
+    return (size + PLANAR_ALIGNMENT - 1) & ~(size_t)(PLANAR_ALIGNMENT - 1);
+}
+
+static unsigned char * read_all(FILE * fh, size_t * size_p) {
+    size_t size = 0, allocated = 1U << 20;
+    unsigned char * data = malloc(allocated);
+    for (size_t ret; data && (ret = fread(data + size, 1, allocated - size, fh)) > 0; ) {
+        size += ret;
+        if (size == allocated) data = realloc(data, allocated *= 2);
+    }
+    *size_p = size;
+    return data;
+}
+
+/* calls the given function for each acoustic packet in the logged data, and returns the
+ number of records of any kind in it */
+static size_t for_each_packet(const unsigned char * data, const size_t size, void (* function)(void *, const struct acoustic_packet_header *,
+                              const unsigned char *, uint64_t), void * context) {
+    size_t records = 0;
+    for (size_t offset = 0; offset + sizeof(uint64_t) <= size; records++) {
+        uint64_t logging_header;
+        memcpy(&logging_header, data + offset, sizeof(uint64_t));
+        const size_t packet_size = logging_header & 65535U;
+        const unsigned char * packet = data + offset + sizeof(uint64_t);
+
+        offset += sizeof(uint64_t) + ((packet_size + 7) & ~7);
+        if (offset > size) {
+            fprintf(stderr, WARNING_ANSI " %s: input ends partway through a packet\n", __func__);
+            break;
+        }
+
+        struct acoustic_packet_header header;
+        if (!acoustic_packet_parse(&header, packet, packet_size))
+            function(context, &header, packet + ACOUSTIC_PACKET_HEADER_SIZE, (logging_header >> 16U) * 16U);
+    }
+    return records;
+}
+
+struct archive {
+    /* format of the first acoustic packet, to which all others must conform */
+    struct acoustic_packet_header format;
+    int have_format;
+    size_t packets;
+    uint64_t samples_per_channel;
+
+    /* set only once the layout is known */
+    unsigned char * data;
+    struct planar_packet * table;
+    size_t sizeof_output_sample;
+    uint64_t channel_stride;
+};
+
+static int conforms(struct archive * archive, const struct acoustic_packet_header * header) {
+    if (!archive->have_format) {
+        archive->format = *header;
+        archive->have_format = 1;
+    }
+    return header->channels == archive->format.channels && header->flags == archive->format.flags &&
+           header->sample_rate == archive->format.sample_rate;
+}
+
+static void count(void * context, const struct acoustic_packet_header * header, const unsigned char * samples, const uint64_t logged_microseconds) {
+    struct archive * archive = context;
+    (void)samples;
+    (void)logged_microseconds;
+    if (!conforms(archive, header)) return;
+
+    archive->samples_per_channel += header->samples_per_channel;
+    archive->packets++;
+}
+
+/* appends the samples of one packet to each channel, transposing them from interleaved */
+static void scatter(void * context, const struct acoustic_packet_header * header, const unsigned char * samples, const uint64_t logged_microseconds) {
+    struct archive * archive = context;
+    if (!conforms(archive, header)) return;
+
+    const size_t channels = header->channels, frames = header->samples_per_channel;
+    const uint64_t first = archive->samples_per_channel;
+    unsigned char * const planes = archive->data;
+
+    archive->table[archive->packets++] = (struct planar_packet) {
+        .logged_microseconds = logged_microseconds,
+        .timestamp_microseconds = header->timestamp_microseconds,
+        .first_sample = first,
+        .samples = frames,
+        .seqnum = header->seqnum,
+        .flags = header->flags,
+    };
+
+    for (size_t ichannel = 0; ichannel < channels; ichannel++) {
+        unsigned char * plane = planes + ichannel * archive->channel_stride;
+        if (3 == header->sizeof_sample)
+            for (size_t iframe = 0; iframe < frames; iframe++) {
+                const unsigned char * in = samples + 3 * (iframe * channels + ichannel);
+                const int32_t value = (int32_t)((uint32_t)in[0] << 8 | (uint32_t)in[1] << 16 | (uint32_t)in[2] << 24) >> 8;
+                memcpy(plane + 4 * (first + iframe), &value, 4);
+            }
+        else if (2 == header->sizeof_sample)
+            for (size_t iframe = 0; iframe < frames; iframe++)
+                memcpy(plane + 2 * (first + iframe), samples + 2 * (iframe * channels + ichannel), 2);
+        else if (4 == header->sizeof_sample)
+            for (size_t iframe = 0; iframe < frames; iframe++)
+                memcpy(plane + 4 * (first + iframe), samples + 4 * (iframe * channels + ichannel), 4);
+        else
+            for (size_t iframe = 0; iframe < frames; iframe++)
+                plane[first + iframe] = samples[iframe * channels + ichannel];
+    }
+
+    archive->samples_per_channel += frames;
+}
+
+int main(int argc, char ** const argv) {
+    /* do some silly stuff to get a progname regardless of runtime environment */
+    const char * s, * progname = argc ? ((s = strrchr(argv[0], '/')) ? s + 1 : argv[0]) : __func__;
+
+    if (argc < 3) {
+        fprintf(stderr, "%s: usage: %s input.bin output.planar, where either may be - for stdin or stdout\n", progname, progname);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE * fh_in = strcmp(argv[1], "-") ? fopen(argv[1], "rb") : stdin;
+    if (!fh_in) NOPE("%s: fopen(%s): %s\n", progname, argv[1], strerror(errno));
+
+    size_t size;
+    unsigned char * data = read_all(fh_in, &size);
+    if (!data) NOPE("%s: could not read %s: %s\n", progname, argv[1], strerror(errno));
+    if (fh_in != stdin) fclose(fh_in);
+
+    /* first find how many samples each channel will have, which determines the layout */
+    struct archive archive = { 0 };
+    const size_t records = for_each_packet(data, size, count, &archive);
+    if (!archive.packets) NOPE("%s: no acoustic packets in %s\n", progname, argv[1]);
+
+    const unsigned dtype = archive.format.flags & 0x7;
+    archive.sizeof_output_sample = 3 == archive.format.sizeof_sample ? 4 : archive.format.sizeof_sample;
+    archive.channel_stride = aligned(archive.samples_per_channel * archive.sizeof_output_sample);
+
+    struct planar_header header = {
+        .magic = "planar",
+        .version = PLANAR_VERSION,
+        .channels = archive.format.channels,
+        .sample_rate = archive.format.sample_rate,
+        .fullscale = 0 == dtype ? 32767.0f : 1 == dtype ? 2147483647.0f : 3 == dtype ? 1.0f : 4 == dtype ? 127.0f : 8388607.0f,
+        .packets = archive.packets,
+        .samples_per_channel = archive.samples_per_channel,
+        .packets_offset = PLANAR_ALIGNMENT,
+        .channels_offset = PLANAR_ALIGNMENT + aligned(archive.packets * sizeof(struct planar_packet)),
+        .channel_stride = archive.channel_stride,
+        .packets_skipped = records - archive.packets,
+    };
+    strcpy(header.dtype, 0 == dtype ? "<i2" : 3 == dtype ? "<f4" : 4 == dtype ? "|i1" : "<i4");
+
+    const size_t size_out = header.channels_offset + header.channels * header.channel_stride;
+    unsigned char * out = calloc(1, size_out);
+    if (!out) NOPE("%s: calloc(%zu): %s\n", progname, size_out, strerror(errno));
+    memcpy(out, &header, sizeof(header));
+
+    /* then fill in the packet table and channels */
+    archive.table = (void *)(out + header.packets_offset);
+    archive.data = out + header.channels_offset;
+    archive.packets = 0;
+    archive.samples_per_channel = 0;
+    for_each_packet(data, size, scatter, &archive);
+
+    FILE * fh_out = strcmp(argv[2], "-") ? fopen(argv[2], "wb") : stdout;
+    if (!fh_out) NOPE("%s: fopen(%s): %s\n", progname, argv[2], strerror(errno));
+    if (fwrite(out, 1, size_out, fh_out) != size_out || fflush(fh_out)) NOPE("%s: fwrite(%s): %s\n", progname, argv[2], strerror(errno));
+    if (fh_out != stdout) fclose(fh_out);
+
+    if (header.packets_skipped)
+        fprintf(stderr, "%s: archived %llu packets, skipped %llu nonacoustic or differently formatted\n",
+                progname, (unsigned long long)header.packets, (unsigned long long)header.packets_skipped);
+
+    free(out);
+    free(data);
+}
@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+# this file maintains a catalog of the chunk files in a directory, giving the logged times of the
+# first and last packets of each, such that a range of time can be located among months of
+# chunks without opening any of them. the catalog is kept in the directory itself and updated
+# incrementally: files are found by their names, which the loggers derive from the second in
+# which each chunk started, and if the directory has not changed since the catalog was written,
+# it is not even listed. where a .summary.json written with LOGGING_SUMMARY is present, the
+# times are taken from it. otherwise no chunk is read, as that would mean decompressing all of
+# it, and its packets are instead known only to lie between the time in its name and that in
+# the name of the next chunk of the same stream. can be imported, or run as a standalone
+# process to list the files overlapping a range of time, e.g.
+# "chunk_catalog.py path /mnt/data start 20240102T030405Z duration 60"
+
+import fcntl
+import gzip
+import json
+import os
+import re
+import sys
+import time
+from collections import namedtuple
+
+catalog_filename = '.chunk_catalog.tsv'
+catalog_version = 2
+
+# the modification time of a directory is only trusted once it is at least this old, as some
+# filesystems, such as the fat of a microsd card, record it to the nearest two seconds
+mtime_settled_ns = 3000000000
+
+# as named by chunk_logger.c, optionally with a stream, and optionally compressed afterwards
+chunk_pattern = re.compile(r'^(\d{8}T\d{6}Z)(?:\.([^.]+))?\.bin(\.gz)?$')
+
+# first and last are logged times of packets in integer unix microseconds. without a summary,
+# first is the time in the name of the file, which is no later than its first packet, and last
+# is None, and if the summary says the chunk is empty, both are None
+chunk_tuple = namedtuple('chunk_tuple', ('filename', 'stream', 'size', 'first', 'last'))
+
+# a chunk named for a second may hold packets from any time within that second
+name_resolution_us = 1000000
+
+def string_to_unix_time_in_microseconds(s):
+    import datetime
+    if 'T' in s and 'Z' in s:
+        return round(datetime.datetime.strptime(s, '%Y%m%dT%H%M%SZ').replace(tzinfo=datetime.timezone.utc).timestamp() * 1000000)
+    return int(s)
+
+def open_chunk(path):
+    return gzip.open(path, 'rb') if path.endswith('.gz') else open(path, 'rb')
+
+# names of the summary of a chunk, possibly compressed
+def summary_filenames(filename):
+    stem = filename[:-len('.gz')] if filename.endswith('.gz') else filename
+    return stem[:-len('.bin')] + '.summary.json', stem[:-len('.bin')] + '.summary.json.gz'
+
+# returns the times given by the summary of a chunk among the given names, or the time in the
+# name of the chunk and None if there is no summary
+def packet_times(directory, filename, names):
+    for summary_filename in summary_filenames(filename):
+        if summary_filename not in names: continue
+        try:
+            with open_chunk(os.path.join(directory, summary_filename)) as f:
+                summary = json.load(f)
+        except (OSError, EOFError, ValueError):
+            continue
+        if not summary['packets'] and not summary['nonacoustic_packets']: return None, None
+        return summary['first_microseconds'], summary['last_microseconds']
+    return string_to_unix_time_in_microseconds(chunk_pattern.match(filename).group(1)), None
+
+def read_catalog(directory):
+    try:
+        with open(os.path.join(directory, catalog_filename), 'r') as f:
+            fcntl.flock(f, fcntl.LOCK_SH)
+            version, directory_mtime_ns = f.readline().split()
+            if int(version) != catalog_version: return None, {}
+            chunks = {}
+            for line in f:
+                filename, size, first, last = line.split()
+                stream = chunk_pattern.match(filename).group(2)
+                chunks[filename] = chunk_tuple(filename, stream, int(size), None if first == '-' else int(first), None if last == '-' else int(last))
+            return int(directory_mtime_ns), chunks
+    except (OSError, ValueError, AttributeError):
+        return None, {}
+
+# rewritten in place under a lock rather than renamed into place, as adding a file to the
+# directory would change the very modification time recorded in the catalog
+def write_catalog(directory, directory_mtime_ns, chunks):
+    try:
+        with open(os.path.join(directory, catalog_filename), 'a') as f:
+            fcntl.flock(f, fcntl.LOCK_EX)
+            f.truncate(0)
+            f.write('%u %u\n' % (catalog_version, directory_mtime_ns))
+            for chunk in chunks:
+                f.write('%s\t%u\t%s\t%s\n' % (chunk.filename, chunk.size, '-' if chunk.first is None else chunk.first, '-' if chunk.last is None else chunk.last))
+    except OSError:
+        # a read-only directory can still be queried, just not as quickly next time
+        pass
+
+# returns every chunk in the directory, sorted by name and therefore by time, updating the
+# catalog first if the directory has changed
+def chunk_catalog(directory):
+    directory_mtime_ns_cached, cached = read_catalog(directory)
+    directory_mtime_ns = os.stat(directory).st_mtime_ns
+    if directory_mtime_ns == directory_mtime_ns_cached and time.time_ns() - directory_mtime_ns > mtime_settled_ns:
+        return sorted(cached.values())
+
+    with os.scandir(directory) as entries:
+        entries = list(entries)
+    names = set(entry.name for entry in entries)
+
+    chunks = []
+    for entry in entries:
+        match = chunk_pattern.match(entry.name)
+        if not match: continue
+
+        try: size = entry.stat().st_size
+        except OSError: continue
+
+        # a summary is emitted after the chunk it describes, so may have appeared since
+        chunk = cached.get(entry.name)
+        if chunk is None or chunk.size != size or (chunk.last is None and chunk.first is not None and names.intersection(summary_filenames(entry.name))):
+            first, last = packet_times(directory, entry.name, names)
+            chunk = chunk_tuple(entry.name, match.group(2), size, first, last)
+        chunks.append(chunk)
+
+    chunks.sort()
+
+    # only if the directory did not change while it was being listed, and recording its time
+    # only if settled, as otherwise a file added within the same tick would never be found
+    if os.stat(directory).st_mtime_ns == directory_mtime_ns:
+        write_catalog(directory, directory_mtime_ns if time.time_ns() - directory_mtime_ns > mtime_settled_ns else 0, chunks)
+    return chunks
+
+# returns the chunks of the given stream, or of the unnamed stream if None, which may contain
+# packets logged within the given range, either end of which may be None. where the time of the
+# last packet of a chunk is not known, it is taken to be before the end of the second named by
+# the next chunk of the stream, or if there is none, to be unbounded, as given by last
+def chunks_overlapping(directory, start=None, stop=None, stream=None):
+    chunks = [chunk for chunk in chunk_catalog(directory) if chunk.stream == stream and chunk.first is not None]
+
+    # from newest to oldest, noting the time named by the next chunk, skipping over any other
+    # file of the same chunk, such as a copy being compressed
+    bounded = []
+    time_named_following = time_named_previous = None
+    for chunk in reversed(chunks):
+        time_named = string_to_unix_time_in_microseconds(chunk_pattern.match(chunk.filename).group(1))
+        if time_named != time_named_previous: time_named_following, time_named_previous = time_named_previous, time_named
+        if chunk.last is None and time_named_following is not None:
+            chunk = chunk._replace(last=time_named_following + name_resolution_us - 1)
+        bounded.append(chunk)
+
+    return [chunk for chunk in reversed(bounded) if (stop is None or chunk.first <= stop) and (start is None or chunk.last is None or chunk.last >= start)]
+
+# if running this as a standalone process rather than importing as a module...
+if __name__ == '__main__':
+    def main():
+        desired_start = None
+        desired_stop = None
+        duration = None
+        path = None
+        stream = None
+
+        # loop over pairs of arguments
+        for key, value in zip(sys.argv[1::2], sys.argv[2::2]):
+            if key == 'path': path = value
+            if key == 'stream': stream = value
+            if key == 'start': desired_start = string_to_unix_time_in_microseconds(value)
+            if key == 'stop': desired_stop = string_to_unix_time_in_microseconds(value)
+            if key == 'duration': duration = round(float(value) * 1e6)
+
+        if path is None:
+            print('usage: %s path directory [stream name] [start time] [stop time | duration seconds]' % sys.argv[0], file=sys.stderr)
+            sys.exit(1)
+
+        if duration is not None:
+            if desired_stop is not None:
+                if desired_start is not None:
+                    raise RuntimeError('interval overspecified')
+                desired_start = desired_stop - duration
+            else: desired_stop = desired_start + duration
+
+        for chunk in chunks_overlapping(path, desired_start, desired_stop, stream):
+            print('%s %u.%06u %s' % (os.path.join(path, chunk.filename), chunk.first // 1000000, chunk.first % 1000000,
+                                     '-' if chunk.last is None else '%u.%06u' % (chunk.last // 1000000, chunk.last % 1000000)))
+
+    main()
@@ -0,0 +1,1196 @@
+/* campbell, isc license */
+
+/* needed for fallocate, sync_file_range, O_DIRECT and asprintf, must occur prior to any include statements */
+#define _GNU_SOURCE
+
+#include "chunk_logger.h"
+#include "metrics.h"
+#include "retention.h"
+#include "chunk_summary.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <limits.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+
+#ifndef O_DIRECT
+#define O_DIRECT 0
+#endif
+
+/* useful macros */
+#define WARNING_ANSI "\x1B[35;1mwarning:\x1B[0m"
+#define ERROR_ANSI "\x1B[31;1merror:\x1B[0m"
+#define NOPE(...) do { fprintf(stderr, ERROR_ANSI " " __VA_ARGS__); exit(EXIT_FAILURE); } while(0)
+#define alloc_sprintf(...) ({ char * _tmp; if (asprintf(&_tmp, __VA_ARGS__) <= 0) abort(); _tmp ; })
+
+/* records are staged in blocks of this size, or the larger size with CHUNK_LOGGER_DIRECT,
+ which are written whole unless a chunk ends or the oldest record in the block has been
+ waiting for STAGING_AGE_MAX_MICROSECONDS */
+#define STAGING_BLOCK_SIZE (1U << 20)
+#define STAGING_BLOCK_SIZE_DIRECT (4U << 20)
+#define STAGING_BLOCKS_MIN 2
+#define STAGING_AGE_MAX_MICROSECONDS 1000000ULL
+
+/* alignment of staging blocks in memory, and with O_DIRECT, of the offset and size of every
+ write, which covers both 512 and 4096 byte logical sectors */
+#define STAGING_ALIGNMENT 4096U
+
+/* the next file is opened this long before the boundary at which it will be needed, or half
+ the duration of a chunk if that is shorter, or once the current file is seven eighths of the
+ way to its maximum size */
+#define PREOPEN_MICROSECONDS 1000000ULL
+
+/* files are written under their final name plus this suffix, and renamed once complete, such
+ that a file with the final name is always whole and has been emitted, and any left with the
+ suffix were being written when a previous logger died */
+#define PARTIAL_SUFFIX ".partial"
+
+/* directory trees in which space is kept free, and how often */
+#define RETENTIONS_MAX 4
+#define RETENTION_INTERVAL_MICROSECONDS 1000000ULL
+
+/* one current, one next, and the rest still being written out and closed */
+#define FILES 8
+
+#define RING_ENTRIES 32
+
+/* not yet present in the uapi headers of many distributions. older kernels fail it with
+ -EINVAL, in which case files are trimmed synchronously instead */
+#define IORING_OP_FTRUNCATE_ 55
+
+enum chunk_op { OP_WRITE = 1, OP_OPEN, OP_FALLOCATE, OP_SYNC, OP_RENAME, OP_FTRUNCATE, OP_CLOSE, OP_UNLINK,
+                OP_SUMMARY_OPEN, OP_SUMMARY_WRITE, OP_SUMMARY_CLOSE, OP_SUMMARY_RENAME };
+
+/* each operation is identified by the top byte of its user data, and what it was done on by
+ the rest, which no user space address reaches */
+#define OP_SHIFT 56
+
+enum chunk_file_state { FILE_FREE = 0, FILE_OPENING, FILE_OPEN, FILE_TRIMMING, FILE_CLOSING, FILE_RENAMING };
+
+struct chunk_file {
+    enum chunk_file_state state;
+    int fd;
+    char * path;
+
+    /* name to which the file is to be renamed, if a gap in the data means that it was opened
+     in advance under the name of a chunk which has no data in it, or once it is complete */
+    char * path_final;
+
+    /* time given by the name of the file, to the second, and time of the first record in it */
+    unsigned long long time_named;
+    unsigned long long time_first;
+
+    /* bytes handed to writes so far, which is also the offset of the next write, and bytes
+     preallocated beyond the end of the file, which must be trimmed before closing */
+    unsigned long long size;
+    unsigned long long size_preallocated;
+
+    /* the last write was padded to the alignment, so must also be trimmed */
+    char padded;
+
+    /* writes and other operations in flight, which must complete before the file is trimmed */
+    unsigned ops_in_flight;
+
+    /* no more writes will be submitted, so trim and close once those in flight are done */
+    char finishing;
+
+    /* opened in advance but never used, so remove rather than emit it once closed */
+    char discard;
+
+    /* with CHUNK_LOGGER_SUMMARY, of the records written to this file so far */
+    struct chunk_summary * summary;
+};
+
+struct chunk_block {
+    unsigned char * data;
+    struct chunk_file * file;
+    unsigned long long offset;
+
+    /* bytes of records staged, and bytes to be written, which differ only with O_DIRECT */
+    size_t size;
+    size_t write_size;
+
+    /* bytes written so far, which is less than write_size only after a short write */
+    size_t written;
+
+    /* host time of the first record staged in this block */
+    unsigned long long time_first;
+    char in_flight;
+
+    /* handed to a write, which will be submitted once the file has been opened */
+    char pending;
+};
+
+/* the summary of a completed file, being written under a .partial name and then renamed */
+struct chunk_sidecar {
+    int fd;
+    char * path;
+    char * path_final;
+
+    char * text;
+    size_t size;
+    size_t written;
+    char failed;
+};
+
+/* a file being removed to keep space free, on behalf of the retention which chose it */
+struct chunk_removal {
+    struct retention * retention;
+    char * path;
+};
+
+struct chunk_logger {
+    char * directory;
+
+    /* follows the timestamp in the name of each file, either .bin or .<stream>.bin */
+    char * suffix;
+    unsigned flags;
+    struct metrics * metrics;
+
+    /* duration of each chunk, with boundaries at multiples of it since the epoch, and maximum
+     size of each file, either of which may be zero for no limit */
+    unsigned long long chunk_microseconds;
+    unsigned long long chunk_bytes;
+    unsigned long long preopen_microseconds;
+
+    struct chunk_file files[FILES];
+
+    struct chunk_block * blocks;
+    size_t blocks_count;
+    size_t block_size;
+
+    /* with O_DIRECT, writes must be multiples of STAGING_ALIGNMENT, otherwise 1 */
+    size_t alignment;
+
+    /* O_DIRECT if requested and supported by the filesystem */
+    int open_flags;
+
+    /* file receiving records, file opened in advance for the next chunk, and block being
+     filled, any of which may be NULL */
+    struct chunk_file * current, * next;
+    struct chunk_block * staging;
+
+    /* start of the chunk following that of the current file, if chunks have a duration */
+    unsigned long long time_next_chunk;
+
+    /* records not logged because every staging block was waiting to be written, or the
+     filesystem was full */
+    unsigned long drops;
+
+    /* trees in which space is kept free, and whether each is on the same filesystem as the
+     logging directory, such that if it cannot be kept free, records are dropped instead */
+    struct retention * retentions[RETENTIONS_MAX];
+    char retention_throttles[RETENTIONS_MAX];
+    size_t retentions_count;
+    unsigned long long time_retention_checked;
+    int short_of_space;
+
+    /* device of each tree, such that one sharing a filesystem with another is left alone while
+     that is still removing files, and removals not yet done */
+    dev_t retention_devices[RETENTIONS_MAX];
+    unsigned removals_in_flight;
+
+    /* summaries still being written */
+    unsigned sidecars_in_flight;
+
+    /* logger in whose trees files completed by this one are noted, which is usually itself */
+    struct chunk_logger * retaining;
+
+    /* -1 if file operations are done synchronously */
+    int ring_fd;
+
+#ifdef HAVE_IO_URING
+    void * sq_ring, * cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+    struct io_uring_sqe * sqes;
+    _Atomic unsigned * sq_head, * sq_tail, * cq_head, * cq_tail;
+    unsigned * sq_array, sq_mask, sq_entries, cq_mask, cq_entries;
+    struct io_uring_cqe * cqes;
+
+    /* operations queued whose completions have yet to be reaped, which must never outnumber the
+     completion queue, or the kernel holds the excess back and fails every later submission with
+     EBUSY until they are reaped */
+    unsigned ring_in_flight;
+#endif
+
+    /* operations, as bits, which the kernel turned out not to support via io_uring */
+    unsigned ops_unsupported;
+};
+
+static unsigned long long monotonic_microseconds(void) {
+    struct timespec timespec;
+    clock_gettime(CLOCK_MONOTONIC, &timespec);
+    return timespec.tv_sec * 1000000ULL + timespec.tv_nsec / 1000UL;
+}
+
+static unsigned long long current_time_in_unix_microseconds(void) {
+    struct timespec timespec;
+    clock_gettime(CLOCK_REALTIME, &timespec);
+    return timespec.tv_sec * 1000000ULL + timespec.tv_nsec / 1000UL;
+}
+
+static char * chunk_path(const char * directory, const char * suffix, const unsigned long long time_microseconds) {
+    /* construct timestamp in ISO 8601 format, no separators, rounded down to seconds */
+    struct tm unixtime_struct;
+    gmtime_r(&(time_t) { time_microseconds / 1000000ULL }, &unixtime_struct);
+    char timestamp[17];
+    strftime(timestamp, 17, "%Y%m%dT%H%M%SZ", &unixtime_struct);
+
+    return alloc_sprintf("%s/%s%s" PARTIAL_SUFFIX, directory, timestamp, suffix);
+}
+
+static void submit(struct chunk_logger * logger, const enum chunk_op op, void * target);
+
+/* trims and closes a file once nothing more will be written to it */
+static void maybe_finish(struct chunk_logger * logger, struct chunk_file * file) {
+    if (!file->finishing || file->ops_in_flight || FILE_OPEN != file->state) return;
+
+    if (file->size_preallocated > file->size || file->padded) {
+        file->state = FILE_TRIMMING;
+        submit(logger, OP_FTRUNCATE, file);
+    } else {
+        file->state = FILE_CLOSING;
+        submit(logger, OP_CLOSE, file);
+    }
+}
+
+/* if the kernel predates an operation, do it and all further ones synchronously instead */
+static int retried_synchronously(struct chunk_logger * logger, const enum chunk_op op, void * target, const long long res) {
+    if (-EINVAL != res || -1 == logger->ring_fd || (logger->ops_unsupported & 1U << op)) return 0;
+    logger->ops_unsupported |= 1U << op;
+    submit(logger, op, target);
+    return 1;
+}
+
+/* starts writing the summary of a completed file alongside it, named as the file but ending in
+ .summary.json rather than .bin, in the same way as the file itself, such that it is emitted
+ after the file it describes, and then removed along with it */
+static void start_summary(struct chunk_logger * logger, struct chunk_file * file) {
+    struct chunk_sidecar * sidecar = calloc(1, sizeof(*sidecar));
+    if (!sidecar) abort();
+
+    sidecar->fd = -1;
+    sidecar->path_final = alloc_sprintf("%.*s.summary.json", (int)(strlen(file->path) - strlen(".bin")), file->path);
+    sidecar->path = alloc_sprintf("%s" PARTIAL_SUFFIX, sidecar->path_final);
+    sidecar->text = chunk_summary_format(file->summary, strrchr(file->path, '/') + 1, &sidecar->size);
+    if (!sidecar->text) abort();
+
+    chunk_summary_free(file->summary);
+    file->summary = NULL;
+
+    logger->sidecars_in_flight++;
+    submit(logger, OP_SUMMARY_OPEN, sidecar);
+}
+
+static void sidecar_free(struct chunk_logger * logger, struct chunk_sidecar * sidecar) {
+    free(sidecar->text);
+    free(sidecar->path_final);
+    free(sidecar->path);
+    free(sidecar);
+    logger->sidecars_in_flight--;
+}
+
+/* advances the state of whatever the given operation was done on, given its result */
+static void complete(struct chunk_logger * logger, const enum chunk_op op, void * target, const long long res) {
+    if (OP_WRITE == op) {
+        struct chunk_block * block = target;
+        struct chunk_file * file = block->file;
+
+        if (res <= 0) NOPE("%s: write(%s): %s\n", __func__, file->path, res ? strerror(-res) : "no progress");
+
+        /* resubmit the remainder of a short write */
+        block->written += res;
+        if (block->written < block->write_size) {
+            submit(logger, OP_WRITE, block);
+            return;
+        }
+
+        block->in_flight = 0;
+        file->ops_in_flight--;
+
+        /* records are only on disk once the whole block has been written, so the oldest of them
+         has waited this long, unless the clock has since jumped backwards */
+        if (logger->metrics) {
+            const unsigned long long now = current_time_in_unix_microseconds();
+            metrics_histogram_record(&logger->metrics->publish_to_disk, now > block->time_first ? now - block->time_first : 0);
+        }
+
+        /* start writeback of anything the filesystem has buffered, which is nothing if
+         O_DIRECT is in effect, so that the page cache never holds more than a block or so */
+        if (logger->flags & CHUNK_LOGGER_DIRECT) {
+            file->ops_in_flight++;
+            submit(logger, OP_SYNC, file);
+        }
+        maybe_finish(logger, file);
+    }
+    else if (OP_OPEN == op) {
+        struct chunk_file * file = target;
+
+        if (-EINVAL == res && (logger->open_flags & O_DIRECT)) {
+            fprintf(stderr, WARNING_ANSI " %s: %s does not support O_DIRECT, writing via the page cache\n", __func__, logger->directory);
+            logger->open_flags &= ~O_DIRECT;
+            submit(logger, OP_OPEN, file);
+            return;
+        }
+        if (res < 0) NOPE("%s: open(%s): %s\n", __func__, file->path, strerror(-res));
+
+        file->fd = res;
+        file->state = FILE_OPEN;
+
+        if (file->size_preallocated) {
+            file->ops_in_flight++;
+            submit(logger, OP_FALLOCATE, file);
+        }
+
+        if (file->path_final) {
+            file->ops_in_flight++;
+            submit(logger, OP_RENAME, file);
+        }
+
+        for (size_t iblock = 0; iblock < logger->blocks_count; iblock++)
+            if (logger->blocks[iblock].pending && file == logger->blocks[iblock].file) {
+                logger->blocks[iblock].pending = 0;
+                submit(logger, OP_WRITE, logger->blocks + iblock);
+            }
+
+        maybe_finish(logger, file);
+    }
+    else if (OP_FALLOCATE == op || OP_SYNC == op) {
+        struct chunk_file * file = target;
+
+        /* not every filesystem supports these, and they are only optimizations */
+        if (OP_FALLOCATE == op && res < 0) file->size_preallocated = 0;
+
+        file->ops_in_flight--;
+        maybe_finish(logger, file);
+    }
+    else if (OP_RENAME == op) {
+        struct chunk_file * file = target;
+        if (retried_synchronously(logger, op, target, res)) return;
+        if (res < 0) NOPE("%s: rename(%s, %s): %s\n", __func__, file->path, file->path_final, strerror(-res));
+
+        free(file->path);
+        file->path = file->path_final;
+        file->path_final = NULL;
+
+        if (FILE_RENAMING == file->state) {
+            printf("%s\n", file->path);
+            if (logger->metrics) metrics_add(&logger->metrics->files_logged, 1);
+            if (file->summary) start_summary(logger, file);
+
+            for (size_t iretention = 0; iretention < logger->retaining->retentions_count; iretention++)
+                retention_add(logger->retaining->retentions[iretention], file->path, file->size);
+
+            free(file->path);
+            memset(file, 0, sizeof(*file));
+            file->fd = -1;
+            return;
+        }
+
+        file->ops_in_flight--;
+        maybe_finish(logger, file);
+    }
+    else if (OP_FTRUNCATE == op) {
+        struct chunk_file * file = target;
+        if (retried_synchronously(logger, op, target, res)) return;
+        if (res < 0) fprintf(stderr, WARNING_ANSI " %s: ftruncate(%s): %s\n", __func__, file->path, strerror(-res));
+
+        file->state = FILE_CLOSING;
+        submit(logger, OP_CLOSE, file);
+    }
+    else if (OP_CLOSE == op) {
+        struct chunk_file * file = target;
+        if (res < 0) NOPE("%s: close(%s): %s\n", __func__, file->path, strerror(-res));
+
+        /* only once all of its data has been written and the file closed does it get its final
+         name, after which it is emitted */
+        if (!file->discard) {
+            file->path_final = strndup(file->path, strlen(file->path) - strlen(PARTIAL_SUFFIX));
+            if (!file->path_final) abort();
+            file->state = FILE_RENAMING;
+            submit(logger, OP_RENAME, file);
+            return;
+        }
+
+        unlink(file->path);
+        free(file->path);
+        chunk_summary_free(file->summary);
+        memset(file, 0, sizeof(*file));
+        file->fd = -1;
+    }
+    else if (OP_UNLINK == op) {
+        struct chunk_removal * removal = target;
+        if (retried_synchronously(logger, op, target, res)) return;
+
+        retention_removed(removal->retention, removal->path, res);
+        free(removal);
+        logger->removals_in_flight--;
+    }
+
+    /* a summary is only an aid to finding data, so failing to write one is not fatal */
+    else if (OP_SUMMARY_OPEN == op) {
+        struct chunk_sidecar * sidecar = target;
+        if (res < 0) {
+            fprintf(stderr, WARNING_ANSI " %s: open(%s): %s\n", __func__, sidecar->path, strerror(-res));
+            sidecar_free(logger, sidecar);
+            return;
+        }
+
+        sidecar->fd = res;
+        submit(logger, OP_SUMMARY_WRITE, sidecar);
+    }
+    else if (OP_SUMMARY_WRITE == op) {
+        struct chunk_sidecar * sidecar = target;
+        if (res <= 0) {
+            fprintf(stderr, WARNING_ANSI " %s: write(%s): %s\n", __func__, sidecar->path, res ? strerror(-res) : "no progress");
+            sidecar->failed = 1;
+        }
+        else if ((sidecar->written += res) < sidecar->size) {
+            submit(logger, OP_SUMMARY_WRITE, sidecar);
+            return;
+        }
+
+        submit(logger, OP_SUMMARY_CLOSE, sidecar);
+    }
+    else if (OP_SUMMARY_CLOSE == op) {
+        struct chunk_sidecar * sidecar = target;
+        if (res < 0) {
+            fprintf(stderr, WARNING_ANSI " %s: close(%s): %s\n", __func__, sidecar->path, strerror(-res));
+            sidecar->failed = 1;
+        }
+
+        if (sidecar->failed) {
+            unlink(sidecar->path);
+            sidecar_free(logger, sidecar);
+            return;
+        }
+
+        submit(logger, OP_SUMMARY_RENAME, sidecar);
+    }
+    else if (OP_SUMMARY_RENAME == op) {
+        struct chunk_sidecar * sidecar = target;
+        if (retried_synchronously(logger, op, target, res)) return;
+
+        if (res < 0) fprintf(stderr, WARNING_ANSI " %s: rename(%s, %s): %s\n", __func__, sidecar->path, sidecar->path_final, strerror(-res));
+        else {
+            printf("%s\n", sidecar->path_final);
+            for (size_t iretention = 0; iretention < logger->retaining->retentions_count; iretention++)
+                retention_add(logger->retaining->retentions[iretention], sidecar->path_final, sidecar->size);
+        }
+        sidecar_free(logger, sidecar);
+    }
+}
+
+/* does the given operation synchronously, returning its result as io_uring would */
+static long long perform(struct chunk_logger * logger, const enum chunk_op op, void * target) {
+    long long res = 0;
+    if (OP_WRITE == op) {
+        struct chunk_block * block = target;
+        res = pwrite(block->file->fd, block->data + block->written, block->write_size - block->written, block->offset + block->written);
+    }
+    else if (OP_OPEN == op) {
+        struct chunk_file * file = target;
+        res = open(file->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | logger->open_flags, 0666);
+    }
+    else if (OP_FALLOCATE == op) {
+        struct chunk_file * file = target;
+#ifdef __linux__
+        res = fallocate(file->fd, FALLOC_FL_KEEP_SIZE, 0, file->size_preallocated);
+#else
+        (void)file;
+        res = -1;
+        errno = EOPNOTSUPP;
+#endif
+    }
+    else if (OP_SYNC == op) {
+        struct chunk_file * file = target;
+#ifdef __linux__
+        res = sync_file_range(file->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#else
+        (void)file;
+#endif
+    }
+    else if (OP_RENAME == op) {
+        struct chunk_file * file = target;
+        res = rename(file->path, file->path_final);
+    }
+    else if (OP_FTRUNCATE == op) {
+        struct chunk_file * file = target;
+        res = ftruncate(file->fd, file->size);
+    }
+    else if (OP_CLOSE == op) {
+        struct chunk_file * file = target;
+        res = close(file->fd);
+    }
+    else if (OP_UNLINK == op) {
+        struct chunk_removal * removal = target;
+        res = unlink(removal->path);
+    }
+    else if (OP_SUMMARY_OPEN == op) {
+        struct chunk_sidecar * sidecar = target;
+        res = open(sidecar->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    }
+    else if (OP_SUMMARY_WRITE == op) {
+        struct chunk_sidecar * sidecar = target;
+        res = pwrite(sidecar->fd, sidecar->text + sidecar->written, sidecar->size - sidecar->written, sidecar->written);
+    }
+    else if (OP_SUMMARY_CLOSE == op) {
+        struct chunk_sidecar * sidecar = target;
+        res = close(sidecar->fd);
+    }
+    else if (OP_SUMMARY_RENAME == op) {
+        struct chunk_sidecar * sidecar = target;
+        res = rename(sidecar->path, sidecar->path_final);
+    }
+    return -1 == res ? -errno : res;
+}
+
+#ifdef HAVE_IO_URING
+static int io_uring_enter_(const int fd, const unsigned to_submit, const unsigned min_complete, const unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static void wait_for_completion(struct chunk_logger * logger);
+
+static void queue(struct chunk_logger * logger, const enum chunk_op op, void * target) {
+    /* removals and summaries are not otherwise bounded, so make room for the completion first.
+     this handles others, which may queue further operations of their own */
+    while (logger->ring_in_flight >= logger->cq_entries) wait_for_completion(logger);
+    logger->ring_in_flight++;
+
+    const unsigned tail = atomic_load_explicit(logger->sq_tail, memory_order_relaxed);
+
+    /* every entry is submitted as soon as it is queued, so the kernel has consumed them all */
+    const unsigned index = tail & logger->sq_mask;
+    struct io_uring_sqe * sqe = logger->sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (uint64_t)op << OP_SHIFT | (uintptr_t)target;
+
+    if (OP_WRITE == op) {
+        struct chunk_block * block = target;
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = block->file->fd;
+        sqe->addr = (uintptr_t)(block->data + block->written);
+        sqe->len = block->write_size - block->written;
+        sqe->off = block->offset + block->written;
+    }
+    else if (OP_OPEN == op) {
+        struct chunk_file * file = target;
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uintptr_t)file->path;
+        sqe->len = 0666;
+        sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | logger->open_flags;
+    }
+    else if (OP_FALLOCATE == op) {
+        struct chunk_file * file = target;
+        sqe->opcode = IORING_OP_FALLOCATE;
+        sqe->fd = file->fd;
+        sqe->off = 0;
+        sqe->addr = file->size_preallocated;
+        sqe->len = FALLOC_FL_KEEP_SIZE;
+    }
+    else if (OP_SYNC == op) {
+        struct chunk_file * file = target;
+        sqe->opcode = IORING_OP_SYNC_FILE_RANGE;
+        sqe->fd = file->fd;
+        sqe->sync_range_flags = SYNC_FILE_RANGE_WRITE;
+    }
+    else if (OP_RENAME == op) {
+        struct chunk_file * file = target;
+        sqe->opcode = IORING_OP_RENAMEAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uintptr_t)file->path;
+        sqe->len = AT_FDCWD;
+        sqe->addr2 = (uintptr_t)file->path_final;
+    }
+    else if (OP_FTRUNCATE == op) {
+        struct chunk_file * file = target;
+        sqe->opcode = IORING_OP_FTRUNCATE_;
+        sqe->fd = file->fd;
+        sqe->off = file->size;
+    }
+    else if (OP_CLOSE == op) {
+        struct chunk_file * file = target;
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = file->fd;
+    }
+    else if (OP_UNLINK == op) {
+        struct chunk_removal * removal = target;
+        sqe->opcode = IORING_OP_UNLINKAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uintptr_t)removal->path;
+    }
+    else if (OP_SUMMARY_OPEN == op) {
+        struct chunk_sidecar * sidecar = target;
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uintptr_t)sidecar->path;
+        sqe->len = 0666;
+        sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    }
+    else if (OP_SUMMARY_WRITE == op) {
+        struct chunk_sidecar * sidecar = target;
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = sidecar->fd;
+        sqe->addr = (uintptr_t)(sidecar->text + sidecar->written);
+        sqe->len = sidecar->size - sidecar->written;
+        sqe->off = sidecar->written;
+    }
+    else if (OP_SUMMARY_CLOSE == op) {
+        struct chunk_sidecar * sidecar = target;
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = sidecar->fd;
+    }
+    else if (OP_SUMMARY_RENAME == op) {
+        struct chunk_sidecar * sidecar = target;
+        sqe->opcode = IORING_OP_RENAMEAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uintptr_t)sidecar->path;
+        sqe->len = AT_FDCWD;
+        sqe->addr2 = (uintptr_t)sidecar->path_final;
+    }
+
+    logger->sq_array[index] = index;
+    atomic_store_explicit(logger->sq_tail, tail + 1, memory_order_release);
+
+    while (-1 == io_uring_enter_(logger->ring_fd, 1, 0, 0))
+        if (EINTR != errno && EAGAIN != errno)
+            NOPE("%s: io_uring_enter(): %s\n", __func__, strerror(errno));
+}
+
+/* handles whatever operations have completed, without waiting. each is consumed before being
+ handled, as handling it may queue and so reap others */
+static void reap(struct chunk_logger * logger) {
+    unsigned head;
+    while ((head = atomic_load_explicit(logger->cq_head, memory_order_relaxed)) != atomic_load_explicit(logger->cq_tail, memory_order_acquire)) {
+        const struct io_uring_cqe * cqe = logger->cqes + (head & logger->cq_mask);
+        const uint64_t user_data = cqe->user_data;
+        const int res = cqe->res;
+        atomic_store_explicit(logger->cq_head, head + 1, memory_order_release);
+        logger->ring_in_flight--;
+
+        complete(logger, user_data >> OP_SHIFT, (void *)(uintptr_t)(user_data & ((1ULL << OP_SHIFT) - 1)), res);
+    }
+}
+
+static void wait_for_completion(struct chunk_logger * logger) {
+    if (-1 == io_uring_enter_(logger->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) && EINTR != errno)
+        NOPE("%s: io_uring_enter(): %s\n", __func__, strerror(errno));
+    reap(logger);
+}
+
+/* the completion queue is sized for every staging block being written at once along with the
+ operations on each file, so that queue() rarely has to wait for room even when removals and
+ summaries are also under way */
+static int ring_setup(struct chunk_logger * logger) {
+    struct io_uring_params params = { .flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP };
+    params.cq_entries = logger->blocks_count + FILES + RING_ENTRIES > 2 * RING_ENTRIES ? logger->blocks_count + FILES + RING_ENTRIES : 2 * RING_ENTRIES;
+    const int fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if (-1 == fd) return -1;
+
+    /* openat, close, fallocate and plain writes all arrived in 5.6 along with this flag */
+    if (!(params.features & IORING_FEAT_CUR_PERSONALITY)) {
+        close(fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    logger->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    logger->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        logger->sq_ring_size = logger->cq_ring_size = logger->sq_ring_size > logger->cq_ring_size ? logger->sq_ring_size : logger->cq_ring_size;
+
+    logger->sq_ring = mmap(NULL, logger->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    logger->cq_ring = MAP_FAILED == logger->sq_ring ? MAP_FAILED : (params.features & IORING_FEAT_SINGLE_MMAP) ? logger->sq_ring :
+        mmap(NULL, logger->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    logger->sqes = MAP_FAILED == logger->cq_ring ? MAP_FAILED :
+        mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+    if (MAP_FAILED == logger->sqes) {
+        const int errno_mmap = errno;
+        if (MAP_FAILED != logger->cq_ring && logger->cq_ring != logger->sq_ring) munmap(logger->cq_ring, logger->cq_ring_size);
+        if (MAP_FAILED != logger->sq_ring) munmap(logger->sq_ring, logger->sq_ring_size);
+        close(fd);
+        errno = errno_mmap;
+        return -1;
+    }
+
+    unsigned char * sq = logger->sq_ring, * cq = logger->cq_ring;
+    logger->sq_head = (void *)(sq + params.sq_off.head);
+    logger->sq_tail = (void *)(sq + params.sq_off.tail);
+    logger->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    logger->sq_array = (void *)(sq + params.sq_off.array);
+    logger->sq_entries = params.sq_entries;
+    logger->cq_head = (void *)(cq + params.cq_off.head);
+    logger->cq_tail = (void *)(cq + params.cq_off.tail);
+    logger->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    logger->cq_entries = params.cq_entries;
+    logger->cqes = (void *)(cq + params.cq_off.cqes);
+
+    logger->ring_fd = fd;
+    return 0;
+}
+
+static void ring_teardown(struct chunk_logger * logger) {
+    munmap(logger->sqes, logger->sq_entries * sizeof(struct io_uring_sqe));
+    if (logger->cq_ring != logger->sq_ring) munmap(logger->cq_ring, logger->cq_ring_size);
+    munmap(logger->sq_ring, logger->sq_ring_size);
+    close(logger->ring_fd);
+}
+#endif
+
+static void submit(struct chunk_logger * logger, const enum chunk_op op, void * target) {
+#ifdef HAVE_IO_URING
+    if (-1 != logger->ring_fd && !(logger->ops_unsupported & 1U << op)) {
+        queue(logger, op, target);
+        return;
+    }
+#endif
+    complete(logger, op, target, perform(logger, op, target));
+}
+
+/* handles whatever operations have completed, waiting for at least one if asked */
+static void poll_completions(struct chunk_logger * logger, const int wait) {
+#ifdef HAVE_IO_URING
+    if (-1 == logger->ring_fd) return;
+    if (wait) wait_for_completion(logger);
+    else reap(logger);
+#else
+    (void)logger;
+    (void)wait;
+#endif
+}
+
+/* whether the caller must not be made to wait, which is only possible with io_uring */
+static int nonblocking(const struct chunk_logger * logger) {
+    return (logger->flags & CHUNK_LOGGER_NONBLOCKING) && -1 != logger->ring_fd;
+}
+
+/* starts opening a file, returning NULL if every file is still being written out and the
+ caller must not wait */
+static struct chunk_file * file_start(struct chunk_logger * logger, const unsigned long long time_named, const unsigned long long size_preallocated) {
+    struct chunk_file * file;
+    while (1) {
+        for (file = logger->files; file < logger->files + FILES && FILE_FREE != file->state; file++);
+        if (file < logger->files + FILES) break;
+        if (nonblocking(logger)) return NULL;
+        poll_completions(logger, 1);
+    }
+
+    file->state = FILE_OPENING;
+    file->path = chunk_path(logger->directory, logger->suffix, time_named);
+    file->time_named = time_named;
+    file->size_preallocated = size_preallocated;
+    if ((logger->flags & CHUNK_LOGGER_SUMMARY) && !(file->summary = chunk_summary_create())) abort();
+    submit(logger, OP_OPEN, file);
+    return file;
+}
+
+/* returns a block which is not waiting to be written, or NULL if there are none and the
+ caller must not wait */
+static struct chunk_block * block_get(struct chunk_logger * logger) {
+    while (1) {
+        for (size_t iblock = 0; iblock < logger->blocks_count; iblock++)
+            if (!logger->blocks[iblock].in_flight && logger->blocks + iblock != logger->staging)
+                return logger->blocks + iblock;
+        if (nonblocking(logger)) return NULL;
+        poll_completions(logger, 1);
+    }
+}
+
+static void block_stage(struct chunk_logger * logger, struct chunk_block * block, struct chunk_file * file,
+                        const unsigned long long offset, const unsigned long long time_microseconds) {
+    block->file = file;
+    block->offset = offset;
+    block->size = 0;
+    block->written = 0;
+    block->time_first = time_microseconds;
+    logger->staging = block;
+}
+
+/* hands the block being filled to a write. with O_DIRECT, only whole multiples of the
+ alignment can be written, so unless this is the last block of the file, any remainder is
+ moved to the start of the given fresh block, which then becomes the one being filled, and
+ otherwise the block is padded with zeros and the file trimmed once it is complete */
+static void flush(struct chunk_logger * logger, struct chunk_block * fresh, const unsigned long long time_microseconds) {
+    struct chunk_block * block = logger->staging;
+    if (!block) return;
+    logger->staging = NULL;
+
+    struct chunk_file * file = block->file;
+    const size_t alignment = logger->alignment;
+
+    if (fresh) {
+        block->write_size = block->size & ~(alignment - 1);
+        file->size = block->offset + block->write_size;
+
+        block_stage(logger, fresh, file, file->size, time_microseconds);
+        fresh->size = block->size - block->write_size;
+        memcpy(fresh->data, block->data + block->write_size, fresh->size);
+    } else {
+        block->write_size = (block->size + alignment - 1) & ~(alignment - 1);
+        memset(block->data + block->size, 0, block->write_size - block->size);
+        file->size = block->offset + block->size;
+        if (block->write_size != block->size) file->padded = 1;
+    }
+
+    if (!block->write_size) return;
+
+    file->ops_in_flight++;
+    block->in_flight = 1;
+
+    if (FILE_OPENING == file->state) block->pending = 1;
+    else submit(logger, OP_WRITE, block);
+}
+
+static void finish(struct chunk_logger * logger, struct chunk_file * file) {
+    file->finishing = 1;
+    maybe_finish(logger, file);
+}
+
+/* bytes in the current file so far, including any still being staged */
+static unsigned long long current_size(const struct chunk_logger * logger) {
+    return logger->current->size + (logger->staging && logger->current == logger->staging->file ? logger->staging->size : 0);
+}
+
+/* closes the current file if any, and makes a new one current, named for the boundary at
+ which it was opened in advance if the given time is in that chunk, or otherwise for the given
+ time, such as after a gap in the data or a rotation by size, in which case the file opened in
+ advance is renamed. if no file could be started without waiting, carries on with the current
+ one, which remains a valid if longer chunk */
+static void rotate(struct chunk_logger * logger, const unsigned long long time_microseconds) {
+    const unsigned long long time_rotation_started = monotonic_microseconds();
+    const unsigned long long time_chunk = logger->chunk_microseconds ? time_microseconds - time_microseconds % logger->chunk_microseconds : 0;
+
+    struct chunk_file * file = logger->next;
+    const unsigned long long time_named = file && logger->chunk_microseconds && file->time_named == time_chunk ? time_chunk : time_microseconds;
+
+    if (!file && !(file = file_start(logger, time_named, 0))) return;
+    logger->next = NULL;
+
+    if (file->time_named / 1000000ULL != time_named / 1000000ULL) {
+        file->path_final = chunk_path(logger->directory, logger->suffix, time_named);
+        file->time_named = time_named;
+        if (FILE_OPEN == file->state) {
+            file->ops_in_flight++;
+            submit(logger, OP_RENAME, file);
+        }
+    }
+
+    const int rotating = NULL != logger->current;
+    if (rotating) {
+        flush(logger, NULL, time_microseconds);
+        finish(logger, logger->current);
+    }
+
+    logger->current = file;
+    logger->current->time_first = time_microseconds;
+    logger->time_next_chunk = logger->chunk_microseconds ? time_chunk + logger->chunk_microseconds : ULLONG_MAX;
+
+    if (rotating && logger->metrics)
+        metrics_histogram_record(&logger->metrics->rotation_latency, monotonic_microseconds() - time_rotation_started);
+}
+
+/* opens the file for the next chunk, preallocating as much as the current chunk will contain
+ at the rate seen so far, plus an eighth, but no more than the maximum size. if opened ahead of
+ a rotation by size, the name is provisional, and must not be that of the current file */
+static void preopen(struct chunk_logger * logger, const unsigned long long time_microseconds, const int by_time) {
+    const struct chunk_file * current = logger->current;
+    const unsigned long long elapsed = time_microseconds - current->time_first;
+    const unsigned long long size = current_size(logger);
+
+    unsigned long long size_preallocated = logger->chunk_bytes;
+    if (logger->chunk_microseconds && time_microseconds > current->time_first && elapsed >= 100000ULL && size) {
+        const double estimate = 1.125 * size * logger->chunk_microseconds / elapsed;
+        if (!size_preallocated || estimate < size_preallocated)
+            size_preallocated = estimate < 4e9 ? (unsigned long long)estimate : 4000000000ULL;
+    }
+    size_preallocated = (size_preallocated + STAGING_ALIGNMENT - 1) & ~(unsigned long long)(STAGING_ALIGNMENT - 1);
+
+    const unsigned long long time_after_current = (current->time_named / 1000000ULL + 1) * 1000000ULL;
+    const unsigned long long time_named = by_time ? logger->time_next_chunk : time_microseconds > time_after_current ? time_microseconds : time_after_current;
+
+    logger->next = file_start(logger, time_named, size_preallocated);
+}
+
+/* finishes any files left behind by a logger which did not exit cleanly, keeping every whole
+ record, that is everything before the first header which is entirely zero or which runs past
+ the end of the file, such as where a write was torn or padded. an empty frame has a nonzero
+ timestamp, so is an eight byte record like any other. each is then renamed and emitted as if it
+ had been completed normally, or removed if it contains no records */
+static int recover(const char * directory, const char * suffix, struct metrics * metrics) {
+    DIR * dir = opendir(directory);
+    if (!dir) return -1;
+
+    /* only files of this stream, given that several may share a directory */
+    char * partial_suffix = alloc_sprintf("%s" PARTIAL_SUFFIX, suffix);
+    for (struct dirent * entry; (entry = readdir(dir)); ) {
+        const size_t length = strlen(entry->d_name);
+        if (length != strlen("YYYYmmddTHHMMSSZ") + strlen(partial_suffix) || strcmp(entry->d_name + length - strlen(partial_suffix), partial_suffix)) continue;
+
+        char * path = alloc_sprintf("%s/%s", directory, entry->d_name);
+        const int fd = open(path, O_RDWR | O_CLOEXEC);
+        struct stat st;
+        if (-1 == fd || -1 == fstat(fd, &st)) {
+            fprintf(stderr, WARNING_ANSI " %s: %s: %s\n", __func__, path, strerror(errno));
+            if (-1 != fd) close(fd);
+            free(path);
+            continue;
+        }
+
+        /* only the headers need be read to find the end of the last whole record */
+        off_t size = 0;
+        for (uint64_t header; size + 8 <= st.st_size && 8 == pread(fd, &header, 8, size); ) {
+            const off_t record_size = 8 + (((header & 0xFFFF) + 7) & ~7ULL);
+            if (!header || size + record_size > st.st_size) break;
+            size += record_size;
+        }
+
+        /* also frees whatever was preallocated */
+        if (-1 == ftruncate(fd, size))
+            fprintf(stderr, WARNING_ANSI " %s: ftruncate(%s): %s\n", __func__, path, strerror(errno));
+        close(fd);
+
+        if (!size) {
+            unlink(path);
+            free(path);
+            continue;
+        }
+
+        char * path_final = strndup(path, strlen(path) - strlen(PARTIAL_SUFFIX));
+        if (!path_final) abort();
+        if (-1 == rename(path, path_final))
+            fprintf(stderr, WARNING_ANSI " %s: rename(%s, %s): %s\n", __func__, path, path_final, strerror(errno));
+        else {
+            fprintf(stderr, WARNING_ANSI " %s: recovered %lld of %lld bytes of %s\n", __func__, (long long)size, (long long)st.st_size, path);
+            printf("%s\n", path_final);
+            if (metrics) metrics_add(&metrics->files_logged, 1);
+        }
+
+        free(path_final);
+        free(path);
+    }
+
+    free(partial_suffix);
+    closedir(dir);
+    return 0;
+}
+
+struct chunk_logger * chunk_logger_open(const char * directory, const char * stream, const unsigned long long chunk_microseconds, const unsigned long long chunk_bytes,
+                                        const size_t staging_size, const unsigned flags, struct metrics * metrics) {
+    char * suffix = stream ? alloc_sprintf(".%s.bin", stream) : alloc_sprintf(".bin");
+    struct chunk_logger * logger = -1 != recover(directory, suffix, metrics) ? calloc(1, sizeof(*logger)) : NULL;
+    if (!logger) {
+        free(suffix);
+        return NULL;
+    }
+
+    logger->directory = strdup(directory);
+    logger->suffix = suffix;
+    logger->flags = flags;
+    logger->metrics = metrics;
+    logger->retaining = logger;
+    logger->ring_fd = -1;
+
+    logger->chunk_microseconds = chunk_microseconds;
+    logger->chunk_bytes = chunk_bytes;
+    logger->preopen_microseconds = chunk_microseconds && chunk_microseconds / 2 < PREOPEN_MICROSECONDS ? chunk_microseconds / 2 : PREOPEN_MICROSECONDS;
+
+    logger->block_size = (flags & CHUNK_LOGGER_DIRECT) ? STAGING_BLOCK_SIZE_DIRECT : STAGING_BLOCK_SIZE;
+    logger->blocks_count = staging_size / logger->block_size > STAGING_BLOCKS_MIN ? staging_size / logger->block_size : STAGING_BLOCKS_MIN;
+    logger->alignment = (flags & CHUNK_LOGGER_DIRECT) ? STAGING_ALIGNMENT : 1;
+    logger->open_flags = (flags & CHUNK_LOGGER_DIRECT) ? O_DIRECT : 0;
+
+    for (size_t ifile = 0; ifile < FILES; ifile++)
+        logger->files[ifile].fd = -1;
+
+    if (!(logger->blocks = calloc(logger->blocks_count, sizeof(*logger->blocks)))) {
+        free(logger->suffix);
+        free(logger->directory);
+        free(logger);
+        return NULL;
+    }
+
+    for (size_t iblock = 0; iblock < logger->blocks_count; iblock++)
+        if (!(logger->blocks[iblock].data = aligned_alloc(STAGING_ALIGNMENT, logger->block_size))) {
+            fprintf(stderr, "error: %s: aligned_alloc(): %s\n", __func__, strerror(errno));
+            chunk_logger_close(logger);
+            return NULL;
+        }
+
+#ifdef HAVE_IO_URING
+    if (!(flags & CHUNK_LOGGER_SYNCHRONOUS) && -1 == ring_setup(logger))
+        fprintf(stderr, "warning: %s: io_uring unavailable (%s), writing synchronously\n", __func__, strerror(errno));
+#endif
+
+    return logger;
+}
+
+int chunk_logger_retain(struct chunk_logger * logger, const char * directory, const unsigned long long free_bytes_min, const unsigned flags) {
+    struct stat st_logging, st;
+    if (logger->retentions_count == RETENTIONS_MAX || -1 == stat(logger->directory, &st_logging) || -1 == stat(directory, &st)) return -1;
+
+    struct retention * retention = retention_open(directory, free_bytes_min, flags);
+    if (!retention) return -1;
+
+    logger->retention_throttles[logger->retentions_count] = st.st_dev == st_logging.st_dev;
+    logger->retention_devices[logger->retentions_count] = st.st_dev;
+    logger->retentions[logger->retentions_count++] = retention;
+    return 0;
+}
+
+void chunk_logger_retain_alongside(struct chunk_logger * logger, struct chunk_logger * other) {
+    logger->retaining = other;
+}
+
+/* removes a file chosen by a retention without waiting for it */
+static void unlink_file(void * context, struct retention * retention, char * path) {
+    struct chunk_logger * logger = context;
+    struct chunk_removal * removal = malloc(sizeof(*removal));
+    if (!removal) abort();
+    *removal = (struct chunk_removal) { .retention = retention, .path = path };
+
+    logger->removals_in_flight++;
+    submit(logger, OP_UNLINK, removal);
+}
+
+/* frees space as needed, and notes whether the logging filesystem is still short of it. where
+ several trees share a filesystem, a later one is only checked once removals from those
+ before it, which hold older files, are done */
+static void retain(struct chunk_logger * logger) {
+    unsigned removed = 0;
+    int short_of_space = 0;
+    for (size_t iretention = 0; iretention < logger->retentions_count; iretention++) {
+        size_t iearlier = 0;
+        while (iearlier < iretention && !(logger->retention_devices[iearlier] == logger->retention_devices[iretention] &&
+                                          retention_removals_in_flight(logger->retentions[iearlier]))) iearlier++;
+        if (iearlier < iretention) continue;
+
+        int short_here;
+        removed += retention_check(logger->retentions[iretention], unlink_file, logger, &short_here);
+        if (logger->retention_throttles[iretention] && short_here) short_of_space = 1;
+    }
+
+    if (logger->metrics && removed) metrics_add(&logger->metrics->files_removed, removed);
+    logger->short_of_space = short_of_space;
+}
+
+void chunk_logger_advance(struct chunk_logger * logger, const unsigned long long time_microseconds) {
+    poll_completions(logger, 0);
+
+    if (logger->current && time_microseconds >= logger->time_next_chunk) {
+        flush(logger, NULL, time_microseconds);
+        finish(logger, logger->current);
+        logger->current = NULL;
+    }
+}
+
+void chunk_logger_write(struct chunk_logger * logger, const void * record, const size_t size, const unsigned long long time_microseconds) {
+    poll_completions(logger, 0);
+
+    if (logger->retentions_count && (time_microseconds - logger->time_retention_checked >= RETENTION_INTERVAL_MICROSECONDS ||
+                                     time_microseconds < logger->time_retention_checked)) {
+        logger->time_retention_checked = time_microseconds;
+        retain(logger);
+    }
+
+    /* rather than fail once the filesystem is full, drop records until there is space again */
+    if (logger->short_of_space) {
+        logger->drops++;
+        if (logger->metrics) metrics_add(&logger->metrics->logging_drops, 1);
+        return;
+    }
+
+    /* rotation by size waits until the second has changed, so that no two files have the same
+     name, and happens only between records, so that files can always be concatenated */
+    const int over_size = logger->current && logger->chunk_bytes && current_size(logger) + size > logger->chunk_bytes &&
+                          time_microseconds / 1000000ULL > logger->current->time_named / 1000000ULL;
+
+    if (!logger->current || time_microseconds >= logger->time_next_chunk || over_size)
+        rotate(logger, time_microseconds);
+    else if (!logger->next && time_microseconds + logger->preopen_microseconds >= logger->time_next_chunk)
+        preopen(logger, time_microseconds, 1);
+    else if (!logger->next && logger->chunk_bytes && current_size(logger) >= logger->chunk_bytes - logger->chunk_bytes / 8)
+        preopen(logger, time_microseconds, 0);
+
+    struct chunk_block * block = logger->staging;
+    const int full = block && block->size + size > logger->block_size;
+
+    /* a block is written once full, or once it has held a record for a while, as long as it
+     has enough in it to write with O_DIRECT */
+    const int aged = block && time_microseconds - block->time_first >= STAGING_AGE_MAX_MICROSECONDS && block->size >= logger->alignment;
+
+    if (full || aged) {
+        struct chunk_block * fresh = block_get(logger);
+        if (fresh) flush(logger, fresh, time_microseconds);
+    }
+    else if (!block && logger->current && (block = block_get(logger)))
+        block_stage(logger, block, logger->current, logger->current->size, time_microseconds);
+
+    /* every block is waiting to be written, and the caller must not wait */
+    block = logger->staging;
+    if (!block || block->size + size > logger->block_size) {
+        logger->drops++;
+        if (logger->metrics) metrics_add(&logger->metrics->logging_drops, 1);
+        return;
+    }
+
+    memcpy(block->data + block->size, record, size);
+    block->size += size;
+    chunk_summary_add(block->file->summary, record, size);
+    if (logger->metrics) metrics_add(&logger->metrics->bytes_logged, size);
+}
+
+unsigned long chunk_logger_drops(const struct chunk_logger * logger) {
+    return logger->drops;
+}
+
+void chunk_logger_close(struct chunk_logger * logger) {
+    if (!logger) return;
+
+    flush(logger, NULL, 0);
+    if (logger->current) finish(logger, logger->current);
+    if (logger->next) {
+        logger->next->discard = 1;
+        finish(logger, logger->next);
+    }
+
+    for (size_t ifile = 0; ifile < FILES; ifile++)
+        while (FILE_FREE != logger->files[ifile].state)
+            poll_completions(logger, 1);
+
+    while (logger->removals_in_flight || logger->sidecars_in_flight)
+        poll_completions(logger, 1);
+
+#ifdef HAVE_IO_URING
+    if (-1 != logger->ring_fd) ring_teardown(logger);
+#endif
+
+    for (size_t iblock = 0; iblock < logger->blocks_count; iblock++)
+        free(logger->blocks[iblock].data);
+    free(logger->blocks);
+
+    for (size_t iretention = 0; iretention < logger->retentions_count; iretention++)
+        retention_close(logger->retentions[iretention]);
+
+    free(logger->suffix);
+    free(logger->directory);
+    free(logger);
+}
@@ -0,0 +1,81 @@
+/* campbell, isc license */
+
+/* writes the logged format to a directory in chunk files, as used by cobs_to_shm and
+ shm_logger, each named for the second of its first record or of the boundary at which it
+ started. records are copied into large aligned staging blocks which are written
+ asynchronously via io_uring, the file for the next chunk is opened and preallocated shortly
+ before it is needed, and completed files are trimmed and closed asynchronously, such that
+ the caller never waits for open(), fallocate() or close() when a chunk rotates. where
+ io_uring is unavailable, the same operations are done synchronously instead. files are
+ written with a .partial suffix, renamed once all of their data has been written and they have
+ been closed, and only then is the final path printed to stdout */
+#include <stddef.h>
+
+struct metrics;
+struct chunk_logger;
+
+/* if given, do all file operations synchronously in the calling thread, even if io_uring is
+ available, which is slower but may be useful for comparison or on unusual filesystems */
+#define CHUNK_LOGGER_SYNCHRONOUS 1U
+
+/* if given, write straight to the device with O_DIRECT, in 4 MiB blocks which are written
+ only in whole multiples of 4096 bytes, and start writeback after each block in case the
+ filesystem buffers them anyway. intended for slow nonvolatile storage such as a microsd card,
+ which can then be logged to without a tmpfs in between. falls back to writing via the page
+ cache if the filesystem does not support O_DIRECT */
+#define CHUNK_LOGGER_DIRECT 2U
+
+/* if given, never wait for the device: records which arrive while every staging block is
+ waiting to be written are dropped and counted, and a chunk is extended rather than waiting
+ for a file to be closed. has no effect if io_uring is unavailable */
+#define CHUNK_LOGGER_NONBLOCKING 4U
+
+/* if given, alongside each completed file, write and print a summary of it as described in
+ chunk_summary.h, named as the file but ending in .summary.json, e.g.
+ 20240102T030405Z.summary.json, which is written asynchronously and renamed into place as the
+ file itself is. files recovered from a logger which died get no summary */
+#define CHUNK_LOGGER_SUMMARY 8U
+
+/* returns NULL if the logger could not be created. if stream is given, it is included in the
+ name of each file, as in 20240102T030405Z.<stream>.bin, such that several loggers with the
+ same timestamps and chunk boundaries can share a directory. any .partial files of the stream
+ already in the directory, left by a logger which died, are first trimmed to their last whole
+ record, renamed and printed, so the directory must not be shared with another logger of the
+ same stream. chunks end at multiples of the given duration since the epoch, and also once
+ they would exceed the given size, though never within the second in which they started.
+ either may be zero for no limit, but not both. staging_size is the total size of the staging
+ blocks, which limits how long the device may stall before records are dropped or the caller
+ waits. metrics may be NULL */
+struct chunk_logger * chunk_logger_open(const char * directory, const char * stream, const unsigned long long chunk_microseconds, const unsigned long long chunk_bytes,
+                                        const size_t staging_size, const unsigned flags, struct metrics * metrics);
+
+/* keeps at least the given number of bytes free on the filesystem holding the given directory
+ tree, which may be the logging directory or elsewhere, such as where files are moved to once
+ complete, by removing the oldest completed files in it as described in retention.h, checked
+ once per second of records, and removed via io_uring where available. trees are checked in
+ the order given, so where several share a filesystem, that holding the oldest files should be
+ given first. if the logging filesystem cannot be kept that free, records are dropped and
+ counted until it can. returns -1 if the directory cannot be read */
+int chunk_logger_retain(struct chunk_logger * logger, const char * directory, const unsigned long long free_bytes_min, const unsigned flags);
+
+/* notes the files completed by the given logger in the trees in which the other keeps space
+ free, where loggers of several streams share a directory, such that the files of each stream
+ are removed along with those of the others for the same time. the other must be closed last */
+void chunk_logger_retain_alongside(struct chunk_logger * logger, struct chunk_logger * other);
+
+/* appends one record, consisting of the logging header, packet and padding, having the given
+ host time in microseconds, first starting a new file if that time falls in a later chunk.
+ records must be smaller than 1 MiB. exits on any error writing to disk, as there is nothing
+ sensible the caller could do */
+void chunk_logger_write(struct chunk_logger * logger, const void * record, const size_t size, const unsigned long long time_microseconds);
+
+/* finishes the current file if the given time is in a later chunk, as chunk_logger_write()
+ would, but without starting another, such that the files of a sparse stream are completed
+ and emitted in step with those of a busier one */
+void chunk_logger_advance(struct chunk_logger * logger, const unsigned long long time_microseconds);
+
+/* number of records dropped so far, with CHUNK_LOGGER_NONBLOCKING or for lack of space */
+unsigned long chunk_logger_drops(const struct chunk_logger * logger);
+
+/* writes out everything staged, waits for all files to be closed, and frees the logger */
+void chunk_logger_close(struct chunk_logger * logger);
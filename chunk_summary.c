@@ -0,0 +1,198 @@
+/* campbell, isc license */
+
+/* needed for open_memstream, must occur prior to any include statements */
+#define _GNU_SOURCE
+
+#include "chunk_summary.h"
+#include "acoustic_packet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <float.h>
+
+/* records further than this from the first in the chunk are counted in the last second, such
+ that a jump in the system clock cannot make the summary enormous */
+#define SECONDS_MAX 86400
+
+struct chunk_summary {
+    unsigned long long time_first, time_last;
+    unsigned long packets, packets_nonacoustic, packets_other_format;
+
+    /* sequence numbers which did not follow the previous, and packets missing in between */
+    unsigned long seqnum_gaps, packets_missing;
+    int seqnum_previous;
+
+    /* format of the first acoustic packet, which the per-channel statistics are for */
+    struct acoustic_packet_header format;
+    char have_format;
+    float fullscale;
+
+    /* per second of logged time from that of the first record, and per channel therein */
+    size_t seconds, seconds_allocated;
+    unsigned long * second_packets, * second_samples;
+    float * min, * max;
+    double * sum_squares;
+};
+
+struct chunk_summary * chunk_summary_create(void) {
+    struct chunk_summary * summary = calloc(1, sizeof(*summary));
+    if (summary) summary->seqnum_previous = -1;
+    return summary;
+}
+
+static double sample_value(const unsigned char * sample, const unsigned dtype) {
+    if (0 == dtype) { int16_t value; memcpy(&value, sample, 2); return value; }
+    else if (1 == dtype) { int32_t value; memcpy(&value, sample, 4); return value; }
+    else if (3 == dtype) { float value; memcpy(&value, sample, 4); return value; }
+    else if (4 == dtype) return (int8_t)sample[0];
+    else return (int32_t)((uint32_t)sample[0] << 8 | (uint32_t)sample[1] << 16 | (uint32_t)sample[2] << 24) >> 8;
+}
+
+/* returns the index of the given second, growing the arrays as needed, or -1 on failure */
+static long second_index(struct chunk_summary * summary, const unsigned long long time_microseconds) {
+    const unsigned long long second_first = summary->time_first / 1000000ULL, second = time_microseconds / 1000000ULL;
+    const size_t isecond = second < second_first ? 0 : second - second_first >= SECONDS_MAX ? SECONDS_MAX - 1 : second - second_first;
+    const size_t channels = summary->format.channels;
+
+    if (isecond >= summary->seconds_allocated) {
+        const size_t allocated = isecond + 16 > 2 * summary->seconds_allocated ? isecond + 16 : 2 * summary->seconds_allocated;
+        unsigned long * second_packets = realloc(summary->second_packets, allocated * sizeof(unsigned long));
+        if (second_packets) summary->second_packets = second_packets;
+        unsigned long * second_samples = realloc(summary->second_samples, allocated * sizeof(unsigned long));
+        if (second_samples) summary->second_samples = second_samples;
+        float * min = realloc(summary->min, allocated * channels * sizeof(float));
+        if (min) summary->min = min;
+        float * max = realloc(summary->max, allocated * channels * sizeof(float));
+        if (max) summary->max = max;
+        double * sum_squares = realloc(summary->sum_squares, allocated * channels * sizeof(double));
+        if (sum_squares) summary->sum_squares = sum_squares;
+        if (!second_packets || !second_samples || !min || !max || !sum_squares) return -1;
+        summary->seconds_allocated = allocated;
+    }
+
+    for ( ; summary->seconds <= isecond; summary->seconds++) {
+        summary->second_packets[summary->seconds] = 0;
+        summary->second_samples[summary->seconds] = 0;
+        for (size_t ichannel = 0; ichannel < channels; ichannel++) {
+            summary->min[summary->seconds * channels + ichannel] = FLT_MAX;
+            summary->max[summary->seconds * channels + ichannel] = -FLT_MAX;
+            summary->sum_squares[summary->seconds * channels + ichannel] = 0;
+        }
+    }
+    return isecond;
+}
+
+void chunk_summary_add(struct chunk_summary * summary, const void * record, const size_t size) {
+    if (!summary || size < sizeof(uint64_t)) return;
+
+    uint64_t logging_header;
+    memcpy(&logging_header, record, sizeof(uint64_t));
+    const unsigned long long time_microseconds = (logging_header >> 16U) * 16U;
+    const size_t packet_size = logging_header & 65535U;
+    const unsigned char * packet = (const unsigned char *)record + sizeof(uint64_t);
+    if (sizeof(uint64_t) + packet_size > size) return;
+
+    if (!summary->packets && !summary->packets_nonacoustic) summary->time_first = time_microseconds;
+    summary->time_last = time_microseconds;
+
+    struct acoustic_packet_header header;
+    if (acoustic_packet_parse(&header, packet, packet_size)) {
+        summary->packets_nonacoustic++;
+        return;
+    }
+    summary->packets++;
+
+    if (summary->seqnum_previous >= 0 && header.seqnum != ((summary->seqnum_previous + 1) & 0xFFFF)) {
+        summary->seqnum_gaps++;
+        summary->packets_missing += (header.seqnum - summary->seqnum_previous - 1) & 0xFFFF;
+    }
+    summary->seqnum_previous = header.seqnum;
+
+    if (!summary->have_format) {
+        const unsigned dtype = header.flags & 0x7;
+        summary->format = header;
+        summary->fullscale = 0 == dtype ? 32767.0f : 1 == dtype ? 2147483647.0f : 3 == dtype ? 1.0f : 4 == dtype ? 127.0f : 8388607.0f;
+        summary->have_format = 1;
+    }
+
+    if (header.channels != summary->format.channels || header.flags != summary->format.flags) {
+        summary->packets_other_format++;
+        return;
+    }
+
+    const long isecond = second_index(summary, time_microseconds);
+    if (isecond < 0) return;
+
+    const size_t channels = header.channels;
+    const unsigned dtype = header.flags & 0x7;
+    const unsigned char * samples = packet + ACOUSTIC_PACKET_HEADER_SIZE;
+    float * min = summary->min + isecond * channels, * max = summary->max + isecond * channels;
+    double * sum_squares = summary->sum_squares + isecond * channels;
+
+    for (size_t iframe = 0; iframe < header.samples_per_channel; iframe++)
+        for (size_t ichannel = 0; ichannel < channels; ichannel++) {
+            const double value = sample_value(samples + (iframe * channels + ichannel) * header.sizeof_sample, dtype);
+            if (value < min[ichannel]) min[ichannel] = value;
+            if (value > max[ichannel]) max[ichannel] = value;
+            sum_squares[ichannel] += value * value;
+        }
+
+    summary->second_packets[isecond]++;
+    summary->second_samples[isecond] += header.samples_per_channel;
+}
+
+char * chunk_summary_format(const struct chunk_summary * summary, const char * chunk, size_t * size) {
+    char * text = NULL;
+    FILE * fh = open_memstream(&text, size);
+    if (!fh) return NULL;
+
+    fprintf(fh, "{\"chunk\": \"%s\", \"first_microseconds\": %llu, \"last_microseconds\": %llu, \"packets\": %lu, \"nonacoustic_packets\": %lu, "
+            "\"other_format_packets\": %lu, \"seqnum_gaps\": %lu, \"packets_missing\": %lu",
+            chunk, summary->time_first, summary->time_last, summary->packets, summary->packets_nonacoustic,
+            summary->packets_other_format, summary->seqnum_gaps, summary->packets_missing);
+
+    if (summary->have_format) {
+        const size_t channels = summary->format.channels;
+        fprintf(fh, ", \"channels\": %zu, \"sample_rate\": %.8g, \"fullscale\": %.10g, \"seconds\": [", channels, summary->format.sample_rate, summary->fullscale);
+
+        for (size_t isecond = 0; isecond < summary->seconds; isecond++) {
+            const float * min = summary->min + isecond * channels, * max = summary->max + isecond * channels;
+            const double * sum_squares = summary->sum_squares + isecond * channels;
+            const unsigned long samples = summary->second_samples[isecond];
+
+            fprintf(fh, "%s\n{\"time\": %llu, \"packets\": %lu, \"samples\": %lu", isecond ? "," : "",
+                    summary->time_first / 1000000ULL + isecond, summary->second_packets[isecond], samples);
+            if (samples) {
+                fprintf(fh, ", \"min\": [");
+                for (size_t ichannel = 0; ichannel < channels; ichannel++) fprintf(fh, "%s%.10g", ichannel ? ", " : "", min[ichannel]);
+                fprintf(fh, "], \"max\": [");
+                for (size_t ichannel = 0; ichannel < channels; ichannel++) fprintf(fh, "%s%.10g", ichannel ? ", " : "", max[ichannel]);
+                fprintf(fh, "], \"rms\": [");
+                for (size_t ichannel = 0; ichannel < channels; ichannel++) fprintf(fh, "%s%.6g", ichannel ? ", " : "", sqrt(sum_squares[ichannel] / samples));
+                fprintf(fh, "]");
+            }
+            fprintf(fh, "}");
+        }
+        fprintf(fh, "]");
+    }
+    fprintf(fh, "}\n");
+
+    if (ferror(fh) | fclose(fh)) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+void chunk_summary_free(struct chunk_summary * summary) {
+    if (!summary) return;
+    free(summary->second_packets);
+    free(summary->second_samples);
+    free(summary->min);
+    free(summary->max);
+    free(summary->sum_squares);
+    free(summary);
+}
@@ -0,0 +1,21 @@
+/* campbell, isc license */
+
+/* accumulates a compact summary of the packets written to one logged chunk, such that
+ overviews of weeks of data can be made without reading the data itself: the time span,
+ counts of acoustic and nonacoustic packets, gaps in acoustic sequence numbers, and for each
+ second of logged time, the packet count and the min, max and rms of each channel in raw units,
+ along with the full scale value by which to divide them. written as a small json object */
+#include <stddef.h>
+
+struct chunk_summary;
+
+struct chunk_summary * chunk_summary_create(void);
+
+/* given one record as logged, consisting of the logging header, packet and any padding */
+void chunk_summary_add(struct chunk_summary * summary, const void * record, const size_t size);
+
+/* returns the summary as text, to be freed by the caller, setting *size to its length, or NULL
+ on error. chunk is the name of the file summarised */
+char * chunk_summary_format(const struct chunk_summary * summary, const char * chunk, size_t * size);
+
+void chunk_summary_free(struct chunk_summary * summary);
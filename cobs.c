@@ -0,0 +1,191 @@
+/* campbell, isc license */
+#include "cobs.h"
+#include "metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+/* useful macros */
+#define WARNING_ANSI "\x1B[35;1mwarning:\x1B[0m"
+
+ssize_t cobs_read_frame(unsigned char * const out, const size_t max_plain_size, FILE * fh, struct metrics * metrics) {
+    /* note: "out" must be large enough to hold an extra final appended zero */
+    unsigned char * dst = out;
+
+    while (1) {
+        /* read one byte */
+        int code;
+        if ((code = getc_unlocked(fh)) < 0) return -1;
+
+        /* got an end byte */
+        if (0 == code) break;
+
+        /* if we have gone too long without seeing an end byte... */
+        if ((size_t)(dst - out) + code > max_plain_size) {
+            fprintf(stderr, WARNING_ANSI " %s: missing end byte\n", __func__);
+            if (metrics) metrics_add(&metrics->cobs_missing_end_byte, 1);
+
+            /* discard all further bytes until we see a zero byte, then reset */
+            do if ((code = getc_unlocked(fh)) < 0) return -1;
+            while (code);
+
+            dst = out;
+            continue;
+        }
+
+        /* read until next implicit zero, unless we get an unexpected explicit zero */
+        size_t ibyte = 0;
+        for (; ibyte < code - 1U; ibyte++) {
+            int byte;
+            if ((byte = getc_unlocked(fh)) < 0) return -1;
+            else if (0 == byte) break;
+
+            dst[ibyte] = byte;
+        }
+
+        /* if the above loop exited early, reset */
+        if (ibyte != code - 1U) {
+            fprintf(stderr, WARNING_ANSI " %s: unexpected zero byte\n", __func__);
+            if (metrics) metrics_add(&metrics->cobs_unexpected_zero_byte, 1);
+
+            dst = out;
+            continue;
+        }
+
+        dst += code - 1;
+
+        /* a special value of 0xff indicates that the block encodes 254 bytes */
+        if (code != 0xFF) *(dst++) = 0;
+    }
+
+    return dst > out ? (dst - out) - 1 : 0;
+}
+
+size_t cobs_encode(unsigned char * out, const unsigned char * in, const size_t size) {
+    unsigned char * code_p = out, * dst = out + 1;
+    unsigned char code = 1;
+
+    for (size_t ibyte = 0; ibyte < size; ibyte++) {
+        if (in[ibyte]) {
+            *(dst++) = in[ibyte];
+            code++;
+        }
+
+        if (!in[ibyte] || 255 == code) {
+            *code_p = code;
+            code = 1;
+            code_p = dst++;
+        }
+    }
+
+    *code_p = code;
+    *(dst++) = 0;
+    return dst - out;
+}
+
+int cobs_trailer_parse(enum cobs_trailer * trailer_p, const char * text) {
+    if (!strcmp(text, "none")) *trailer_p = COBS_TRAILER_NONE;
+    else if (!strcmp(text, "crc16")) *trailer_p = COBS_TRAILER_CRC16;
+    else if (!strcmp(text, "crc32c")) *trailer_p = COBS_TRAILER_CRC32C;
+    else return -1;
+    return 0;
+}
+
+ssize_t cobs_trailer_check(const unsigned char * frame, const size_t size, const enum cobs_trailer trailer) {
+    if (size < (size_t)trailer) return -1;
+    const size_t packet_size = size - trailer;
+
+    if (COBS_TRAILER_CRC16 == trailer) {
+        const uint16_t expected = frame[packet_size] | frame[packet_size + 1] << 8;
+        if (crc16_ccitt(frame, packet_size) != expected) return -1;
+    }
+    else if (COBS_TRAILER_CRC32C == trailer) {
+        const uint32_t expected = frame[packet_size] | frame[packet_size + 1] << 8 | frame[packet_size + 2] << 16 | (uint32_t)frame[packet_size + 3] << 24;
+        if (crc32c(frame, packet_size) != expected) return -1;
+    }
+
+    return packet_size;
+}
+
+size_t cobs_trailer_append(unsigned char * packet, const size_t size, const enum cobs_trailer trailer) {
+    const uint32_t crc = COBS_TRAILER_CRC16 == trailer ? crc16_ccitt(packet, size) :
+                         COBS_TRAILER_CRC32C == trailer ? crc32c(packet, size) : 0;
+    for (size_t ibyte = 0; ibyte < (size_t)trailer; ibyte++)
+        packet[size + ibyte] = crc >> (8 * ibyte);
+    return size + trailer;
+}
+
+/* byte-at-a-time tables, populated on first use */
+static uint16_t crc16_table[256];
+static uint32_t crc32c_table[256];
+
+uint16_t crc16_ccitt(const unsigned char * data, const size_t size) {
+    if (!crc16_table[1])
+        for (unsigned ibyte = 0; ibyte < 256; ibyte++) {
+            uint16_t crc = ibyte << 8;
+            for (size_t ibit = 0; ibit < 8; ibit++)
+                crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+            crc16_table[ibyte] = crc;
+        }
+
+    uint16_t crc = 0xffff;
+    for (size_t ibyte = 0; ibyte < size; ibyte++)
+        crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ data[ibyte]];
+    return crc;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* the sse4.2 crc32 instruction computes exactly crc-32c, eight bytes at a time */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hardware(uint32_t crc, const unsigned char * data, size_t size) {
+#ifdef __x86_64__
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = _mm_crc32_u64(crc, word);
+    }
+#endif
+    for (; size; size--, data++)
+        crc = _mm_crc32_u8(crc, *data);
+    return crc;
+}
+#elif defined(__ARM_FEATURE_CRC32)
+/* as does the armv8 crc32c instruction */
+static uint32_t crc32c_hardware(uint32_t crc, const unsigned char * data, size_t size) {
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = __crc32cd(crc, word);
+    }
+    for (; size; size--, data++)
+        crc = __crc32cb(crc, *data);
+    return crc;
+}
+#endif
+
+uint32_t crc32c(const unsigned char * data, const size_t size) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("sse4.2")) return ~crc32c_hardware(~0U, data, size);
+#elif defined(__ARM_FEATURE_CRC32)
+    return ~crc32c_hardware(~0U, data, size);
+#endif
+
+    if (!crc32c_table[1])
+        for (unsigned ibyte = 0; ibyte < 256; ibyte++) {
+            uint32_t crc = ibyte;
+            for (size_t ibit = 0; ibit < 8; ibit++)
+                crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78U : crc >> 1;
+            crc32c_table[ibyte] = crc;
+        }
+
+    uint32_t crc = ~0U;
+    for (size_t ibyte = 0; ibyte < size; ibyte++)
+        crc = (crc >> 8) ^ crc32c_table[(crc ^ data[ibyte]) & 0xff];
+    return ~crc;
+}
@@ -0,0 +1,49 @@
+/* campbell, isc license */
+
+/* consistent overhead byte stuffing, as used to frame packets on the serial link: frames are
+ terminated by a zero byte, and each block of up to 254 nonzero bytes is preceded by a code
+ byte giving the distance to the next zero (or 0xff for a block with no trailing zero) */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+struct metrics;
+
+/* reads and decodes frames from the given stream until one is complete, returning its size,
+ or -1 on eof or error. never writes more than max_plain_size bytes to out, which must
+ therefore have room for one more byte than the largest expected packet. frames which are
+ too long or contain a premature zero are discarded, counted in metrics if it is not NULL,
+ and decoding resumes at the next zero byte. the stream should be locked by the caller, as
+ getc_unlocked() is used */
+ssize_t cobs_read_frame(unsigned char * const out, const size_t max_plain_size, FILE * fh, struct metrics * metrics);
+
+/* encodes size bytes, returning the size of the frame including the terminating zero. out
+ must have room for COBS_ENCODED_SIZE_MAX(size) bytes */
+#define COBS_ENCODED_SIZE_MAX(size) ((size) + (size) / 254 + 2)
+size_t cobs_encode(unsigned char * out, const unsigned char * in, const size_t size);
+
+/* optional integrity check which the device appends to each packet before encoding it, as a
+ little-endian crc of everything before it. each value is the size of the trailer */
+enum cobs_trailer {
+    COBS_TRAILER_NONE = 0,
+
+    /* crc-16/ccitt-false: polynomial 0x1021, initial value 0xffff, not reflected */
+    COBS_TRAILER_CRC16 = 2,
+
+    /* crc-32c (castagnoli), as in iscsi and ext4, which has hardware support on x86 and arm */
+    COBS_TRAILER_CRC32C = 4
+};
+
+/* parses "none", "crc16" or "crc32c", returning -1 if the text is none of these */
+int cobs_trailer_parse(enum cobs_trailer * trailer_p, const char * text);
+
+/* returns the size of the packet without its trailer if the trailer matches, or -1 if it does
+ not match or the frame is too small to contain it */
+ssize_t cobs_trailer_check(const unsigned char * frame, const size_t size, const enum cobs_trailer trailer);
+
+/* appends the trailer to a packet, which must have room for it, returning the new size */
+size_t cobs_trailer_append(unsigned char * packet, const size_t size, const enum cobs_trailer trailer);
+
+uint16_t crc16_ccitt(const unsigned char * data, const size_t size);
+uint32_t crc32c(const unsigned char * data, const size_t size);
@@ -0,0 +1,120 @@
+/* campbell, isc license */
+
+/* microbenchmark of cobs_read_frame(), decoding frames from memory via fmemopen() such that
+ only the decoder and stdio are measured. reports throughput for a range of packet sizes and
+ densities of zero bytes within packets, printed to stdout as one json object per line, as
+ with shm_bench. invoke as "cobs_bench [seconds_per_test]" */
+
+/* needed for fmemopen on some platforms, must occur prior to any include statements */
+#define _GNU_SOURCE
+
+#include "cobs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+/* useful macros */
+#define WARNING_ANSI "\x1B[35;1mwarning:\x1B[0m"
+#define ERROR_ANSI "\x1B[31;1merror:\x1B[0m"
+#define NOPE(...) do { fprintf(stderr, ERROR_ANSI " " __VA_ARGS__); exit(EXIT_FAILURE); } while(0)
+
+/* enough encoded input per pass to be well beyond the size of the caches */
+#define WIRE_SIZE (32U << 20)
+
+static unsigned long long monotonic_nanoseconds(void) {
+    struct timespec timespec;
+    clock_gettime(CLOCK_MONOTONIC, &timespec);
+    return timespec.tv_sec * 1000000000ULL + timespec.tv_nsec;
+}
+
+int main(int argc, char ** const argv) {
+    /* do some silly stuff to get a progname regardless of runtime environment */
+    const char * s, * progname = argc ? ((s = strrchr(argv[0], '/')) ? s + 1 : argv[0]) : __func__;
+
+    const double seconds = argc > 1 ? strtod(argv[1], NULL) : 1.0;
+
+    static const size_t packet_sizes[] = { 64, 1472, 16384, 65527 };
+    static const double zero_densities[] = { 0.0, 0.01, 0.1, 0.5 };
+
+    unsigned char * wire = malloc(WIRE_SIZE);
+    unsigned char * packet = malloc(65536), * out = malloc(65536);
+    if (!wire || !packet || !out) NOPE("%s: malloc(): %s\n", progname, strerror(errno));
+
+    srand(1);
+
+    for (size_t isize = 0; isize < sizeof(packet_sizes) / sizeof(packet_sizes[0]); isize++)
+        for (size_t idensity = 0; idensity < sizeof(zero_densities) / sizeof(zero_densities[0]); idensity++) {
+            const size_t packet_size = packet_sizes[isize];
+
+            /* fill the wire with as many encoded random packets as will fit */
+            size_t wire_size = 0, frames = 0, plain_bytes = 0;
+            while (wire_size + COBS_ENCODED_SIZE_MAX(packet_size) <= WIRE_SIZE) {
+                for (size_t ibyte = 0; ibyte < packet_size; ibyte++)
+                    packet[ibyte] = rand() < zero_densities[idensity] * RAND_MAX ? 0 : 1 + rand() % 255;
+                wire_size += cobs_encode(wire + wire_size, packet, packet_size);
+                frames++;
+                plain_bytes += packet_size;
+            }
+
+            /* decode the whole wire repeatedly until enough time has elapsed */
+            unsigned long passes = 0;
+            const unsigned long long time_start = monotonic_nanoseconds();
+            unsigned long long time_now = time_start;
+            do {
+                FILE * fh = fmemopen(wire, wire_size, "r");
+                if (!fh) NOPE("%s: fmemopen(): %s\n", progname, strerror(errno));
+                flockfile(fh);
+
+                size_t frames_decoded = 0;
+                for (ssize_t ret; (ret = cobs_read_frame(out, 65536, fh, NULL)) >= 0; frames_decoded++)
+                    if ((size_t)ret != packet_size) NOPE("%s: decoded %zd bytes, expected %zu\n", progname, ret, packet_size);
+
+                funlockfile(fh);
+                fclose(fh);
+                if (frames_decoded != frames) NOPE("%s: decoded %zu frames, expected %zu\n", progname, frames_decoded, frames);
+
+                passes++;
+                time_now = monotonic_nanoseconds();
+            } while (time_now - time_start < seconds * 1e9);
+
+            const double elapsed = (time_now - time_start) * 1e-9;
+            printf("{\"test\": \"cobs_decode\", \"packet_size\": %zu, \"zero_density\": %g, \"wire_bytes_per_second\": %.0f, "
+                   "\"plain_bytes_per_second\": %.0f, \"frames_per_second\": %.0f}\n",
+                   packet_size, zero_densities[idensity], passes * wire_size / elapsed, passes * plain_bytes / elapsed, passes * frames / elapsed);
+            fflush(stdout);
+        }
+
+    /* throughput of the crc trailer check for typical packet sizes */
+    static const struct { enum cobs_trailer trailer; const char * name; } trailers[] = {
+        { COBS_TRAILER_CRC16, "crc16" }, { COBS_TRAILER_CRC32C, "crc32c" } };
+
+    for (size_t itrailer = 0; itrailer < sizeof(trailers) / sizeof(trailers[0]); itrailer++)
+        for (size_t isize = 0; isize < sizeof(packet_sizes) / sizeof(packet_sizes[0]); isize++) {
+            const size_t packet_size = packet_sizes[isize];
+            for (size_t ibyte = 0; ibyte < packet_size; ibyte++) packet[ibyte] = rand();
+            const size_t frame_size = cobs_trailer_append(packet, packet_size, trailers[itrailer].trailer);
+
+            unsigned long checks = 0;
+            const unsigned long long time_start = monotonic_nanoseconds();
+            unsigned long long time_now = time_start;
+            do {
+                for (size_t irepeat = 0; irepeat < 256; irepeat++, checks++)
+                    if (cobs_trailer_check(packet, frame_size, trailers[itrailer].trailer) != (ssize_t)packet_size)
+                        NOPE("%s: %s mismatch\n", progname, trailers[itrailer].name);
+                time_now = monotonic_nanoseconds();
+            } while (time_now - time_start < seconds * 1e9);
+
+            const double elapsed = (time_now - time_start) * 1e-9;
+            printf("{\"test\": \"cobs_trailer\", \"trailer\": \"%s\", \"packet_size\": %zu, \"bytes_per_second\": %.0f, \"frames_per_second\": %.0f}\n",
+                   trailers[itrailer].name, packet_size, checks * packet_size / elapsed, checks / elapsed);
+            fflush(stdout);
+        }
+
+    free(out);
+    free(packet);
+    free(wire);
+}
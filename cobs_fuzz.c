@@ -0,0 +1,87 @@
+/* campbell, isc license */
+
+/* fuzz harness for cobs_read_frame(), usable with libfuzzer (build with "make cobs_fuzz_libfuzzer
+ CC=clang") or afl and similar tools, which run the plain build on each input given on stdin
+ or as a path. the input is split into a size limit and arbitrary bytes on the wire, which are
+ followed by a zero byte and a known valid frame. checks that the decoder never writes past
+ the size limit, never returns more than fits within it, and always decodes the known frame
+ correctly, i.e. that it resynchronises on the next zero byte whatever preceded it */
+#include "cobs.h"
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/* bytes past the size limit which must not be touched */
+#define CANARY_SIZE 64
+
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size) {
+    if (size < 2) return 0;
+
+    /* between 1 and 1024 bytes, so that both tiny and typical limits are exercised */
+    const size_t max_plain_size = 1 + ((data[0] | (size_t)data[1] << 8) & 1023);
+    data += 2;
+    size -= 2;
+
+    /* known frame, which must contain zeros and fit within the limit */
+    static const unsigned char known[] = { 0x45, 0, 1, 2, 0, 0, 3 };
+    const size_t known_size = sizeof(known) < max_plain_size ? sizeof(known) : max_plain_size - 1;
+
+    unsigned char * wire = malloc(size + 1 + COBS_ENCODED_SIZE_MAX(sizeof(known)));
+    memcpy(wire, data, size);
+    wire[size] = 0;
+    const size_t wire_size = size + 1 + cobs_encode(wire + size + 1, known, known_size);
+
+    FILE * fh = fmemopen(wire, wire_size, "r");
+    if (!fh) abort();
+
+    unsigned char * out = malloc(max_plain_size + CANARY_SIZE);
+    memset(out + max_plain_size, 0xa5, CANARY_SIZE);
+
+    struct metrics metrics = { 0 };
+    ssize_t ret, ret_last = -1;
+    unsigned char * last = malloc(max_plain_size);
+
+    while ((ret = cobs_read_frame(out, max_plain_size, fh, &metrics)) >= 0) {
+        if ((size_t)ret >= max_plain_size) abort();
+
+        for (size_t ibyte = 0; ibyte < CANARY_SIZE; ibyte++)
+            if (0xa5 != out[max_plain_size + ibyte]) abort();
+
+        memcpy(last, out, ret);
+        ret_last = ret;
+    }
+
+    /* whatever came before, the last frame must be the known one */
+    if (ret_last != (ssize_t)known_size || memcmp(last, known, known_size)) abort();
+
+    fclose(fh);
+    free(last);
+    free(out);
+    free(wire);
+    return 0;
+}
+
+#ifndef COBS_FUZZ_LIBFUZZER
+int main(int argc, char ** const argv) {
+    FILE * fh = argc > 1 ? fopen(argv[1], "rb") : stdin;
+    if (!fh) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    size_t size = 0, capacity = 65536;
+    uint8_t * data = malloc(capacity);
+    for (size_t ret; (ret = fread(data + size, 1, capacity - size, fh)) > 0; ) {
+        size += ret;
+        if (size == capacity) data = realloc(data, capacity *= 2);
+    }
+
+    LLVMFuzzerTestOneInput(data, size);
+    free(data);
+}
+#endif
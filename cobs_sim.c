@@ -0,0 +1,321 @@
+/* campbell, isc license */
+
+/*
+ Synthetic COBS-framed acoustic packet source on a pseudo-terminal
+
+ This creates a pty pair and prints the path of the slave end, which can be given to
+ cobs_to_shm in place of the usb serial device, allowing the decoder, ring buffer and loggers
+ to be benchmarked without hardware. Packets use the same acoustic header as pcm2packets.py
+ and parse_acoustic_packets.py, and contain a sine wave in each channel.
+
+ A pty has no modem control lines, so the opening of the slave end by a reader stands in for
+ DTR going high, and its closing for DTR going low: like the real device, nothing is sent
+ until a reader has opened the slave, and the sequence number and timestamps are reset each
+ time a reader closes it and another opens it.
+
+ Configuration is via environment variables:
+ SIM_CHANNELS (default 1), SIM_SAMPLE_RATE (default 31250), SIM_DTYPE (int16, int32, single,
+ int8 or int24, default int16), and SIM_PACKET_SIZE (default 1472, the maximum size of each
+ packet including the 16-byte acoustic header) set the format of the packets.
+
+ SIM_SPEED (default 1) is the rate at which packets are sent as a multiple of realtime, or 0
+ to send them as fast as the reader will accept them. SIM_JITTER (default 0) is the maximum
+ number of microseconds by which each packet is randomly delayed, without affecting the
+ timing of subsequent packets.
+
+ SIM_CORRUPT (default 0) is the probability that each frame is corrupted on the wire, either
+ by flipping a bit, by replacing a byte with a zero, or by dropping the frame delimiter.
+ SIM_SEED (default 1) seeds the generator used for jitter and corruption. SIM_TRAILER (none,
+ crc16 or crc32c, default none) appends a crc to each packet, as COBS_TRAILER expects.
+
+ SIM_PACKETS (default 0, meaning unlimited) is the number of packets after which to exit.
+ */
+
+/* needed for posix_openpt, must occur prior to any include statements */
+#define _GNU_SOURCE
+
+#include "acoustic_packet.h"
+#include "cobs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+/* useful macros */
+#define WARNING_ANSI "\x1B[35;1mwarning:\x1B[0m"
+#define ERROR_ANSI "\x1B[31;1merror:\x1B[0m"
+#define NOPE(...) do { fprintf(stderr, ERROR_ANSI " " __VA_ARGS__); exit(EXIT_FAILURE); } while(0)
+
+static volatile sig_atomic_t got_sigterm_or_sigint = 0;
+
+static void sigint_handler(int sig) {
+    (void)sig;
+    got_sigterm_or_sigint = 1;
+}
+
+static unsigned long long current_time_in_unix_microseconds(void) {
+    struct timespec timespec;
+    clock_gettime(CLOCK_REALTIME, &timespec);
+    return timespec.tv_sec * 1000000ULL + timespec.tv_nsec / 1000UL;
+}
+
+static unsigned long long monotonic_nanoseconds(void) {
+    struct timespec timespec;
+    clock_gettime(CLOCK_MONOTONIC, &timespec);
+    return timespec.tv_sec * 1000000000ULL + timespec.tv_nsec;
+}
+
+static void sleep_until_monotonic_nanoseconds(const unsigned long long nanoseconds) {
+    const struct timespec timespec = { .tv_sec = nanoseconds / 1000000000ULL, .tv_nsec = nanoseconds % 1000000000ULL };
+    while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &timespec, NULL) && !got_sigterm_or_sigint);
+}
+
+/* xorshift64*, which is plenty for jitter and corruption, and reproducible across platforms */
+static uint64_t random_state;
+
+static uint64_t random_next(void) {
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 2685821657736338717ULL;
+}
+
+static double random_uniform(void) {
+    return (random_next() >> 11) * 0x1.0p-53;
+}
+
+/* returns the value of the flags field for the given dtype, and sets the sample size */
+static unsigned parse_dtype(const char * dtype, size_t * sizeof_sample_p) {
+    if (!strcmp(dtype, "int16")) { *sizeof_sample_p = 2; return 0; }
+    else if (!strcmp(dtype, "int32")) { *sizeof_sample_p = 4; return 1; }
+    else if (!strcmp(dtype, "single")) { *sizeof_sample_p = 4; return 3; }
+    else if (!strcmp(dtype, "int8")) { *sizeof_sample_p = 1; return 4; }
+    else if (!strcmp(dtype, "int24")) { *sizeof_sample_p = 3; return 2; }
+    else NOPE("%s: unrecognized dtype \"%s\"\n", __func__, dtype);
+}
+
+/* writes one sample of a sine wave at half of full scale, in the given format */
+static void write_sample(unsigned char * dst, const unsigned flags, const double value) {
+    switch (flags & 0x7) {
+        case 0: { const int16_t sample = lrint(value * 16383.0); memcpy(dst, &sample, 2); break; }
+        case 1: { const int32_t sample = lrint(value * 1073741823.0); memcpy(dst, &sample, 4); break; }
+        case 3: { const float sample = value * 0.5f; memcpy(dst, &sample, 4); break; }
+        case 4: { const int8_t sample = lrint(value * 63.0); memcpy(dst, &sample, 1); break; }
+        default: {
+            /* little endian, three lowest bytes of a 32-bit integer */
+            const int32_t sample = lrint(value * 4194303.0);
+            memcpy(dst, &sample, 3);
+        }
+    }
+}
+
+/* master end poll()s with POLLHUP once the slave has been closed, and not before it is first
+ opened, so open and close it once such that there is no difference between those two states */
+static int open_pty(char ** slave_path_p) {
+    const int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (-1 == fd || -1 == grantpt(fd) || -1 == unlockpt(fd)) NOPE("%s: posix_openpt(): %s\n", __func__, strerror(errno));
+
+    char * slave_path = strdup(ptsname(fd));
+    const int fd_slave = open(slave_path, O_RDWR | O_NOCTTY);
+    if (-1 == fd_slave) NOPE("%s: %s: %s\n", __func__, slave_path, strerror(errno));
+
+    /* default to raw, in case the reader does not set it */
+    struct termios ts;
+    if (-1 == tcgetattr(fd_slave, &ts)) NOPE("%s: tcgetattr: %s\n", __func__, strerror(errno));
+    cfmakeraw(&ts);
+    if (-1 == tcsetattr(fd_slave, TCSANOW, &ts)) NOPE("%s: tcsetattr: %s\n", __func__, strerror(errno));
+
+    close(fd_slave);
+    *slave_path_p = slave_path;
+    return fd;
+}
+
+static int reader_has_slave_open(const int fd) {
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+    if (-1 == poll(&pfd, 1, 0) && EINTR != errno) NOPE("%s: poll(): %s\n", __func__, strerror(errno));
+    return !(pfd.revents & POLLHUP);
+}
+
+int main(int argc, char ** const argv) {
+    /* do some silly stuff to get a progname regardless of runtime environment */
+    const char * s, * progname = argc ? ((s = strrchr(argv[0], '/')) ? s + 1 : argv[0]) : __func__;
+
+    /* optional path at which to create a symlink to the slave end of the pty */
+    const char * link_path = argc > 1 ? argv[1] : NULL;
+
+    const unsigned long channels = strtoul(getenv("SIM_CHANNELS") ?: "1", NULL, 10);
+    const double sample_rate = strtod(getenv("SIM_SAMPLE_RATE") ?: "31250", NULL);
+    const size_t packet_size_max = strtoul(getenv("SIM_PACKET_SIZE") ?: "1472", NULL, 10);
+    const double speed = strtod(getenv("SIM_SPEED") ?: "1", NULL);
+    const double jitter_microseconds = strtod(getenv("SIM_JITTER") ?: "0", NULL);
+    const double corrupt_probability = strtod(getenv("SIM_CORRUPT") ?: "0", NULL);
+    const unsigned long packets_max = strtoul(getenv("SIM_PACKETS") ?: "0", NULL, 10);
+    random_state = strtoull(getenv("SIM_SEED") ?: "1", NULL, 10) ?: 1;
+
+    size_t sizeof_sample;
+    const unsigned flags = parse_dtype(getenv("SIM_DTYPE") ?: "int16", &sizeof_sample);
+
+    if (!channels || channels > 255) NOPE("%s: SIM_CHANNELS must be between 1 and 255\n", progname);
+    if (!(sample_rate > 0)) NOPE("%s: SIM_SAMPLE_RATE must be positive\n", progname);
+    if (speed < 0) NOPE("%s: SIM_SPEED must not be negative\n", progname);
+    enum cobs_trailer trailer;
+    if (-1 == cobs_trailer_parse(&trailer, getenv("SIM_TRAILER") ?: "none"))
+        NOPE("%s: SIM_TRAILER must be none, crc16 or crc32c\n", progname);
+
+    if (packet_size_max > 65528) NOPE("%s: SIM_PACKET_SIZE must not exceed 65528\n", progname);
+
+    /* number of samples per channel is the largest s.t. the packet fits, as in pcm2packets.py */
+    const size_t samples_per_channel = packet_size_max > ACOUSTIC_PACKET_HEADER_SIZE ?
+        (packet_size_max - ACOUSTIC_PACKET_HEADER_SIZE) / (sizeof_sample * channels) : 0;
+    if (!samples_per_channel) NOPE("%s: SIM_PACKET_SIZE too small for one sample of each channel\n", progname);
+    const size_t packet_size = ACOUSTIC_PACKET_HEADER_SIZE + samples_per_channel * sizeof_sample * channels;
+
+    /* install a signal handler so that we can stop cleanly on sigint or sigterm */
+    if (-1 == sigaction(SIGINT, &(struct sigaction) { .sa_handler = sigint_handler }, NULL) ||
+        -1 == sigaction(SIGTERM, &(struct sigaction) { .sa_handler = sigint_handler }, NULL))
+        NOPE("%s: sigaction(): %s\n", progname, strerror(errno));
+
+    /* a reader closing the slave end would otherwise kill us on the next write */
+    signal(SIGPIPE, SIG_IGN);
+
+    char * slave_path;
+    const int fd = open_pty(&slave_path);
+
+    if (link_path) {
+        unlink(link_path);
+        if (-1 == symlink(slave_path, link_path)) NOPE("%s: symlink(%s): %s\n", progname, link_path, strerror(errno));
+    }
+
+    /* the one thing on stdout, so that scripts can capture it */
+    printf("%s\n", slave_path);
+    fflush(stdout);
+
+    fprintf(stderr, "%s: %lu channels, %g sps, %zu samples of %zu bytes per channel per packet, %zu byte packets\n",
+            progname, channels, sample_rate, samples_per_channel, sizeof_sample, packet_size);
+
+    unsigned char * packet = calloc(packet_size + trailer, 1);
+    unsigned char * frame = malloc(COBS_ENCODED_SIZE_MAX(packet_size + trailer));
+
+    unsigned long packets_sent = 0, bytes_sent = 0;
+    unsigned long corrupted_bit = 0, corrupted_zero = 0, corrupted_delimiter = 0;
+    unsigned long long time_started = 0;
+
+    while (!got_sigterm_or_sigint && (!packets_max || packets_sent < packets_max)) {
+        /* wait for the equivalent of dtr going high */
+        fprintf(stderr, "%s: waiting for a reader to open %s\n", progname, slave_path);
+        while (!got_sigterm_or_sigint && !reader_has_slave_open(fd))
+            usleep(10000);
+        if (got_sigterm_or_sigint) break;
+        fprintf(stderr, "%s: reader connected\n", progname);
+
+        /* reset state as the device does */
+        const unsigned long long time_connected_unix = current_time_in_unix_microseconds();
+        const unsigned long long time_connected = monotonic_nanoseconds();
+        if (!time_started) time_started = time_connected;
+        unsigned long long samples_sent = 0;
+        uint16_t seqnum = 0;
+
+        while (!got_sigterm_or_sigint && (!packets_max || packets_sent < packets_max)) {
+            if (!reader_has_slave_open(fd)) {
+                fprintf(stderr, "%s: reader disconnected\n", progname);
+                break;
+            }
+
+            /* device timestamp marks the end of the packet, as described in acoustic_packet.h */
+            const uint64_t timestamp_ticks = ((time_connected_unix + (unsigned long long)((samples_sent + samples_per_channel) * 1e6 / sample_rate)) / 16) & ((1ULL << 48) - 1);
+            const uint16_t timestamp_lsbs = timestamp_ticks & 65535U;
+            const uint32_t timestamp_msbs = timestamp_ticks >> 16;
+            const float sample_rate_float = sample_rate;
+            const uint16_t flags_field = flags;
+
+            packet[0] = ACOUSTIC_PACKET_MAGIC;
+            packet[1] = channels;
+            memcpy(packet + 2, &seqnum, 2);
+            memcpy(packet + 4, &sample_rate_float, 4);
+            memcpy(packet + 8, &flags_field, 2);
+            memcpy(packet + 10, &timestamp_lsbs, 2);
+            memcpy(packet + 12, &timestamp_msbs, 4);
+
+            /* a 1 kHz sine in each channel, with a different phase per channel */
+            for (size_t isample = 0; isample < samples_per_channel; isample++)
+                for (size_t ichannel = 0; ichannel < channels; ichannel++)
+                    write_sample(packet + ACOUSTIC_PACKET_HEADER_SIZE + (isample * channels + ichannel) * sizeof_sample, flags,
+                                 0.5 * sin(2.0 * M_PI * (1000.0 * (samples_sent + isample) / sample_rate + (double)ichannel / channels)));
+
+            size_t frame_size = cobs_encode(frame, packet, cobs_trailer_append(packet, packet_size, trailer));
+
+            if (corrupt_probability > 0 && random_uniform() < corrupt_probability) {
+                const unsigned kind = random_next() % 3;
+                const size_t ibyte = random_next() % (frame_size - 1);
+                if (0 == kind) {
+                    /* flip a bit without creating or destroying a zero byte */
+                    frame[ibyte] ^= 1U << (random_next() % 8);
+                    if (!frame[ibyte]) frame[ibyte] ^= 2;
+                    corrupted_bit++;
+                }
+                else if (1 == kind) {
+                    frame[ibyte] = 0;
+                    corrupted_zero++;
+                }
+                else {
+                    frame_size--;
+                    corrupted_delimiter++;
+                }
+            }
+
+            /* pace packets such that each is sent when its last sample would have been acquired */
+            if (speed > 0) {
+                const unsigned long long time_due = time_connected + ((samples_sent + samples_per_channel) * 1e9 / sample_rate) / speed +
+                    (jitter_microseconds > 0 ? random_uniform() * jitter_microseconds * 1000.0 : 0.0);
+                sleep_until_monotonic_nanoseconds(time_due);
+                if (got_sigterm_or_sigint) break;
+            }
+
+            for (size_t written = 0; written < frame_size; ) {
+                const ssize_t ret = write(fd, frame + written, frame_size - written);
+                if (ret > 0) written += ret;
+                else if (-1 == ret && EINTR == errno) {
+                    if (got_sigterm_or_sigint) break;
+                }
+                /* eio once the reader has closed the slave end, which is handled above */
+                else if (-1 == ret && EIO == errno) break;
+                else NOPE("%s: write(): %s\n", progname, strerror(errno));
+            }
+
+            packets_sent++;
+            bytes_sent += frame_size;
+            samples_sent += samples_per_channel;
+            seqnum++;
+        }
+    }
+
+    const double elapsed = time_started ? (monotonic_nanoseconds() - time_started) * 1e-9 : 0.0;
+    fprintf(stderr, "%s: sent %lu packets, %lu bytes in %.3f s, %.1f packets/s, %.3f MB/s\n", progname,
+            packets_sent, bytes_sent, elapsed, elapsed > 0 ? packets_sent / elapsed : 0.0, elapsed > 0 ? bytes_sent * 1e-6 / elapsed : 0.0);
+    if (corrupted_bit || corrupted_zero || corrupted_delimiter)
+        fprintf(stderr, "%s: corrupted %lu frames with a flipped bit, %lu with an unexpected zero, %lu with a missing delimiter\n",
+                progname, corrupted_bit, corrupted_zero, corrupted_delimiter);
+
+    /* give the reader a chance to drain the pty before the master end goes away */
+    while (!got_sigterm_or_sigint && reader_has_slave_open(fd)) {
+        int queued = 0;
+        if (-1 == ioctl(fd, TIOCOUTQ, &queued) || !queued) break;
+        usleep(10000);
+    }
+
+    if (link_path) unlink(link_path);
+    free(frame);
+    free(packet);
+    free(slave_path);
+    close(fd);
+}
@@ -57,6 +57,10 @@
 
 /* library functions */
 #include "shared_memory_ringbuffer.h"
+#include "metrics.h"
+#include "cobs.h"
+#include "chunk_logger.h"
+#include "retention.h"
 
 /* c standard includes */
 #include <stdio.h>
@@ -97,6 +101,19 @@ static void sigint_handler(int sig) {
     got_sigterm_or_sigint = 1;
 }
 
+volatile sig_atomic_t got_sigusr1 = 0;
+
+static void sigusr1_handler(int sig) {
+    (void)sig;
+    got_sigusr1 = 1;
+}
+
+static unsigned long long monotonic_microseconds(void) {
+    struct timespec timespec;
+    clock_gettime(CLOCK_MONOTONIC, &timespec);
+    return timespec.tv_sec * 1000000ULL + timespec.tv_nsec / 1000UL;
+}
+
 static speed_t parse_baud_rate(const unsigned long desired) {
     return (2400 == desired ? B2400 :
             4800 == desired ? B4800 :
@@ -209,55 +226,15 @@ static FILE * open_serial_port(const char * const path_and_maybe_baud) {
     return fh;
 }
 
-static ssize_t read_escaped_frame(unsigned char * const out, const size_t max_plain_size, FILE * fh) {
-    /* note: "out" must be large enough to hold an extra final appended zero */
-    unsigned char * dst = out;
-
-    while (1) {
-        /* read one byte */
-        int code;
-        if ((code = getc_unlocked(fh)) < 0) return -1;
-
-        /* got an end byte */
-        if (0 == code) break;
-
-        /* if we have gone too long without seeing an end byte... */
-        if ((size_t)(dst - out) + code > max_plain_size) {
-            fprintf(stderr, WARNING_ANSI " %s: missing end byte\n", __func__);
-
-            /* discard all further bytes until we see a zero byte, then reset */
-            do if ((code = getc_unlocked(fh)) < 0) return -1;
-            while (code);
-
-            dst = out;
-            continue;
-        }
-
-        /* read until next implicit zero, unless we get an unexpected explicit zero */
-        size_t ibyte = 0;
-        for (; ibyte < code - 1U; ibyte++) {
-            int byte;
-            if ((byte = getc_unlocked(fh)) < 0) return -1;
-            else if (0 == byte) break;
-
-            dst[ibyte] = byte;
-        }
-
-        /* if the above loop exited early, reset */
-        if (ibyte != code - 1U) {
-            fprintf(stderr, WARNING_ANSI " %s: unexpected zero byte\n", __func__);
-
-            dst = out;
-            continue;
-        }
-
-        dst += code - 1;
-
-        /* a special value of 0xff indicates that the block encodes 254 bytes */
-        if (code != 0xFF) *(dst++) = 0;
-    }
-
-    return dst > out ? (dst - out) - 1 : 0;
+/* parse a size given as a plain number of bytes with an optional k, M, or G binary suffix */
+static size_t parse_size(const char * const text) {
+    char * end;
+    const unsigned long long value = strtoull(text, &end, 10);
+    const unsigned long long multiplier = ('k' == *end || 'K' == *end ? 1ULL << 10 :
+                                           'M' == *end ? 1ULL << 20 :
+                                           'G' == *end ? 1ULL << 30 : 1);
+    if (end == text || (*end && end[1]) || (*end && 1 == multiplier) || value * multiplier > SIZE_MAX) return 0;
+    return value * multiplier;
 }
 
 static int text_packet(void * packet_buffer, const size_t packet_size) {
@@ -291,6 +268,10 @@ int main(const int argc, char ** const argv) {
         -1 == sigaction(SIGTERM, &(struct sigaction) { .sa_handler = sigint_handler }, NULL))
         NOPE("%s: sigaction(): %s\n", progname, strerror(errno));
 
+    /* sigusr1 dumps latency histograms to stderr, and must not interrupt blocking reads */
+    if (-1 == sigaction(SIGUSR1, &(struct sigaction) { .sa_handler = sigusr1_handler, .sa_flags = SA_RESTART }, NULL))
+        NOPE("%s: sigaction(): %s\n", progname, strerror(errno));
+
     if (argc > 1) {
         fprintf(stderr, "%s: called with:", progname);
         for (size_t iarg = 1; iarg < (size_t)argc; iarg++)
@@ -300,13 +281,45 @@ int main(const int argc, char ** const argv) {
 
     if (argc < 2) {
         fprintf(stderr, "Usage: %s /dev/tty.usbmodem24601 [/dev/shm/]\n", argv[0]);
-        fprintf(stderr, "where the optional second argument specifies the intermediate directory to which files will be written. This intermediate directory MUST NOT be in slow nonvolatile storage (such as on a microsd card) - the intention is that files will be moved to a final logging location after they are complete (and after applying compression if desired) by piping the output of %s into xargs or similar. If no second argument is given, only fanout via shm will be performed.\n", progname);
+        fprintf(stderr, "where the optional second argument specifies the intermediate directory to which files will be written. This intermediate directory should not be in slow nonvolatile storage (such as on a microsd card) unless LOGGING_DIRECT=1 is given - the intention is that files will be moved to a final logging location after they are complete (and after applying compression if desired) by piping the output of %s into xargs or similar. If no second argument is given, only fanout via shm will be performed.\n", progname);
+        fprintf(stderr, "Environment variables SHM_NAME (default /cobs_to_shm, or a path within a hugetlbfs mount), SHM_SIZE (default 4M, must be a power of two), SHM_PACKET_SIZE_MAX (default 65536, including the eight-byte logging header), SHM_DOUBLE_MAPPED (default 0), and SHM_CRITICAL_READERS (default 0) configure the shm ring buffer. COBS_TRAILER (none, crc16 or crc32c, default none) sets the integrity check the device appends to each packet. LOGGING_IO_URING (default 1) may be set to 0 to write files synchronously rather than via io_uring, LOGGING_DIRECT (default 0) set to 1 to write them with O_DIRECT, and LOGGING_STAGING_SIZE (default 16M) sets how much may be waiting to be written before packets are not logged. Logged files end at multiples of CHUNK_DURATION seconds (default 10) since the epoch, and once they would exceed CHUNK_SIZE bytes (default 0), either of which may be 0 for no limit. RETENTION_FREE (default 0, disabled) keeps that much space free in the logging directory, and in RETENTION_PATH if given, by removing the oldest completed files, or with RETENTION_THIN=1 every other file. LOGGING_SUMMARY=1 writes a small summary of each logged file alongside it, named as the file but ending in .summary.json. Latency histograms are printed to stderr every STATS_INTERVAL seconds (default 600, 0 to disable) and on SIGUSR1.\n");
         exit(EXIT_FAILURE);
     }
 
     unsigned short udp_input_port = 24597;
 
     const char * shm_name = getenv("SHM_NAME") ?: "/cobs_to_shm";
+
+    /* capacity of the shm ring buffer, which must be a power of two. at high channel counts
+     the default may be well under a second of data, so increase this if any reader may
+     stall for longer than that. for multi-gigabyte rings, consider giving SHM_NAME as a
+     path within a hugetlbfs mount, such as /dev/hugepages/cobs_to_shm */
+    const size_t shm_size = parse_size(getenv("SHM_SIZE") ?: "4M");
+    if (!shm_size || (shm_size & (shm_size - 1)))
+        NOPE("%s: SHM_SIZE must be a power of two\n", progname);
+
+    /* maximum size of each slot in the ring buffer, including the logging header, which
+     limits the size of the largest packet and also determines how much of the ring buffer
+     readers must treat as potentially being written to at any given moment */
+    const size_t shm_packet_size_max = parse_size(getenv("SHM_PACKET_SIZE_MAX") ?: "65536");
+
+    /* if nonzero, map the data segment of the ring buffer twice back to back, such that
+     slots wrap around seamlessly and no extra space past its end is needed */
+    const unsigned shm_double_mapped = atoi(getenv("SHM_DOUBLE_MAPPED") ?: "0") ? SHARED_MEMORY_RINGBUFFER_DOUBLE_MAPPED : 0;
+
+    /* if nonzero, rather than overwrite data not yet consumed by readers which have marked
+     themselves as critical (such as shm_logger), queue packets privately and drop them only
+     once the queue is full, delaying packets for all readers while the queue is non-empty */
+    const unsigned shm_critical_readers = atoi(getenv("SHM_CRITICAL_READERS") ?: "0") ? SHARED_MEMORY_RINGBUFFER_CRITICAL_READERS : 0;
+
+    const unsigned shm_flags = shm_double_mapped | shm_critical_readers;
+
+    /* if the device appends a crc to each packet, frames whose crc does not match are
+     discarded and counted, and the crc is removed from those that do */
+    const char * trailer_name = getenv("COBS_TRAILER") ?: "none";
+    enum cobs_trailer trailer;
+    if (-1 == cobs_trailer_parse(&trailer, trailer_name))
+        NOPE("%s: COBS_TRAILER must be none, crc16 or crc32c\n", progname);
     const char * escaped_serial_path = argv[1];
     const char * logging_path = argc > 2 ? argv[2] : NULL;
 
@@ -330,13 +343,29 @@ int main(const int argc, char ** const argv) {
 
     static_assert(!(sizeof(*buf) % 16), "max shared memory slot size must be a multiple of 16");
 
+    if (shm_packet_size_max < 32 || shm_packet_size_max > sizeof(*buf) || shm_packet_size_max % 16)
+        NOPE("%s: SHM_PACKET_SIZE_MAX must be a multiple of 16 between 32 and %zu\n", progname, sizeof(*buf));
+
+    /* largest packet that will fit in a slot after the logging header */
+    const size_t packet_size_max = shm_packet_size_max - sizeof(buf->logging_header);
+
     /* establish a shared-memory segment into which we will place the de-escaped incoming
      packets, which allows them to be shared with zero or more listening downstream
      processes in a zero-copy scheme, with no possibility of a slow reader blocking the
      writer or other readers */
-    struct shared_memory_ringbuffer * shm = shared_memory_ringbuffer_writer_init(shm_name, 4194304, sizeof(*buf));
+    struct shared_memory_ringbuffer * shm = shared_memory_ringbuffer_writer_init(shm_name, shm_size, shm_packet_size_max, shm_flags);
     if (MAP_FAILED == shm || !shm) exit(EXIT_FAILURE);
 
+    /* counters and histograms for monitoring via shm_stats. if this fails, carry on without */
+    struct metrics * metrics = metrics_create(shm_name, METRICS_SUFFIX_COBS_TO_SHM);
+    if (!metrics) fprintf(stderr, WARNING_ANSI " %s: metrics will not be available\n", progname);
+
+    /* histograms are printed for the values recorded since they were last printed */
+    const unsigned long long stats_interval_microseconds = strtoull(getenv("STATS_INTERVAL") ?: "600", NULL, 10) * 1000000ULL;
+    unsigned long long time_stats_printed = monotonic_microseconds();
+    char * stats_prefix = alloc_sprintf("%s: ", progname);
+    struct metrics * metrics_printed = metrics ? calloc(1, sizeof(*metrics)) : NULL;
+
     /* sleep a bit to give simultaneously-started readers a chance to connect for determinism */
     usleep(200000);
 
@@ -358,29 +387,83 @@ int main(const int argc, char ** const argv) {
     }, sizeof(struct sockaddr_in)))
         NOPE("%s: cannot bind(%d): %s\n", progname, udp_input_port, strerror(errno));
 
-    unsigned long long time_microseconds_file_start = 0;
-    FILE * fh = NULL;
-    char * path = NULL;
+    /* files are written via io_uring where available, unless LOGGING_IO_URING is zero, in
+     which case this loop may block on the filesystem. otherwise, if the filesystem stalls for
+     longer than LOGGING_STAGING_SIZE takes to fill, packets are dropped from the log rather
+     than from the serial input and the ring buffer. LOGGING_DIRECT bypasses the page cache,
+     allowing the logging path to be on slow nonvolatile storage */
+    const size_t logging_staging_size = parse_size(getenv("LOGGING_STAGING_SIZE") ?: "16M");
+    if (!logging_staging_size) NOPE("%s: LOGGING_STAGING_SIZE must be a size in bytes\n", progname);
+
+    /* files end at multiples of CHUNK_DURATION seconds since the epoch, and once they would
+     exceed CHUNK_SIZE bytes, either of which may be zero for no limit */
+    const char * const chunk_duration_text = getenv("CHUNK_DURATION") ?: "10", * const chunk_size_text = getenv("CHUNK_SIZE") ?: "0";
+    char * chunk_duration_end;
+    const unsigned long long chunk_duration = strtoull(chunk_duration_text, &chunk_duration_end, 10);
+    const unsigned long long chunk_size = parse_size(chunk_size_text);
+    if (chunk_duration_end == chunk_duration_text || *chunk_duration_end) NOPE("%s: CHUNK_DURATION must be a whole number of seconds\n", progname);
+    if (!chunk_size && strcmp(chunk_size_text, "0")) NOPE("%s: CHUNK_SIZE must be a size in bytes\n", progname);
+    if (!chunk_duration && !chunk_size) NOPE("%s: CHUNK_DURATION and CHUNK_SIZE cannot both be zero\n", progname);
+
+    const unsigned logging_flags = CHUNK_LOGGER_NONBLOCKING |
+                                   (atoi(getenv("LOGGING_IO_URING") ?: "1") ? 0 : CHUNK_LOGGER_SYNCHRONOUS) |
+                                   (atoi(getenv("LOGGING_DIRECT") ?: "0") ? CHUNK_LOGGER_DIRECT : 0);
+
+    /* with LOGGING_SUMMARY, each file is accompanied by a small summary of its contents, such
+     that weeks of data can be overviewed without reading it */
+    const unsigned logging_summary = atoi(getenv("LOGGING_SUMMARY") ?: "0") ? CHUNK_LOGGER_SUMMARY : 0;
+
+    struct chunk_logger * logger = NULL;
+    if (logging_path && !(logger = chunk_logger_open(logging_path, NULL, chunk_duration * 1000000ULL, chunk_size, logging_staging_size, logging_flags | logging_summary, metrics)))
+        NOPE("%s: could not start logging to %s\n", progname, logging_path);
+
+    /* with RETENTION_FREE, the oldest completed files are removed as needed to keep that much
+     space free on the filesystem of the logging directory, and of RETENTION_PATH if given,
+     which is typically where completed files are moved to. with RETENTION_THIN, every other
+     file is removed instead, oldest first */
+    const char * const retention_free_text = getenv("RETENTION_FREE") ?: "0", * const retention_path = getenv("RETENTION_PATH");
+    const unsigned long long retention_free = parse_size(retention_free_text);
+    if (!retention_free && strcmp(retention_free_text, "0")) NOPE("%s: RETENTION_FREE must be a size in bytes\n", progname);
+    const unsigned retention_flags = atoi(getenv("RETENTION_THIN") ?: "0") ? RETENTION_THIN : 0;
+    if (logger && retention_free) {
+        if (retention_path && -1 == chunk_logger_retain(logger, retention_path, retention_free, retention_flags))
+            NOPE("%s: cannot keep space free in %s\n", progname, retention_path);
+        if (-1 == chunk_logger_retain(logger, logging_path, retention_free, retention_flags))
+            NOPE("%s: cannot keep space free in %s\n", progname, logging_path);
+    }
+    unsigned long logging_drops_previous = 0;
 
     unsigned long long packet_time_previous = 0;
+    unsigned long long time_readers_checked = 0;
+    unsigned long critical_drops_previous = 0;
 
     /* get the next slot in the ring buffer */
     buf = shared_memory_ringbuffer_acquire(shm);
 
     /* loop over whole packets */
     while (1) {
-        const ssize_t ret = read_escaped_frame(buf->packet, sizeof(buf->packet), fh_serial);
+        const ssize_t ret = cobs_read_frame(buf->packet, packet_size_max, fh_serial, metrics);
         if (got_sigterm_or_sigint) break;
 
-        /* if read_escaped_frame returns -1, we either got eof or an error on the input */
+        /* if cobs_read_frame returns -1, we either got eof or an error on the input */
         else if (-1 == ret) {
             if (ENXIO != errno)
                 fprintf(stderr, "%s: %s\n", progname, strerror(errno));
             break;
         }
 
-        const size_t packet_size = ret;
+        /* verify and remove the trailer, if any. empty frames, which carry no trailer, are
+         passed through as they always have been */
+        const ssize_t checked = trailer && ret ? cobs_trailer_check(buf->packet, ret, trailer) : ret;
+        if (-1 == checked) {
+            fprintf(stderr, WARNING_ANSI " %s: %s mismatch in %zd byte frame\n", progname, trailer_name, ret);
+            if (metrics) metrics_add(&metrics->cobs_trailer_mismatch, 1);
+            continue;
+        }
+
+        const size_t packet_size = checked;
         const unsigned long long packet_time_microseconds = current_time_in_unix_microseconds();
+        const unsigned long long time_received = monotonic_microseconds();
 
         /* check whether a SIGINT or SIGTERM arrived before handling other errors */
         if (got_sigterm_or_sigint) {
@@ -388,35 +471,16 @@ int main(const int argc, char ** const argv) {
             break;
         }
 
-        if (packet_time_previous > packet_time_microseconds)
+        if (packet_time_previous > packet_time_microseconds) {
             fprintf(stderr, WARNING_ANSI " %s: time has jumped backwards by %lld us, new time is %llu\n",
                     progname, packet_time_previous - packet_time_microseconds, packet_time_microseconds);
-        packet_time_previous = packet_time_microseconds;
-
-        const unsigned long long packet_time_microseconds_rounded_down_to_10s = packet_time_microseconds - (packet_time_microseconds % 10000000ULL);
-
-        /* if rounding down gives a time later than the file start time, we need to close
-         the old file and then create a new one in the next step */
-        if (fh && packet_time_microseconds_rounded_down_to_10s > time_microseconds_file_start) {
-            fclose(fh);
-            printf("%s\n", path);
-            free(path);
-            fh = NULL;
+            if (metrics) metrics_add(&metrics->time_jumps_backwards, 1);
         }
+        packet_time_previous = packet_time_microseconds;
 
-        /* if we just closed the most recent file or haven't opened one yet, open a new one */
-        if (!fh && logging_path) {
-            /* construct timestamp in ISO 8601 format, no separators, rounded down to seconds */
-            struct tm unixtime_struct;
-            gmtime_r(&(time_t) { packet_time_microseconds / 1000000ULL }, &unixtime_struct);
-            char timestamp[17];
-            strftime(timestamp, 17, "%Y%m%dT%H%M%SZ", &unixtime_struct);
-
-            path = alloc_sprintf("%s/%s.bin", logging_path, timestamp);
-            fh = fopen(path, "w");
-            if (!fh) NOPE("%s: fopen(%s): %s\n", progname, path, strerror(errno));
-            time_microseconds_file_start = packet_time_microseconds;
-            /* would be nice to write to stderr here, but even logged writes to stderr can block */
+        if (metrics) {
+            metrics_add(&metrics->frames, 1);
+            metrics_add(&metrics->frame_bytes, packet_size);
         }
 
         /* populate the eight bytes we're prepending to each packet on disk and in shared memory */
@@ -433,17 +497,51 @@ int main(const int argc, char ** const argv) {
             memset(buf->packet + packet_size, 0, packet_size_padded - packet_size);
 
         /* done constructing unpadded portion of header and payload, release to readers */
-        shared_memory_ringbuffer_send(shm, sizeof(buf->logging_header) + packet_size);
+        shared_memory_ringbuffer_send_with_time(shm, sizeof(buf->logging_header) + packet_size, packet_time_microseconds);
+        const unsigned long long time_published = monotonic_microseconds();
 
-        /* write the packet to the current output file. WARNING: this should not be a file on sd */
-        if (fh && !fwrite(buf, sizeof(buf->logging_header) + packet_size_padded, 1, fh))
-            NOPE("%s: fwrite(): %s\n", progname, strerror(errno));
+        /* append the packet to the current output file, starting a new one as necessary */
+        if (logger) chunk_logger_write(logger, buf, sizeof(buf->logging_header) + packet_size_padded, packet_time_microseconds);
+
+        if (metrics) metrics_histogram_record(&metrics->receive_to_publish, time_published - time_received);
 
         text_packet(buf->packet, packet_size);
 
         const unsigned elapsed = current_time_in_unix_microseconds() - packet_time_microseconds;
         if (elapsed >= 100000)
             fprintf(stderr, WARNING_ANSI " %s: output took %u ms\n", progname, elapsed / 1000U);
+        if (metrics) metrics_histogram_record(&metrics->output_latency, elapsed);
+
+        if (metrics_printed && (got_sigusr1 || (stats_interval_microseconds && time_published - time_stats_printed >= stats_interval_microseconds))) {
+            got_sigusr1 = 0;
+            time_stats_printed = time_published;
+            metrics_print_latencies(stderr, stats_prefix, metrics, metrics_printed);
+            memcpy(metrics_printed, metrics, sizeof(*metrics));
+        }
+
+        /* once per second, warn about any registered readers in danger of being lapped */
+        if (packet_time_microseconds - time_readers_checked >= 1000000) {
+            time_readers_checked = packet_time_microseconds;
+
+            struct shared_memory_ringbuffer_reader_status statuses[32];
+            const size_t count = shared_memory_ringbuffer_writer_list_readers(shm, statuses, 32);
+            for (size_t ireader = 0; ireader < count; ireader++)
+                if (!statuses[ireader].critical && statuses[ireader].lag * 4 > statuses[ireader].capacity * 3 && statuses[ireader].lag <= statuses[ireader].capacity)
+                    fprintf(stderr, WARNING_ANSI " %s: reader %ld is %zu bytes behind, %.0f%% of the way to being lapped\n",
+                            progname, statuses[ireader].pid, statuses[ireader].lag, 100.0 * statuses[ireader].lag / statuses[ireader].capacity);
+
+            const unsigned long critical_drops = shared_memory_ringbuffer_writer_critical_drops(shm);
+            if (critical_drops != critical_drops_previous)
+                fprintf(stderr, WARNING_ANSI " %s: dropped %lu packets because a critical reader fell too far behind\n",
+                        progname, critical_drops - critical_drops_previous);
+            critical_drops_previous = critical_drops;
+
+            const unsigned long logging_drops = logger ? chunk_logger_drops(logger) : 0;
+            if (logging_drops != logging_drops_previous)
+                fprintf(stderr, WARNING_ANSI " %s: did not log %lu packets because the filesystem could not keep up or was full\n",
+                        progname, logging_drops - logging_drops_previous);
+            logging_drops_previous = logging_drops;
+        }
 
         /* get the next slot in the ring buffer */
         buf = shared_memory_ringbuffer_acquire(shm);
@@ -451,8 +549,13 @@ int main(const int argc, char ** const argv) {
         /* loop over any udp packets that arrived during this acoustic packet */
         /* TODO: ideally we would use poll() and react to each of these and the acoustic
          packets strictly in the order they occur */
-        for (ssize_t recv_ret; (recv_ret = recv(fd_udp, buf->packet, sizeof(buf->packet), 0)) > 0; ) {
+        for (ssize_t recv_ret; (recv_ret = recv(fd_udp, buf->packet, packet_size_max, 0)) > 0; ) {
             const size_t udp_packet_size = recv_ret;
+            const unsigned long long time_udp_received = monotonic_microseconds();
+            if (metrics) {
+                metrics_add(&metrics->udp_packets, 1);
+                metrics_add(&metrics->udp_bytes, udp_packet_size);
+            }
 
             /* for now, timestamp is the same as that of the acoustic packet during which
              the nonacoustic packet arrived. we really only care about preserving the order
@@ -469,11 +572,13 @@ int main(const int argc, char ** const argv) {
                 memset(buf->packet + udp_packet_size, 0, udp_packet_size_padded - udp_packet_size);
 
             /* release to readers */
-            shared_memory_ringbuffer_send(shm, sizeof(buf->logging_header) + udp_packet_size);
+            shared_memory_ringbuffer_send_with_time(shm, sizeof(buf->logging_header) + udp_packet_size, packet_time_microseconds);
+            const unsigned long long time_udp_published = monotonic_microseconds();
+
+            /* append the packet to the current output file */
+            if (logger) chunk_logger_write(logger, buf, sizeof(buf->logging_header) + udp_packet_size_padded, packet_time_microseconds);
 
-            /* write the packet to the current output file. WARNING: this should not be a file on sd */
-            if (!fwrite(buf, sizeof(buf->logging_header) + udp_packet_size_padded, 1, fh))
-                NOPE("%s: fwrite(): %s\n", progname, strerror(errno));
+            if (metrics) metrics_histogram_record(&metrics->receive_to_publish, time_udp_published - time_udp_received);
 
             /* get the next slot in the ring buffer */
             buf = shared_memory_ringbuffer_acquire(shm);
@@ -482,13 +587,17 @@ int main(const int argc, char ** const argv) {
 
     fprintf(stderr, "%s: exiting\n", progname);
 
-    if (fh) {
-        fclose(fh);
-        printf("%s\n", path);
-        free(path);
-    }
+    /* finish writing and emit the last file */
+    chunk_logger_close(logger);
 
     close(fd_udp);
 
+    if (metrics_printed) metrics_print_latencies(stderr, stats_prefix, metrics, metrics_printed);
+    free(metrics_printed);
+    free(stats_prefix);
+
+    metrics_close(metrics);
+    shared_memory_ringbuffer_writer_close(shm);
+
     return 0;
 }
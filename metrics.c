@@ -0,0 +1,120 @@
+/* campbell, isc license */
+#include "metrics.h"
+#include "shared_memory_ringbuffer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+static_assert(2 == ATOMIC_LONG_LOCK_FREE, "long is not lock free");
+
+/* the segment is a page regardless, so keep the mapped size alongside the struct */
+struct metrics_segment {
+    struct metrics metrics;
+    size_t mapped_size;
+};
+
+struct metrics * metrics_create(const char * shm_name, const char * suffix) {
+    size_t mapped_size;
+    struct metrics_segment * segment = shared_memory_ringbuffer_sibling_create(shm_name, suffix, sizeof(*segment), 0, &mapped_size);
+    if (!segment) return NULL;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    *segment = (struct metrics_segment) {
+        .metrics = {
+            .version = METRICS_VERSION,
+            .time_started = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000U,
+        },
+        .mapped_size = mapped_size
+    };
+
+    /* atomic store, must be last */
+    segment->metrics.writer_pid = getpid();
+
+    return &segment->metrics;
+}
+
+void metrics_close(struct metrics * metrics) {
+    if (!metrics) return;
+    metrics->writer_pid = 0;
+
+    struct metrics_segment * segment = (void *)metrics;
+    munmap(segment, segment->mapped_size);
+}
+
+const struct metrics * metrics_open(const char * shm_name, const char * suffix) {
+    size_t mapped_size;
+    struct metrics_segment * segment = shared_memory_ringbuffer_sibling_open(shm_name, suffix, sizeof(*segment), 0, &mapped_size);
+    if (!segment) return NULL;
+
+    if (METRICS_VERSION != segment->metrics.version) {
+        fprintf(stderr, "error: %s: metrics version %u, expected %u\n", __func__, segment->metrics.version, METRICS_VERSION);
+        munmap(segment, mapped_size);
+        return NULL;
+    }
+
+    return &segment->metrics;
+}
+
+void metrics_unmap(const struct metrics * metrics) {
+    const struct metrics_segment * segment = (const void *)metrics;
+    munmap((void *)segment, segment->mapped_size);
+}
+
+unsigned long metrics_histogram_bucket_upper_bound(const unsigned ibucket) {
+    if (ibucket < METRICS_HISTOGRAM_SUB_BUCKETS) return ibucket;
+    if (ibucket == METRICS_HISTOGRAM_BUCKETS - 1) return ULONG_MAX;
+
+    const unsigned magnitude = ibucket / METRICS_HISTOGRAM_SUB_BUCKETS + 2;
+    const unsigned long lower = (unsigned long)(METRICS_HISTOGRAM_SUB_BUCKETS + ibucket % METRICS_HISTOGRAM_SUB_BUCKETS) << (magnitude - 3);
+    return lower + (1UL << (magnitude - 3)) - 1;
+}
+
+void metrics_print_latencies(FILE * fh, const char * prefix, const struct metrics * now, const struct metrics * before) {
+    static const char * const names[] = { "receive to publish", "publish to disk", "timestamp to output", "file rotation" };
+    const size_t offsets[] = { offsetof(struct metrics, receive_to_publish), offsetof(struct metrics, publish_to_disk),
+                               offsetof(struct metrics, output_latency), offsetof(struct metrics, rotation_latency) };
+
+    for (size_t ihistogram = 0; ihistogram < sizeof(offsets) / sizeof(offsets[0]); ihistogram++) {
+        const struct metrics_histogram * histogram_now = (const void *)((const char *)now + offsets[ihistogram]);
+        const struct metrics_histogram * histogram_before = (const void *)((const char *)before + offsets[ihistogram]);
+
+        unsigned long count = 0;
+        for (size_t ibucket = 0; ibucket < METRICS_HISTOGRAM_BUCKETS; ibucket++)
+            count += histogram_now->count[ibucket] - histogram_before->count[ibucket];
+        if (!count) continue;
+
+        fprintf(fh, "%s%s: %lu samples, p50 %lu, p90 %lu, p99 %lu, p99.9 %lu us, max since start %lu us\n", prefix, names[ihistogram], count,
+                metrics_histogram_quantile(histogram_now, histogram_before, 0.5),
+                metrics_histogram_quantile(histogram_now, histogram_before, 0.9),
+                metrics_histogram_quantile(histogram_now, histogram_before, 0.99),
+                metrics_histogram_quantile(histogram_now, histogram_before, 0.999),
+                (unsigned long)histogram_now->max);
+    }
+}
+
+unsigned long metrics_histogram_quantile(const struct metrics_histogram * now, const struct metrics_histogram * before, const double quantile) {
+    unsigned long total = 0;
+    for (size_t ibucket = 0; ibucket < METRICS_HISTOGRAM_BUCKETS; ibucket++)
+        total += now->count[ibucket] - before->count[ibucket];
+    if (!total) return 0;
+
+    /* smallest bucket at which the cumulative count reaches the requested quantile */
+    const double target = quantile * total;
+    unsigned long cumulative = 0;
+    for (size_t ibucket = 0; ibucket < METRICS_HISTOGRAM_BUCKETS; ibucket++) {
+        cumulative += now->count[ibucket] - before->count[ibucket];
+        if (cumulative >= target && cumulative) {
+            /* the maximum is never an overestimate, unlike the upper bound of the bucket */
+            const unsigned long bound = metrics_histogram_bucket_upper_bound(ibucket);
+            return bound < now->max ? bound : now->max;
+        }
+    }
+
+    return now->max;
+}
@@ -0,0 +1,128 @@
+/* campbell, isc license */
+
+/* counters and histograms published by cobs_to_shm and shm_logger in small shm segments
+ alongside the ring buffer (e.g. "/cobs_to_shm.metrics" and "/cobs_to_shm.shm_logger.metrics"),
+ such that throughput and error rates can be monitored by shm_stats, shm_prom or any other
+ process without parsing stderr. the writer is the only process
+ which modifies any of these, so it uses relaxed atomics, and readers compute rates and
+ percentiles from the difference between two snapshots */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+/* incremented whenever the layout of the struct below changes */
+#define METRICS_VERSION 6
+
+/* histograms are log-linear, as in hdrhistogram: values below 8 each get their own bucket,
+ and every power of two above that is split into 8 linear sub-buckets, such that any value
+ up to 2^32 - 1 is known to within 12.5%. values beyond that go in the last bucket */
+#define METRICS_HISTOGRAM_SUB_BUCKETS 8
+#define METRICS_HISTOGRAM_BUCKETS 240
+
+struct metrics_histogram {
+    _Atomic unsigned long count[METRICS_HISTOGRAM_BUCKETS];
+    _Atomic unsigned long max;
+    _Atomic unsigned long long sum;
+};
+
+struct metrics {
+    unsigned version;
+
+    /* pid of the writer, or zero once it has exited */
+    _Atomic long writer_pid;
+
+    /* unix time in microseconds at which the writer started */
+    unsigned long long time_started;
+
+    /* frames successfully decoded from the serial input, and their total size */
+    _Atomic unsigned long frames;
+    _Atomic unsigned long frame_bytes;
+
+    /* frames discarded by the cobs decoder */
+    _Atomic unsigned long cobs_missing_end_byte;
+    _Atomic unsigned long cobs_unexpected_zero_byte;
+
+    /* frames discarded because their crc trailer did not match, if trailers are enabled */
+    _Atomic unsigned long cobs_trailer_mismatch;
+
+    /* packets received via udp, and their total size */
+    _Atomic unsigned long udp_packets;
+    _Atomic unsigned long udp_bytes;
+
+    /* bytes of records accepted by the logger, excluding those dropped, and number of completed
+     logged files */
+    _Atomic unsigned long bytes_logged;
+    _Atomic unsigned long files_logged;
+
+    /* records not logged because the device could not keep up and the logger could not wait,
+     or because the filesystem was full */
+    _Atomic unsigned long logging_drops;
+
+    /* completed files removed to keep space free */
+    _Atomic unsigned long files_removed;
+
+    /* number of times the system clock was seen to jump backwards */
+    _Atomic unsigned long time_jumps_backwards;
+
+    /* microseconds between each frame being timestamped and being fully output */
+    struct metrics_histogram output_latency;
+
+    /* microseconds between the read of each frame returning and the frame being sent to the
+     ring buffer, and, once per staging block of the logger, between the host timestamp of the
+     first record in the block and the block having been written to the logged file */
+    struct metrics_histogram receive_to_publish;
+    struct metrics_histogram publish_to_disk;
+
+    /* microseconds taken to close each logged file and open the next */
+    struct metrics_histogram rotation_latency;
+};
+
+/* suffixes of the segments published by each process, appended to the ring buffer name */
+#define METRICS_SUFFIX_COBS_TO_SHM ".metrics"
+#define METRICS_SUFFIX_SHM_LOGGER ".shm_logger.metrics"
+
+static inline void metrics_add(_Atomic unsigned long * counter, const unsigned long value) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static inline unsigned metrics_histogram_bucket(const unsigned long value) {
+    if (value < METRICS_HISTOGRAM_SUB_BUCKETS) return value;
+
+    /* index of the most significant bit, which is at least 3 here */
+    const unsigned magnitude = 8 * sizeof(long) - 1 - __builtin_clzl(value);
+    const unsigned ibucket = METRICS_HISTOGRAM_SUB_BUCKETS * (magnitude - 2) + ((value >> (magnitude - 3)) & (METRICS_HISTOGRAM_SUB_BUCKETS - 1));
+    return ibucket < METRICS_HISTOGRAM_BUCKETS ? ibucket : METRICS_HISTOGRAM_BUCKETS - 1;
+}
+
+static inline void metrics_histogram_record(struct metrics_histogram * histogram, const unsigned long value) {
+    metrics_add(&histogram->count[metrics_histogram_bucket(value)], 1);
+    atomic_store_explicit(&histogram->sum, atomic_load_explicit(&histogram->sum, memory_order_relaxed) + value, memory_order_relaxed);
+    if (value > atomic_load_explicit(&histogram->max, memory_order_relaxed))
+        atomic_store_explicit(&histogram->max, value, memory_order_relaxed);
+}
+
+/* writer calls this to create the metrics segment for the given ring buffer name and suffix,
+ returning NULL if it could not be created, in which case the writer should carry on without */
+struct metrics * metrics_create(const char * shm_name, const char * suffix);
+
+/* writer calls this when exiting */
+void metrics_close(struct metrics * metrics);
+
+/* readers call this to map the metrics segment read-only, returning NULL if it does not
+ exist or has an incompatible layout */
+const struct metrics * metrics_open(const char * shm_name, const char * suffix);
+
+/* readers call this when done */
+void metrics_unmap(const struct metrics * metrics);
+
+/* largest value which would be counted in the given bucket */
+unsigned long metrics_histogram_bucket_upper_bound(const unsigned ibucket);
+
+/* prints the count, p50, p90, p99, p99.9 and maximum of each latency histogram for the values
+ recorded between two snapshots, one histogram per line, each line prefixed with the prefix */
+void metrics_print_latencies(FILE * fh, const char * prefix, const struct metrics * now, const struct metrics * before);
+
+/* returns the upper bound of the bucket containing the given quantile of the values counted
+ in the difference between two snapshots of a histogram, clamped to the maximum value ever
+ recorded, or 0 if there were none */
+unsigned long metrics_histogram_quantile(const struct metrics_histogram * now, const struct metrics_histogram * before, const double quantile);
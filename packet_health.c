@@ -0,0 +1,389 @@
+/* campbell, isc license */
+
+/* health monitor which reads every packet from the ring buffer and, once per interval, prints
+ the min, max, rms, dc offset and number of clipped samples of each channel, along with packet
+ and sample rates, sequence number gaps, and the jitter of the device timestamps relative to
+ those expected from the nominal sample rate, and the drift of the device clock implied by
+ them. equivalent to packet_health.py, but able to keep up with many channels at high rates,
+ as the per-channel reductions over 16-bit samples are done with gcc vector extensions, which
+ compile to simd instructions on any target that has them. invoke as "packet_health [shm name]
+ [interval in seconds]". when stdout is a terminal, the display is redrawn in place */
+#include "shared_memory_ringbuffer.h"
+#include "acoustic_packet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdint.h>
+#include <math.h>
+#include <float.h>
+#include <time.h>
+#include <unistd.h>
+
+/* useful macros */
+#define WARNING_ANSI "\x1B[35;1mwarning:\x1B[0m"
+#define ERROR_ANSI "\x1B[31;1merror:\x1B[0m"
+#define NOPE(...) do { fprintf(stderr, ERROR_ANSI " " __VA_ARGS__); exit(EXIT_FAILURE); } while(0)
+
+/* number of 16-bit samples reduced at once, which spans two sse or neon registers or one avx2
+ register, and of which most common channel counts are factors */
+#define LANES 16
+
+typedef int16_t vec_int16 __attribute__((vector_size(LANES * sizeof(int16_t))));
+typedef float vec_float __attribute__((vector_size(LANES * sizeof(float))));
+
+#define CHANNELS_MAX 255
+
+/* maximum number of packets consumed per wakeup */
+#define BATCH_PACKETS 256
+
+static unsigned long long current_time_in_unix_microseconds(void) {
+    struct timespec timespec;
+    clock_gettime(CLOCK_REALTIME, &timespec);
+    return timespec.tv_sec * 1000000ULL + timespec.tv_nsec / 1000UL;
+}
+
+static volatile sig_atomic_t got_sigterm_or_sigint = 0;
+
+static void sigint_handler(int sig) {
+    (void)sig;
+    got_sigterm_or_sigint = 1;
+}
+
+struct channel_statistics {
+    double min, max, sum, sum_squares;
+    unsigned long clips;
+};
+
+/* accumulated over one interval, or over one batch until it is known that the writer did not
+ overwrite any of it while it was being read */
+struct health {
+    unsigned long packets, packets_nonacoustic, packets_other_format, samples_per_channel;
+    unsigned long seqnum_gaps, packets_missing;
+
+    /* over consecutive packets, the differences between their device timestamps, and between
+     those and the differences expected from the sample counts and nominal sample rate */
+    unsigned long timestamp_intervals;
+    double timestamp_microseconds, timestamp_microseconds_expected;
+    double timestamp_error_sum_squares, timestamp_error_max;
+
+    struct channel_statistics channels[CHANNELS_MAX];
+};
+
+/* carried from each packet to the next */
+struct stream {
+    struct acoustic_packet_header format;
+    int have_format;
+    float fullscale;
+
+    struct acoustic_packet_header previous;
+    int have_previous;
+};
+
+static void channels_reset(struct health * health, const size_t channels) {
+    for (size_t ichannel = 0; ichannel < channels; ichannel++)
+        health->channels[ichannel] = (struct channel_statistics) { .min = DBL_MAX, .max = -DBL_MAX };
+}
+
+static void health_reset(struct health * health, const size_t channels) {
+    memset(health, 0, offsetof(struct health, channels));
+    channels_reset(health, channels);
+}
+
+static void health_merge(struct health * to, const struct health * from, const size_t channels) {
+    to->packets += from->packets;
+    to->packets_nonacoustic += from->packets_nonacoustic;
+    to->packets_other_format += from->packets_other_format;
+    to->samples_per_channel += from->samples_per_channel;
+    to->seqnum_gaps += from->seqnum_gaps;
+    to->packets_missing += from->packets_missing;
+    to->timestamp_intervals += from->timestamp_intervals;
+    to->timestamp_microseconds += from->timestamp_microseconds;
+    to->timestamp_microseconds_expected += from->timestamp_microseconds_expected;
+    to->timestamp_error_sum_squares += from->timestamp_error_sum_squares;
+    if (from->timestamp_error_max > to->timestamp_error_max) to->timestamp_error_max = from->timestamp_error_max;
+
+    for (size_t ichannel = 0; ichannel < channels; ichannel++) {
+        struct channel_statistics * a = to->channels + ichannel;
+        const struct channel_statistics * b = from->channels + ichannel;
+        if (b->min < a->min) a->min = b->min;
+        if (b->max > a->max) a->max = b->max;
+        a->sum += b->sum;
+        a->sum_squares += b->sum_squares;
+        a->clips += b->clips;
+    }
+}
+
+static size_t greatest_common_divisor(size_t a, size_t b) {
+    while (b) {
+        const size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* reduces count interleaved 16-bit samples of the given number of channels. within each group
+ of lcm(channels, LANES) samples, lane l of the kth vector always belongs to the same channel,
+ (k * LANES + l) % channels, so each vector position has its own accumulators, which are
+ folded into the channels once per packet. any samples after the last whole group are done
+ one at a time */
+static void accumulate_int16(struct channel_statistics * statistics, const unsigned char * samples, const size_t channels, const size_t count) {
+    static vec_int16 min[CHANNELS_MAX], max[CHANNELS_MAX], clips[CHANNELS_MAX];
+    static vec_float sum[CHANNELS_MAX], sum_squares[CHANNELS_MAX];
+
+    const size_t vectors_per_group = channels / greatest_common_divisor(channels, LANES);
+    const size_t groups = count / (vectors_per_group * LANES);
+
+    if (groups) {
+        for (size_t ivector = 0; ivector < vectors_per_group; ivector++) {
+            min[ivector] = (vec_int16) { 0 } + INT16_MAX;
+            max[ivector] = (vec_int16) { 0 } + INT16_MIN;
+            clips[ivector] = (vec_int16) { 0 };
+            sum[ivector] = (vec_float) { 0 };
+            sum_squares[ivector] = (vec_float) { 0 };
+        }
+
+        for (size_t igroup = 0; igroup < groups; igroup++)
+            for (size_t ivector = 0; ivector < vectors_per_group; ivector++) {
+                vec_int16 x;
+                memcpy(&x, samples + (igroup * vectors_per_group + ivector) * sizeof(vec_int16), sizeof(vec_int16));
+
+                /* comparisons give all ones where true, from which selects are built */
+                const vec_int16 below = x < min[ivector], above = x > max[ivector];
+                min[ivector] = (x & below) | (min[ivector] & ~below);
+                max[ivector] = (x & above) | (max[ivector] & ~above);
+                clips[ivector] -= (x >= INT16_MAX) | (x <= -INT16_MAX);
+
+                const vec_float y = __builtin_convertvector(x, vec_float);
+                sum[ivector] += y;
+                sum_squares[ivector] += y * y;
+            }
+
+        for (size_t ivector = 0; ivector < vectors_per_group; ivector++)
+            for (size_t ilane = 0; ilane < LANES; ilane++) {
+                struct channel_statistics * channel = statistics + (ivector * LANES + ilane) % channels;
+                if (min[ivector][ilane] < channel->min) channel->min = min[ivector][ilane];
+                if (max[ivector][ilane] > channel->max) channel->max = max[ivector][ilane];
+                channel->clips += (uint16_t)clips[ivector][ilane];
+                channel->sum += sum[ivector][ilane];
+                channel->sum_squares += sum_squares[ivector][ilane];
+            }
+    }
+
+    for (size_t isample = groups * vectors_per_group * LANES; isample < count; isample++) {
+        int16_t value;
+        memcpy(&value, samples + isample * sizeof(int16_t), sizeof(int16_t));
+        struct channel_statistics * channel = statistics + isample % channels;
+        if (value < channel->min) channel->min = value;
+        if (value > channel->max) channel->max = value;
+        channel->clips += value >= INT16_MAX || value <= -INT16_MAX;
+        channel->sum += value;
+        channel->sum_squares += (double)value * value;
+    }
+}
+
+static double sample_value(const unsigned char * sample, const unsigned dtype) {
+    if (1 == dtype) { int32_t value; memcpy(&value, sample, 4); return value; }
+    else if (3 == dtype) { float value; memcpy(&value, sample, 4); return value; }
+    else if (4 == dtype) return (int8_t)sample[0];
+    else return (int32_t)((uint32_t)sample[0] << 8 | (uint32_t)sample[1] << 16 | (uint32_t)sample[2] << 24) >> 8;
+}
+
+/* samples other than 16-bit are rare enough not to warrant their own vector code */
+static void accumulate_other(struct channel_statistics * statistics, const unsigned char * samples, const size_t channels, const size_t count,
+                             const unsigned dtype, const size_t sizeof_sample, const double fullscale) {
+    for (size_t isample = 0; isample < count; isample++) {
+        const double value = sample_value(samples + isample * sizeof_sample, dtype);
+        struct channel_statistics * channel = statistics + isample % channels;
+        if (value < channel->min) channel->min = value;
+        if (value > channel->max) channel->max = value;
+        channel->clips += value >= fullscale || value <= -fullscale;
+        channel->sum += value;
+        channel->sum_squares += value * value;
+    }
+}
+
+static void accumulate_packet(struct health * health, struct stream * stream, const unsigned char * packet, const size_t size) {
+    struct acoustic_packet_header header;
+    if (acoustic_packet_parse(&header, packet, size)) {
+        health->packets_nonacoustic++;
+        return;
+    }
+
+    if (!stream->have_format) {
+        const unsigned dtype = header.flags & 0x7;
+        stream->format = header;
+        stream->fullscale = 0 == dtype ? 32767.0f : 1 == dtype ? 2147483647.0f : 3 == dtype ? 1.0f : 4 == dtype ? 127.0f : 8388607.0f;
+        stream->have_format = 1;
+        channels_reset(health, header.channels);
+    }
+
+    if (header.channels != stream->format.channels || header.flags != stream->format.flags || header.sample_rate != stream->format.sample_rate) {
+        health->packets_other_format++;
+        stream->have_previous = 0;
+        return;
+    }
+
+    if (stream->have_previous) {
+        const struct acoustic_packet_header * previous = &stream->previous;
+        const uint16_t missing = header.seqnum - previous->seqnum - 1;
+        if (missing) {
+            health->seqnum_gaps++;
+            health->packets_missing += missing;
+        }
+        else if (header.sample_rate > 0) {
+            const double interval = (double)header.timestamp_microseconds - (double)previous->timestamp_microseconds;
+            /* each timestamp marks the end of its packet, so they differ by the duration of this one */
+            const double expected = header.samples_per_channel * 1e6 / header.sample_rate;
+            const double error = fabs(interval - expected);
+            health->timestamp_intervals++;
+            health->timestamp_microseconds += interval;
+            health->timestamp_microseconds_expected += expected;
+            health->timestamp_error_sum_squares += error * error;
+            if (error > health->timestamp_error_max) health->timestamp_error_max = error;
+        }
+    }
+    stream->previous = header;
+    stream->have_previous = 1;
+
+    const unsigned char * samples = packet + ACOUSTIC_PACKET_HEADER_SIZE;
+    const size_t count = header.samples_per_channel * header.channels;
+    if (2 == header.sizeof_sample)
+        accumulate_int16(health->channels, samples, header.channels, count);
+    else
+        accumulate_other(health->channels, samples, header.channels, count, header.flags & 0x7, header.sizeof_sample, stream->fullscale);
+
+    health->packets++;
+    health->samples_per_channel += header.samples_per_channel;
+}
+
+static const char * dtype_name(const unsigned dtype) {
+    return 0 == dtype ? "int16" : 1 == dtype ? "int32" : 3 == dtype ? "float" : 4 == dtype ? "int8" : "int24";
+}
+
+static void print_health(const char * progname, const char * shm_name, const struct health * health, const struct stream * stream,
+                         const double seconds, const unsigned long lapped, const int redraw) {
+    /* move to the top left and clear the terminal, so the display stays in place */
+    if (redraw) printf("\x1B[H\x1B[J");
+
+    if (!stream->have_format)
+        printf("%s: %s: no acoustic packets yet, %.1f nonacoustic packets/s\n", progname, shm_name, health->packets_nonacoustic / seconds);
+    else {
+        const size_t channels = stream->format.channels;
+        printf("%s: %s: %zu channels of %s at %.8g sps nominal, %.1f packets/s, %.1f samples/s per channel\n", progname, shm_name,
+               channels, dtype_name(stream->format.flags & 0x7), stream->format.sample_rate, health->packets / seconds, health->samples_per_channel / seconds);
+
+        printf("%lu seqnum gaps (%lu packets missing), %.1f nonacoustic packets/s, %lu of other formats, %lu times lapped\n",
+               health->seqnum_gaps, health->packets_missing, health->packets_nonacoustic / seconds, health->packets_other_format, lapped);
+
+        /* device timestamps have 16 us resolution, so jitter below that is not meaningful */
+        if (health->timestamp_intervals)
+            printf("timestamp jitter rms %.1f us, max %.0f us, device clock %+.1f ppm vs nominal sample rate\n",
+                   sqrt(health->timestamp_error_sum_squares / health->timestamp_intervals), health->timestamp_error_max,
+                   (health->timestamp_microseconds / health->timestamp_microseconds_expected - 1.0) * 1e6);
+
+        if (health->samples_per_channel) {
+            printf("%3s %11s %11s %11s %9s %11s %8s\n", "ch", "min", "max", "rms", "rms dBFS", "dc", "clipped");
+            for (size_t ichannel = 0; ichannel < channels; ichannel++) {
+                const struct channel_statistics * channel = health->channels + ichannel;
+                const double rms = sqrt(channel->sum_squares / health->samples_per_channel);
+                printf("%3zu %11.6g %11.6g %11.6g %9.1f %11.6g %8lu\n", ichannel, channel->min, channel->max, rms,
+                       rms > 0 ? 20.0 * log10(rms / stream->fullscale) : -INFINITY, channel->sum / health->samples_per_channel, channel->clips);
+            }
+        }
+    }
+
+    if (!redraw) printf("\n");
+    fflush(stdout);
+}
+
+int main(int argc, char ** const argv) {
+    /* do some silly stuff to get a progname regardless of runtime environment */
+    const char * s, * progname = argc ? ((s = strrchr(argv[0], '/')) ? s + 1 : argv[0]) : __func__;
+
+    const char * shm_name = argc > 1 ? argv[1] : "/cobs_to_shm";
+
+    /* how often to print the statistics for the preceding interval */
+    const double interval = argc > 2 ? strtod(argv[2], NULL) : 1.0;
+    if (!(interval > 0)) NOPE("%s: interval must be a positive number of seconds\n", progname);
+
+    /* install a signal handler so that we can stop cleanly on sigint or sigterm */
+    if (-1 == sigaction(SIGINT, &(struct sigaction) { .sa_handler = sigint_handler }, NULL) ||
+        -1 == sigaction(SIGTERM, &(struct sigaction) { .sa_handler = sigint_handler }, NULL))
+        NOPE("%s: sigaction(): %s\n", progname, strerror(errno));
+
+    struct shared_memory_ringbuffer_reader * shm = NULL;
+    char printed_not_ready = 0;
+
+    /* loop until the writer exists */
+    while (!(shm = shared_memory_ringbuffer_reader_init(shm_name))) {
+        if (!printed_not_ready) {
+            fprintf(stderr, "%s: waiting for \"%s\"\n", progname, shm_name);
+            printed_not_ready = 1;
+        }
+        usleep(50000);
+        if (got_sigterm_or_sigint) return 0;
+    }
+    if (MAP_FAILED == shm) NOPE("%s: could not open \"%s\"\n", progname, shm_name);
+
+    const int redraw = isatty(STDOUT_FILENO);
+
+    static struct health health, batch;
+    struct stream stream = { 0 };
+    unsigned long lapped = 0;
+    unsigned long long time_printed = current_time_in_unix_microseconds();
+
+    while (!got_sigterm_or_sigint) {
+        const void * packets[BATCH_PACKETS];
+        size_t sizes[BATCH_PACKETS];
+        const ssize_t count = shared_memory_ringbuffer_recv_batch(packets, sizes, BATCH_PACKETS, shm);
+
+        if (count > 0) {
+            health_reset(&batch, stream.format.channels);
+            const struct stream stream_before = stream;
+
+            for (ssize_t ipacket = 0; ipacket < count; ipacket++)
+                if (sizes[ipacket] >= sizeof(uint64_t))
+                    accumulate_packet(&batch, &stream, (const unsigned char *)packets[ipacket] + sizeof(uint64_t), sizes[ipacket] - sizeof(uint64_t));
+
+            /* statistics of the channels start afresh whenever a format is taken up */
+            if (!stream_before.have_format && stream.have_format) channels_reset(&health, stream.format.channels);
+
+            if (shared_memory_ringbuffer_reader_has_kept_up(shm))
+                health_merge(&health, &batch, stream.format.channels);
+            else {
+                /* the writer may have overwritten packets while they were being read, so
+                 discard everything from them and carry on from the live head */
+                lapped++;
+                stream.have_previous = 0;
+                shared_memory_ringbuffer_reader_rewind(shm, 0);
+            }
+        }
+        else if (-1 == count) {
+            lapped++;
+            stream.have_previous = 0;
+            shared_memory_ringbuffer_reader_rewind(shm, 0);
+        }
+        else if (shared_memory_ringbuffer_eof(shm)) {
+            fprintf(stderr, "%s: writer has exited\n", progname);
+            break;
+        }
+        else usleep(10000);
+
+        const unsigned long long now = current_time_in_unix_microseconds();
+        if (now - time_printed >= interval * 1e6) {
+            print_health(progname, shm_name, &health, &stream, (now - time_printed) * 1e-6, lapped, redraw);
+
+            /* if the format changed and none of the old format remain, take up the new one */
+            if (!health.packets && health.packets_other_format) stream.have_format = 0;
+
+            health_reset(&health, stream.format.channels);
+            time_printed = now;
+        }
+    }
+
+    shared_memory_ringbuffer_reader_close(shm);
+}
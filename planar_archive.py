@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+# this file provides a zero-copy reader for the planar archives written by bin_to_planar, in
+# which the samples of each channel are contiguous, such that reading one channel of a chunk
+# touches only that channel's pages rather than every sample of every channel. it can be
+# imported, or run as a standalone process to dump one channel as raw pcm to stdout, e.g.
+# "planar_archive.py chunk.planar channel 3 > channel3.raw", or to describe an archive
+
+import struct
+import sys
+from collections import namedtuple
+import numpy as np
+
+# mirrors struct planar_header in bin_to_planar.c
+header_format = '<8sII8sffQQQQQQ'
+header_tuple = namedtuple('header_tuple', ('magic', 'version', 'channels', 'dtype', 'sample_rate', 'fullscale', 'packets', 'samples_per_channel',
+                                           'packets_offset', 'channels_offset', 'channel_stride', 'packets_skipped'))
+
+# mirrors struct planar_packet in bin_to_planar.c
+packet_dtype = np.dtype([('logged_microseconds', '<u8'), ('timestamp_microseconds', '<u8'), ('first_sample', '<u8'),
+                         ('samples', '<u4'), ('seqnum', '<u2'), ('flags', '<u2')])
+
+archive_tuple = namedtuple('archive_tuple', ('channels', 'packets', 'fs', 'fullscale', 'packets_skipped'))
+
+# returns the packet table, and a list with one array of samples per channel, all of which are
+# views of a read-only memory map of the file, so nothing is read until it is used
+def open_planar_archive(path):
+    with open(path, 'rb') as f:
+        header = header_tuple(*struct.unpack(header_format, f.read(struct.calcsize(header_format))))
+
+    if header.magic.rstrip(b'\0') != b'planar' or header.version != 1:
+        raise RuntimeError('%s is not a version 1 planar archive' % path)
+
+    mapped = np.memmap(path, mode='r')
+    dtype = np.dtype(header.dtype.rstrip(b'\0').decode())
+
+    packets = np.ndarray((header.packets,), dtype=packet_dtype, buffer=mapped, offset=header.packets_offset)
+    channels = [np.ndarray((header.samples_per_channel,), dtype=dtype, buffer=mapped, offset=header.channels_offset + ichannel * header.channel_stride)
+                for ichannel in range(header.channels)]
+
+    return archive_tuple(channels=channels, packets=packets, fs=header.sample_rate, fullscale=header.fullscale, packets_skipped=header.packets_skipped)
+
+# if running this as a standalone process rather than importing as a module...
+if __name__ == '__main__':
+    def main():
+        if len(sys.argv) < 2:
+            print('usage: %s archive.planar [channel N]' % sys.argv[0], file=sys.stderr)
+            sys.exit(1)
+
+        archive = open_planar_archive(sys.argv[1])
+
+        # loop over pairs of arguments
+        channel = None
+        for key, value in zip(sys.argv[2::2], sys.argv[3::2]):
+            if key == 'channel': channel = int(value)
+
+        if channel is not None:
+            sys.stdout.buffer.write(archive.channels[channel])
+            return
+
+        packets = archive.packets
+        print('%u channels of %u %s samples at %.8g sps, %u packets (%u skipped)' %
+              (len(archive.channels), len(archive.channels[0]) if archive.channels else 0, archive.channels[0].dtype if archive.channels else '',
+               archive.fs, len(packets), archive.packets_skipped))
+        if len(packets):
+            missing = int(np.count_nonzero(np.diff(packets['seqnum'].astype(np.int64)) % 65536 != 1))
+            print('logged from %u to %u us, %u seqnum discontinuities' % (packets['logged_microseconds'][0], packets['logged_microseconds'][-1], missing))
+
+    main()
@@ -0,0 +1,361 @@
+/* campbell, isc license */
+
+/* needed for asprintf, must occur prior to any include statements */
+#define _GNU_SOURCE
+
+#include "retention.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+/* useful macros */
+#define WARNING_ANSI "\x1B[35;1mwarning:\x1B[0m"
+#define alloc_sprintf(...) ({ char * _tmp; if (asprintf(&_tmp, __VA_ARGS__) <= 0) abort(); _tmp ; })
+
+/* at most this many removals are started per check, however much space is still needed */
+#define REMOVALS_PER_CHECK 16
+
+/* subdirectories, such as one per run, are searched to this depth */
+#define DEPTH_MAX 4
+
+/* if every file found has been removed, the tree is not walked again until this long after
+ the previous walk, so that a filesystem filled by something else is not walked continually */
+#define WALK_INTERVAL_MICROSECONDS 60000000ULL
+
+enum walk_state { WALK_IDLE = 0, WALK_RUNNING, WALK_DONE };
+
+struct retention_file {
+    /* NULL once removed or handed to the caller to be removed */
+    char * path;
+
+    /* space taken on the filesystem, as far as is known */
+    unsigned long long size;
+};
+
+struct retention_list {
+    struct retention_file * files;
+    size_t count, allocated;
+};
+
+struct retention {
+    char * directory;
+    unsigned long long free_bytes_min;
+    unsigned flags;
+
+    /* files found by the last walk or added since, oldest first */
+    struct retention_list list;
+
+    /* first of the next time to be removed, or with RETENTION_THIN, to be kept */
+    size_t next;
+
+    /* removals handed to the caller and not yet reported done, and the space they will free */
+    unsigned removals_in_flight;
+    unsigned long long bytes_in_flight;
+
+    /* removals reported done since the last check */
+    unsigned removed;
+
+    /* later walks are done by a thread, into a list of its own which replaces the above once
+     the walk is done */
+    pthread_t walker;
+    int walker_started;
+    _Atomic enum walk_state walk_state;
+    struct retention_list walked;
+
+    unsigned long long time_walked;
+    int short_of_space;
+};
+
+static unsigned long long monotonic_microseconds(void) {
+    struct timespec timespec;
+    clock_gettime(CLOCK_MONOTONIC, &timespec);
+    return timespec.tv_sec * 1000000ULL + timespec.tv_nsec / 1000UL;
+}
+
+/* matches names as given by chunk_logger, such as 20240102T030405Z.bin, .bin.gz or
+ .nonacoustic.bin, and their summaries such as 20240102T030405Z.summary.json, but not those
+ still being written */
+static int is_chunk(const char * name) {
+    for (size_t ichar = 0; ichar < 15; ichar++)
+        if (8 == ichar ? 'T' != name[ichar] : !isdigit((unsigned char)name[ichar])) return 0;
+    return 'Z' == name[15] && '.' == name[16] && (strstr(name + 16, ".bin") || strstr(name + 16, ".summary.json")) && !strstr(name + 16, ".partial");
+}
+
+/* files are ordered by name alone, which is their start time, regardless of directory, such
+ that the files of every stream with the same time are adjacent, and then by path, such that
+ any file listed twice is adjacent to itself */
+static int compare_names(const void * a, const void * b) {
+    const char * path_a = ((const struct retention_file *)a)->path, * path_b = ((const struct retention_file *)b)->path;
+    return strcmp(strrchr(path_a, '/') + 1, strrchr(path_b, '/') + 1) ?: strcmp(path_a, path_b);
+}
+
+static int same_time(const struct retention_file * a, const struct retention_file * b) {
+    return !strncmp(strrchr(a->path, '/') + 1, strrchr(b->path, '/') + 1, strlen("YYYYmmddTHHMMSSZ"));
+}
+
+/* index of the first file after the given one which has a different time */
+static size_t time_end(const struct retention * retention, const size_t ifile) {
+    size_t iend = ifile + 1;
+    while (iend < retention->list.count && same_time(retention->list.files + ifile, retention->list.files + iend)) iend++;
+    return iend;
+}
+
+static void append(struct retention_list * list, char * path, const unsigned long long size) {
+    if (list->count == list->allocated) {
+        list->allocated = list->allocated ? 2 * list->allocated : 1024;
+        if (!(list->files = realloc(list->files, list->allocated * sizeof(*list->files)))) abort();
+    }
+    list->files[list->count++] = (struct retention_file) { .path = path, .size = size };
+}
+
+static void list_free(struct retention_list * list) {
+    for (size_t ifile = 0; ifile < list->count; ifile++)
+        free(list->files[ifile].path);
+    free(list->files);
+    memset(list, 0, sizeof(*list));
+}
+
+/* inserts a file in order, which is almost always at the end, as files are added as they are
+ completed, but those of several streams with the same time may complete in any order */
+static void insert(struct retention * retention, char * path, const unsigned long long size) {
+    append(&retention->list, path, size);
+
+    const struct retention_file file = retention->list.files[retention->list.count - 1];
+    size_t ifile = retention->list.count - 1;
+    for (; ifile > retention->next && compare_names(retention->list.files + ifile - 1, &file) > 0; ifile--)
+        retention->list.files[ifile] = retention->list.files[ifile - 1];
+    retention->list.files[ifile] = file;
+}
+
+static void walk(struct retention_list * list, const char * directory, const unsigned depth) {
+    DIR * dir = opendir(directory);
+    if (!dir) return;
+
+    for (struct dirent * entry; (entry = readdir(dir)); ) {
+        if ('.' == entry->d_name[0]) continue;
+        char * path = alloc_sprintf("%s/%s", directory, entry->d_name);
+
+        /* symlinks, such as to the current run, are not followed, so nothing is seen twice */
+        struct stat st;
+        if ((DT_DIR == entry->d_type || DT_UNKNOWN == entry->d_type) && 0 == lstat(path, &st) && S_ISDIR(st.st_mode)) {
+            if (depth < DEPTH_MAX) walk(list, path, depth + 1);
+        }
+        else if ((DT_REG == entry->d_type || DT_UNKNOWN == entry->d_type) && is_chunk(entry->d_name) && 0 == lstat(path, &st) && S_ISREG(st.st_mode)) {
+            append(list, path, st.st_blocks * 512ULL);
+            continue;
+        }
+        free(path);
+    }
+
+    closedir(dir);
+}
+
+/* walks the whole tree, which may take a while, so is done by a thread of its own */
+static void * walker(void * arg) {
+    struct retention * retention = arg;
+    walk(&retention->walked, retention->directory, 0);
+    qsort(retention->walked.files, retention->walked.count, sizeof(*retention->walked.files), compare_names);
+    atomic_store_explicit(&retention->walk_state, WALK_DONE, memory_order_release);
+    return NULL;
+}
+
+/* replaces the list with that of a walk, keeping any files added since it started, some of
+ which the walk may have found as well */
+static void adopt(struct retention * retention) {
+    if (retention->walker_started) pthread_join(retention->walker, NULL);
+    retention->walker_started = 0;
+
+    for (size_t ifile = 0; ifile < retention->list.count; ifile++)
+        if (retention->list.files[ifile].path) {
+            append(&retention->walked, retention->list.files[ifile].path, retention->list.files[ifile].size);
+            retention->list.files[ifile].path = NULL;
+        }
+    list_free(&retention->list);
+
+    struct retention_list * list = &retention->walked;
+    qsort(list->files, list->count, sizeof(*list->files), compare_names);
+
+    size_t count = 0;
+    for (size_t ifile = 0; ifile < list->count; ifile++)
+        if (count && !strcmp(list->files[count - 1].path, list->files[ifile].path)) free(list->files[ifile].path);
+        else list->files[count++] = list->files[ifile];
+    list->count = count;
+
+    retention->list = *list;
+    memset(list, 0, sizeof(*list));
+    retention->next = 0;
+    atomic_store_explicit(&retention->walk_state, WALK_IDLE, memory_order_relaxed);
+}
+
+static void rewalk(struct retention * retention) {
+    retention->time_walked = monotonic_microseconds();
+    atomic_store_explicit(&retention->walk_state, WALK_RUNNING, memory_order_relaxed);
+    if (!(retention->walker_started = !pthread_create(&retention->walker, NULL, walker, retention))) {
+        fprintf(stderr, WARNING_ANSI " %s: could not start a thread, walking %s in this one\n", __func__, retention->directory);
+        walker(retention);
+    }
+}
+
+/* finds the files to be removed next, being those of every stream with the same time, such
+ that no stream is thinned or lost before another, returning how many there are and setting
+ *victims to the first of them, or returning zero if there are none */
+static size_t victims(struct retention * retention, struct retention_file ** victims) {
+    if (!(retention->flags & RETENTION_THIN)) {
+        if (retention->next >= retention->list.count) return 0;
+        const size_t ibegin = retention->next;
+        retention->next = time_end(retention, ibegin);
+        *victims = retention->list.files + ibegin;
+        return retention->next - ibegin;
+    }
+
+    /* keep one time and remove the next, never removing the newest, and once at the end, close
+     up the gaps and start another pass from the oldest */
+    for (unsigned restarted = 0; ; restarted++) {
+        const size_t count = retention->list.count;
+        const size_t ibegin = retention->next < count ? time_end(retention, retention->next) : count;
+        const size_t iend = ibegin < count ? time_end(retention, ibegin) : count;
+        if (iend < count) {
+            retention->next = iend;
+            *victims = retention->list.files + ibegin;
+            return iend - ibegin;
+        }
+
+        if (restarted) return 0;
+
+        size_t kept = 0;
+        for (size_t ifile = 0; ifile < count; ifile++)
+            if (retention->list.files[ifile].path) retention->list.files[kept++] = retention->list.files[ifile];
+        retention->list.count = kept;
+        retention->next = 0;
+    }
+}
+
+struct retention * retention_open(const char * directory, const unsigned long long free_bytes_min, const unsigned flags) {
+    DIR * dir = opendir(directory);
+    if (!dir) return NULL;
+    closedir(dir);
+
+    struct retention * retention = calloc(1, sizeof(*retention));
+    if (!retention) return NULL;
+
+    retention->directory = strdup(directory);
+    retention->free_bytes_min = free_bytes_min;
+    retention->flags = flags;
+
+    /* the first walk is done before logging starts, so need not be done by a thread */
+    walk(&retention->list, retention->directory, 0);
+    qsort(retention->list.files, retention->list.count, sizeof(*retention->list.files), compare_names);
+    retention->time_walked = monotonic_microseconds();
+    return retention;
+}
+
+void retention_add(struct retention * retention, const char * path, const unsigned long long size) {
+    const size_t length = strlen(retention->directory);
+    if (strncmp(path, retention->directory, length) || '/' != path[length]) return;
+
+    char * copy = strdup(path);
+    if (!copy) abort();
+    insert(retention, copy, size);
+}
+
+unsigned retention_check(struct retention * retention, void (* unlink_file)(void *, struct retention *, char *), void * context, int * short_of_space) {
+    unsigned long long free_bytes = 0;
+
+    for (unsigned started = 0; ; ) {
+        struct statvfs st;
+        if (-1 == statvfs(retention->directory, &st)) {
+            fprintf(stderr, WARNING_ANSI " %s: statvfs(%s): %s\n", __func__, retention->directory, strerror(errno));
+            break;
+        }
+
+        free_bytes = (unsigned long long)st.f_bavail * st.f_frsize;
+        if (free_bytes >= retention->free_bytes_min) {
+            if (retention->short_of_space)
+                fprintf(stderr, "%s: %s has %llu MiB free again\n", __func__, retention->directory, free_bytes >> 20);
+            retention->short_of_space = 0;
+            break;
+        }
+
+        /* removals already under way are expected to free enough */
+        if (free_bytes + retention->bytes_in_flight >= retention->free_bytes_min || started >= REMOVALS_PER_CHECK) break;
+
+        /* the list is replaced only once the walk is done and nothing is being removed */
+        if (WALK_IDLE != atomic_load_explicit(&retention->walk_state, memory_order_acquire)) {
+            if (WALK_DONE != atomic_load_explicit(&retention->walk_state, memory_order_relaxed) || retention->removals_in_flight) break;
+            adopt(retention);
+        }
+
+        struct retention_file * files;
+        const size_t count = victims(retention, &files);
+        if (!count) {
+            if (retention->removals_in_flight) break;
+
+            if (monotonic_microseconds() - retention->time_walked >= WALK_INTERVAL_MICROSECONDS) {
+                rewalk(retention);
+                continue;
+            }
+
+            if (!retention->short_of_space)
+                fprintf(stderr, WARNING_ANSI " %s: %s has only %llu MiB free and no more files to remove\n",
+                        __func__, retention->directory, free_bytes >> 20);
+            retention->short_of_space = 1;
+            break;
+        }
+
+        for (size_t ifile = 0; ifile < count; ifile++) {
+            char * path = files[ifile].path;
+            files[ifile].path = NULL;
+            retention->removals_in_flight++;
+            retention->bytes_in_flight += files[ifile].size;
+            files[ifile].size = 0;
+            started++;
+
+            /* may report the removal done before returning */
+            unlink_file(context, retention, path);
+        }
+    }
+
+    const unsigned removed = retention->removed;
+    retention->removed = 0;
+    if (removed)
+        fprintf(stderr, "%s: removed %u files from %s, %llu MiB free\n", __func__, removed, retention->directory, free_bytes >> 20);
+
+    if (short_of_space) *short_of_space = retention->short_of_space;
+    return removed;
+}
+
+void retention_removed(struct retention * retention, char * path, const int res) {
+    /* something downstream may already have moved or removed it */
+    if (!res) retention->removed++;
+    else if (-ENOENT != res) fprintf(stderr, WARNING_ANSI " %s: unlink(%s): %s\n", __func__, path, strerror(-res));
+    free(path);
+
+    /* the estimate is no longer needed once the space shows up as free */
+    if (!--retention->removals_in_flight) retention->bytes_in_flight = 0;
+}
+
+unsigned retention_removals_in_flight(const struct retention * retention) {
+    return retention->removals_in_flight;
+}
+
+void retention_close(struct retention * retention) {
+    if (!retention) return;
+
+    if (retention->walker_started) pthread_join(retention->walker, NULL);
+
+    list_free(&retention->walked);
+    list_free(&retention->list);
+    free(retention->directory);
+    free(retention);
+}
@@ -0,0 +1,41 @@
+/* campbell, isc license */
+
+/* keeps a minimum amount of space free on the filesystem holding a directory tree of logged
+ chunk files, by removing the oldest completed ones, or with RETENTION_THIN, every other one
+ from oldest to newest, such that the whole history is kept at ever lower density rather than
+ the oldest being lost outright. the files of every stream named for the same second, and
+ their summaries, are removed together, so that each stream is thinned alike. the tree is
+ walked when opened, and again only once every file found by the previous walk or added since
+ has been removed, by a thread of its own, so the cost of each check is a statvfs(). files are
+ not removed here but handed to the caller, which may do so asynchronously, and only as many
+ as are expected to free enough space. files are recognised by their timestamped names, with
+ or without further suffixes such as .gz, and those still being written are never removed */
+
+struct retention;
+
+#define RETENTION_THIN 1U
+
+/* returns NULL if the directory cannot be read */
+struct retention * retention_open(const char * directory, const unsigned long long free_bytes_min, const unsigned flags);
+
+/* notes a newly completed file of the given size, if it is within the tree, in order of its
+ name */
+void retention_add(struct retention * retention, const char * path, const unsigned long long size);
+
+/* unless the minimum is free or removals already under way are expected to free enough, hands
+ the next files to be removed to unlink_file(), up to a limit per call, each of which must be
+ reported to retention_removed() once done, which may be before unlink_file() returns. returns
+ the number of removals reported since the last call, and sets *short_of_space if below the
+ minimum with no more files to remove. intended to be called about once per second */
+unsigned retention_check(struct retention * retention, void (* unlink_file)(void * context, struct retention * retention, char * path),
+                         void * context, int * short_of_space);
+
+/* reports the result of removing a file handed to unlink_file(), as 0 or a negated errno, and
+ frees the path */
+void retention_removed(struct retention * retention, char * path, const int res);
+
+/* number of files handed to unlink_file() and not yet reported done */
+unsigned retention_removals_in_flight(const struct retention * retention);
+
+/* waits for any walk in progress. every removal must have been reported first */
+void retention_close(struct retention * retention);
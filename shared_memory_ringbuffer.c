@@ -11,22 +11,43 @@
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <signal.h>
 
 #include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
 
 struct shared_memory_ringbuffer_slot {
     /* the non-padded size of the data segment. */
     size_t size;
 
+    /* time given by the writer when sending the slot, in microseconds, or zero if none was
+     given. this occupies what would otherwise be padding before the data segment */
+    uint64_t time;
+
     unsigned char _Alignas(16) data[];
 };
 
 static_assert(!(offsetof(struct shared_memory_ringbuffer_slot, data) % 16), "alignment");
+static_assert(16 == offsetof(struct shared_memory_ringbuffer_slot, data), "slot prefix must fit in 16 bytes");
+
+/* number of entries in the time index. the writer adds an entry every cursor_wrap / this
+ many bytes, so that the index always spans the whole ring buffer regardless of data rate */
+#define TIME_INDEX_ENTRIES 256
+
+struct shared_memory_ringbuffer_time_index_entry {
+    /* time of the first slot sent at or after this entry was made */
+    uint64_t time;
+
+    /* cursor of that slot */
+    unsigned long cursor;
+};
 
 struct shared_memory_ringbuffer {
     /* this is the actual logical capacity of the ring buffer, i.e. the size of the data
-     segment minus the maximum slot size. this number MUST be a power of two. when the
+     segment minus the maximum slot size, or the size of the data segment itself if it is
+     double mapped. this number MUST be a power of two. when the
      writer sends a new slot, it increments writer_cursor by the size of the just-written
      slot. the effective positions of the writer and reader cursors within the data segment
      are their values modulo this number */
@@ -52,94 +73,637 @@ struct shared_memory_ringbuffer {
      compile-time assert that pid_t is lock-free */
     _Atomic long writer_pid;
 
-    /* the actual ring buffer, which consists of shared_memory_ringbuffer_slots */
+    /* atomically stored by the writer, and atomically loaded by readers wishing to start
+     from somewhere other than the live head. this is the cursor of the oldest slot which
+     will not be overwritten by the next acquire(), i.e. the oldest slot boundary that is
+     safely readable, from which readers can walk forward one slot at a time */
+    _Atomic unsigned long oldest_cursor;
+
+    /* total number of entries ever written to the time index, atomically stored by the
+     writer after populating entry (time_index_count % TIME_INDEX_ENTRIES). readers consider
+     only the most recent TIME_INDEX_ENTRIES - 1 entries, and after reading them, reload this
+     value to verify that none of the entries they used can have been overwritten meanwhile */
+    _Atomic unsigned long time_index_count;
+
+    /* size of the whole mapping, which may have been rounded up to a multiple of the huge
+     page size if the segment is backed by hugetlbfs */
+    size_t mapped_size;
+
+    /* offset of the data segment from the beginning of this struct. this is normally
+     offsetof(data), but is rounded up to a page boundary if the ring buffer is double
+     mapped, as the second mapping of the data segment must begin at a page-aligned offset
+     within the underlying file */
+    size_t data_offset;
+
+    /* flags given by the writer, which readers must also respect when mapping */
+    unsigned flags;
+
+    /* address of the reader registry within the writer's own address space, or NULL if it
+     could not be created. this is meaningless to readers, which map the registry themselves */
+    struct shared_memory_ringbuffer_registry * registry;
+
+    /* writer-private state used when critical readers are respected, otherwise NULL */
+    struct shared_memory_ringbuffer_backpressure * backpressure;
+
+    /* ring of time index entries, each mapping a timestamp to a cursor */
+    struct shared_memory_ringbuffer_time_index_entry time_index[TIME_INDEX_ENTRIES];
+
+    /* the actual ring buffer, which consists of shared_memory_ringbuffer_slots, unless it
+     has been moved to a page boundary as indicated by data_offset */
+    unsigned char _Alignas(16) data[];
+};
+
+/* maximum number of readers which can be registered at once. any further readers work as
+ normal, but are invisible to the writer and monitoring tools */
+#define REGISTRY_ENTRIES 32
+
+struct shared_memory_ringbuffer_registry_entry {
+    /* pid of the reader occupying this entry, zero if unoccupied, or the negated pid while
+     the reader is still populating the other fields */
+    _Atomic long pid;
+
+    /* cursor of the oldest slot the reader may still be looking at */
+    _Atomic unsigned long cursor;
+
+    /* CLOCK_MONOTONIC time in milliseconds of the reader's most recent call to recv() */
+    _Atomic unsigned long heartbeat;
+
+    /* number of times this reader has detected that it was lapped */
+    _Atomic unsigned long lapped;
+
+    /* REGISTRY_CRITICAL if the writer should avoid overwriting data not yet consumed */
+    _Atomic unsigned flags;
+};
+
+#define REGISTRY_CRITICAL 1U
+
+/* the reader registry lives in a separate shm segment with the same name plus ".readers",
+ which unlike the ring buffer itself is writable by readers. this preserves the property
+ that a misbehaving reader cannot corrupt the data seen by the writer or other readers */
+struct shared_memory_ringbuffer_registry {
+    /* size of the mapping, which may have been rounded up as for the ring buffer itself */
+    size_t mapped_size;
+
+    /* total number of times any reader has detected that it was lapped */
+    _Atomic unsigned long readers_lapped;
+
+    /* populated by the writer if it respects critical readers: the number of packets it has
+     dropped because its overflow queue was full, and the current size of that queue */
+    _Atomic unsigned long critical_drops;
+    _Atomic size_t overflow_bytes;
+
+    /* each entry is written by a different process, so give each its own cache line */
+    struct {
+        struct shared_memory_ringbuffer_registry_entry entry;
+    } _Alignas(64) entries[REGISTRY_ENTRIES];
+};
+
+/* when critical readers are respected, packets which cannot be put in the ring buffer without
+ overwriting data that a critical reader has not yet consumed are queued here instead, in the
+ same slot format, and moved into the ring buffer in order as soon as there is room */
+struct shared_memory_ringbuffer_backpressure {
+    /* size of the queue, past the end of which there is room for one maximum-size slot,
+     followed by a scratch slot for packets which are to be dropped */
+    size_t capacity;
+
+    /* unwrapped byte cursors of the next slot to be queued and the oldest queued slot */
+    size_t head;
+    size_t tail;
+
+    /* writer cursor up to which the most recent scan of the registry showed that no critical
+     reader could be overwritten, such that the registry need not be scanned on every send */
+    size_t clear_until;
+
+    /* where the most recent call to acquire() pointed the caller */
+    enum { ACQUIRED_RING, ACQUIRED_QUEUE, ACQUIRED_SCRATCH } acquired;
+
     unsigned char _Alignas(16) data[];
 };
 
+static struct shared_memory_ringbuffer_slot * slot_at(const struct shared_memory_ringbuffer * shm, const size_t cursor) {
+    return (void *)((unsigned char *)shm + shm->data_offset + cursor % shm->cursor_wrap);
+}
+
 static_assert(!(offsetof(struct shared_memory_ringbuffer, data) % 16), "alignment");
 
 /* guarantee that writer_cursor and writer_pid are lock-free */
 static_assert(2 == ATOMIC_LONG_LOCK_FREE, "long is not lock free");
 static_assert(sizeof(long) >= sizeof(pid_t), "cannot store pid_t in long");
 
-struct shared_memory_ringbuffer * shared_memory_ringbuffer_writer_init(const char * name, const size_t ringbuffer_size, const size_t packet_size_max) {
+/* names containing a slash after the leading one are treated as paths to files in some
+ other filesystem, such as a hugetlbfs mount, rather than as posix shm names */
+static int name_is_path(const char * name) {
+    return name[0] && strchr(name + 1, '/');
+}
+
+static int ringbuffer_open(const char * name, const int flags, const mode_t mode) {
+    return name_is_path(name) ? open(name, flags, mode) : shm_open(name, flags, mode);
+}
+
+static void ringbuffer_unlink(const char * name) {
+    if (name_is_path(name)) unlink(name);
+    else shm_unlink(name);
+}
+
+/* extra mmap flags for both writer and readers, so that page faults are taken up front */
+#ifdef MAP_POPULATE
+#define MAP_FLAGS_EXTRA MAP_POPULATE
+#else
+#define MAP_FLAGS_EXTRA 0
+#endif
+
+/* granularity of mappings of the given fd, which is the page size, or the block size of the
+ filesystem if larger, as is the case for hugetlbfs */
+static size_t mapping_granule(const char * name, const int fd) {
+    size_t granule = sysconf(_SC_PAGESIZE);
+    struct statvfs sv;
+    if (name_is_path(name) && !fstatvfs(fd, &sv) && sv.f_bsize > granule) granule = sv.f_bsize;
+    return granule;
+}
+
+static size_t round_up(const size_t size, const size_t granule) {
+    return (size + granule - 1) / granule * granule;
+}
+
+/* maps the segment, and if double mapped, maps the data segment a second time immediately
+ after the first, such that slots which run past the end of the data segment continue
+ seamlessly at its beginning. the size of the resulting address range is returned via the
+ last argument, for later use with munmap() */
+static void * ringbuffer_map(const int fd, const size_t file_size, const size_t data_offset, const size_t cursor_wrap,
+                             const int double_mapped, const size_t granule, const int prot, size_t * mapped_size_p) {
+    if (!double_mapped) {
+        *mapped_size_p = file_size;
+        return mmap(NULL, file_size, prot, MAP_SHARED | MAP_FLAGS_EXTRA, fd, 0);
+    }
+
+    const size_t mapped_size = data_offset + 2 * cursor_wrap;
+
+    /* reserve a contiguous range of address space, aligned to the granule, and then map the
+     file over it twice. the slack on either side of the aligned range is given back */
+    unsigned char * const reservation = mmap(NULL, mapped_size + granule, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == reservation) return MAP_FAILED;
+
+    unsigned char * const base = (void *)round_up((size_t)reservation, granule);
+    if (base != reservation) munmap(reservation, base - reservation);
+    munmap(base + mapped_size, reservation + granule - base);
+
+    if (MAP_FAILED == mmap(base, data_offset + cursor_wrap, prot, MAP_SHARED | MAP_FIXED | MAP_FLAGS_EXTRA, fd, 0) ||
+        MAP_FAILED == mmap(base + data_offset + cursor_wrap, cursor_wrap, prot, MAP_SHARED | MAP_FIXED | MAP_FLAGS_EXTRA, fd, data_offset)) {
+        munmap(base, mapped_size);
+        return MAP_FAILED;
+    }
+
+    *mapped_size_p = mapped_size;
+    return base;
+}
+
+static char * sibling_name(const char * name, const char * suffix) {
+    const size_t length = strlen(name), suffix_length = strlen(suffix);
+    char * ret = malloc(length + suffix_length + 1);
+    assert(ret);
+    memcpy(ret, name, length);
+    memcpy(ret + length, suffix, suffix_length + 1);
+    return ret;
+}
+
+void * shared_memory_ringbuffer_sibling_create(const char * name, const char * suffix, const size_t size_min, const int writable_by_readers, size_t * mapped_size_p) {
+    char * path = sibling_name(name, suffix);
+    ringbuffer_unlink(path);
+
+    /* never writable by everyone, as any local user could then pose as a reader, critical or not */
+    const mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH | (writable_by_readers ? S_IWGRP : 0);
+    const int fd = ringbuffer_open(path, O_RDWR | O_CREAT, mode);
+    if (-1 == fd) {
+        fprintf(stderr, "warning: %s: open(%s): %s\n", __func__, path, strerror(errno));
+        free(path);
+        return NULL;
+    }
+
+    const size_t size = round_up(size_min, mapping_granule(path, fd));
+    free(path);
+
+    /* readers may be running as other users, so undo whatever the umask did */
+    void * ret = MAP_FAILED;
+    if (-1 == fchmod(fd, mode) ||
+        -1 == ftruncate(fd, size) ||
+        MAP_FAILED == (ret = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)))
+        fprintf(stderr, "warning: %s: %s\n", __func__, strerror(errno));
+    close(fd);
+
+    if (MAP_FAILED == ret) return NULL;
+    *mapped_size_p = size;
+    return ret;
+}
+
+void * shared_memory_ringbuffer_sibling_open(const char * name, const char * suffix, const size_t size_min, const int writable, size_t * mapped_size_p) {
+    char * path = sibling_name(name, suffix);
+    const int fd = ringbuffer_open(path, writable ? O_RDWR : O_RDONLY, 0);
+    free(path);
+    if (-1 == fd) return NULL;
+
+    struct stat s;
+    void * ret = MAP_FAILED;
+    if (!fstat(fd, &s) && (size_t)s.st_size >= size_min)
+        ret = mmap(NULL, s.st_size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (MAP_FAILED == ret) return NULL;
+    *mapped_size_p = s.st_size;
+    return ret;
+}
+
+/* creates the reader registry, or returns NULL if it could not be created, in which case
+ the ring buffer works as normal without it */
+static struct shared_memory_ringbuffer_registry * registry_create(const char * name) {
+    size_t size;
+    struct shared_memory_ringbuffer_registry * registry = shared_memory_ringbuffer_sibling_create(name, ".readers", sizeof(*registry), 1, &size);
+    if (registry) registry->mapped_size = size;
+    return registry;
+}
+
+static struct shared_memory_ringbuffer_registry * registry_open(const char * name) {
+    /* the mapped_size field is populated before any reader can get here */
+    size_t size;
+    return shared_memory_ringbuffer_sibling_open(name, ".readers", sizeof(struct shared_memory_ringbuffer_registry), 1, &size);
+}
+
+static unsigned long monotonic_milliseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL;
+}
+
+struct shared_memory_ringbuffer * shared_memory_ringbuffer_writer_init(const char * name, const size_t ringbuffer_size, const size_t packet_size_max, const unsigned flags) {
     /* ringbuffer_size must be nonzero and a power of two */
     assert(ringbuffer_size && !(ringbuffer_size & (ringbuffer_size - 1)));
 
     const size_t max_slot_size = packet_size_max + sizeof(struct shared_memory_ringbuffer_slot);
 
-    /* size of the actual mmap'd region */
-    const size_t total_size = offsetof(struct shared_memory_ringbuffer, data) + ringbuffer_size + max_slot_size;
-
     /* everything must be a multiple of 16 */
     assert(!(packet_size_max % 16));
-    assert(!(total_size % 16));
 
-    shm_unlink(name);
-    const int fd = shm_open(name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    ringbuffer_unlink(name);
+    const int fd = ringbuffer_open(name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
     if (-1 == fd) {
-        fprintf(stderr, "error: %s: shm_open(%s): %s\n", __func__, name, strerror(errno));
+        fprintf(stderr, "error: %s: open(%s): %s\n", __func__, name, strerror(errno));
+        return MAP_FAILED;
+    }
+
+    /* if backed by a file in a filesystem such as hugetlbfs, sizes and offsets must be a
+     multiple of its block size, which for hugetlbfs is the huge page size */
+    const size_t granule = mapping_granule(name, fd);
+    const int double_mapped = !!(flags & SHARED_MEMORY_RINGBUFFER_DOUBLE_MAPPED);
+
+    if (double_mapped && ringbuffer_size % granule) {
+        fprintf(stderr, "error: %s: double mapped ring buffer size must be a multiple of %zu\n", __func__, granule);
+        close(fd);
         return MAP_FAILED;
     }
 
-    if (-1 == ftruncate(fd, total_size)) {
+    /* if double mapped, the data segment needs no extra space for slots which would
+     otherwise run past its end, but must begin at an aligned offset */
+    const size_t data_offset = double_mapped ? round_up(offsetof(struct shared_memory_ringbuffer, data), granule) : offsetof(struct shared_memory_ringbuffer, data);
+    const size_t file_size = round_up(data_offset + ringbuffer_size + (double_mapped ? 0 : max_slot_size), granule);
+
+    if (-1 == ftruncate(fd, file_size)) {
         fprintf(stderr, "error: %s: ftruncate(): %s\n", __func__, strerror(errno));
         close(fd);
         return MAP_FAILED;
     }
 
-    struct shared_memory_ringbuffer * shm = mmap(NULL, total_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    size_t mapped_size;
+    struct shared_memory_ringbuffer * shm = ringbuffer_map(fd, file_size, data_offset, ringbuffer_size, double_mapped, granule, PROT_READ | PROT_WRITE, &mapped_size);
     close(fd);
     if (MAP_FAILED == shm) {
         fprintf(stderr, "error: %s: mmap(): %s\n", __func__, strerror(errno));
         return MAP_FAILED;
     }
 
+#ifdef MADV_HUGEPAGE
+    /* for large rings in tmpfs, ask for transparent huge pages to reduce tlb pressure. this
+     is only honoured if /sys/kernel/mm/transparent_hugepage/shmem_enabled allows it */
+    madvise(shm, mapped_size, MADV_HUGEPAGE);
+#endif
+
     *shm = (struct shared_memory_ringbuffer) {
         .cursor_wrap = ringbuffer_size,
         .max_slot_size = max_slot_size,
+        .mapped_size = mapped_size,
+        .data_offset = data_offset,
+        .flags = flags,
+        .registry = registry_create(name),
     };
 
+    /* critical readers are found via the registry, so this can only work if it exists */
+    if (flags & SHARED_MEMORY_RINGBUFFER_CRITICAL_READERS) {
+        if (!shm->registry)
+            fprintf(stderr, "warning: %s: no reader registry, critical readers will not be respected\n", __func__);
+        else if (ringbuffer_size < 4 * max_slot_size)
+            fprintf(stderr, "warning: %s: ring buffer too small to respect critical readers\n", __func__);
+        else {
+            struct shared_memory_ringbuffer_backpressure * backpressure = malloc(sizeof(*backpressure) + ringbuffer_size + 2 * max_slot_size);
+            assert(backpressure);
+            *backpressure = (struct shared_memory_ringbuffer_backpressure) { .capacity = ringbuffer_size };
+            shm->backpressure = backpressure;
+        }
+    }
+
     /* atomic store, must be last thing in this function */
     shm->writer_pid = getpid();
 
     return shm;
 }
 
+static size_t slot_size_padded(const struct shared_memory_ringbuffer_slot * slot) {
+    return (sizeof(struct shared_memory_ringbuffer_slot) + slot->size + 15) & ~15;
+}
+
+/* returns nonzero if sending a maximum-size slot at the writer cursor could cause a live
+ critical reader to consider itself lapped */
+static int critical_reader_blocks(struct shared_memory_ringbuffer * shm) {
+    struct shared_memory_ringbuffer_backpressure * backpressure = shm->backpressure;
+    const size_t writer_cursor = shm->writer_cursor;
+
+    /* well-formed even across wraparound of the cursors themselves */
+    if ((ssize_t)(backpressure->clear_until - writer_cursor) >= 0) return 0;
+
+    /* readers consider themselves lapped once they are more than cursor_wrap - max_slot_size
+     behind the writer cursor, which must still hold after the slot about to be sent */
+    const size_t span = shm->cursor_wrap - 2 * shm->max_slot_size;
+
+    /* rescan at least every half ring, so that readers which become critical in between
+     are noticed well before the writer could overwrite anything they have not consumed */
+    size_t clear_until = writer_cursor + span / 2;
+
+    for (size_t ientry = 0; ientry < REGISTRY_ENTRIES; ientry++) {
+        const struct shared_memory_ringbuffer_registry_entry * entry = &shm->registry->entries[ientry].entry;
+        const long pid = entry->pid;
+        if (pid <= 0 || !(entry->flags & REGISTRY_CRITICAL)) continue;
+
+        const size_t cursor = entry->cursor;
+        if (writer_cursor - cursor > span) {
+            /* a critical reader which died without unregistering must not block forever */
+            if (-1 == kill(pid, 0) && ESRCH == errno) continue;
+            return 1;
+        }
+
+        if ((ssize_t)(cursor + span - clear_until) < 0) clear_until = cursor + span;
+    }
+
+    backpressure->clear_until = clear_until;
+    return 0;
+}
+
+static void ring_send(struct shared_memory_ringbuffer * shm, const size_t size, const unsigned long long time);
+
+/* move as many queued slots into the ring buffer as critical readers allow */
+static void backpressure_drain(struct shared_memory_ringbuffer * shm) {
+    struct shared_memory_ringbuffer_backpressure * backpressure = shm->backpressure;
+
+    while (backpressure->tail != backpressure->head && !critical_reader_blocks(shm)) {
+        const struct shared_memory_ringbuffer_slot * queued = (void *)(backpressure->data + backpressure->tail % backpressure->capacity);
+        const size_t size_padded = slot_size_padded(queued);
+
+        memcpy(slot_at(shm, shm->writer_cursor)->data, queued->data, size_padded - sizeof(struct shared_memory_ringbuffer_slot));
+        ring_send(shm, queued->size, queued->time);
+        backpressure->tail += size_padded;
+    }
+
+    shm->registry->overflow_bytes = backpressure->head - backpressure->tail;
+}
+
 void shared_memory_ringbuffer_writer_close(struct shared_memory_ringbuffer * shm) {
+    if (shm->backpressure) {
+        /* give critical readers up to a second to make room for anything still queued */
+        for (size_t attempt = 0; attempt < 100 && shm->backpressure->tail != shm->backpressure->head; attempt++) {
+            backpressure_drain(shm);
+            if (shm->backpressure->tail != shm->backpressure->head) usleep(10000);
+        }
+        free(shm->backpressure);
+    }
+
     /* indicate to readers that the writer is going away */
     shm->writer_pid = 0;
 
-    const size_t total_size = offsetof(struct shared_memory_ringbuffer, data) + shm->cursor_wrap + shm->max_slot_size;
-    munmap(shm, total_size);
+    if (shm->registry) munmap(shm->registry, shm->registry->mapped_size);
+    munmap(shm, shm->mapped_size);
 }
 
 void * shared_memory_ringbuffer_acquire(struct shared_memory_ringbuffer * shm) {
-    struct shared_memory_ringbuffer_slot * const slot = (void *)(shm->data + (shm->writer_cursor % shm->cursor_wrap));
+    struct shared_memory_ringbuffer_backpressure * backpressure = shm->backpressure;
+    if (backpressure) {
+        /* anything already queued must be sent first, to preserve ordering */
+        if (backpressure->tail != backpressure->head) backpressure_drain(shm);
+
+        if (backpressure->tail != backpressure->head || critical_reader_blocks(shm)) {
+            /* queue the packet if there is room for a maximum-size slot, otherwise let the
+             caller populate a scratch slot, and count it as dropped when it is sent */
+            if (backpressure->head + shm->max_slot_size - backpressure->tail <= backpressure->capacity) {
+                backpressure->acquired = ACQUIRED_QUEUE;
+                return ((struct shared_memory_ringbuffer_slot *)(backpressure->data + backpressure->head % backpressure->capacity))->data;
+            }
+
+            backpressure->acquired = ACQUIRED_SCRATCH;
+            return ((struct shared_memory_ringbuffer_slot *)(backpressure->data + backpressure->capacity + shm->max_slot_size))->data;
+        }
+
+        backpressure->acquired = ACQUIRED_RING;
+    }
+
+    struct shared_memory_ringbuffer_slot * const slot = slot_at(shm, shm->writer_cursor);
     return slot->data;
 }
 
 void shared_memory_ringbuffer_send(struct shared_memory_ringbuffer * shm, const size_t size) {
+    shared_memory_ringbuffer_send_with_time(shm, size, 0);
+}
+
+void shared_memory_ringbuffer_send_with_time(struct shared_memory_ringbuffer * shm, const size_t size, const unsigned long long time) {
+    struct shared_memory_ringbuffer_backpressure * backpressure = shm->backpressure;
+
+    if (backpressure && ACQUIRED_QUEUE == backpressure->acquired) {
+        struct shared_memory_ringbuffer_slot * slot = (void *)(backpressure->data + backpressure->head % backpressure->capacity);
+        slot->size = size;
+        slot->time = time;
+        backpressure->head += slot_size_padded(slot);
+        shm->registry->overflow_bytes = backpressure->head - backpressure->tail;
+        return;
+    }
+
+    if (backpressure && ACQUIRED_SCRATCH == backpressure->acquired) {
+        shm->registry->critical_drops++;
+        return;
+    }
+
+    ring_send(shm, size, time);
+}
+
+/* populates the prefix of the slot at the writer cursor, whose data has already been written,
+ and makes it visible to readers */
+static void ring_send(struct shared_memory_ringbuffer * shm, const size_t size, const unsigned long long time) {
     size_t writer_cursor = shm->writer_cursor;
 
     /* populate the prefix fields */
-    struct shared_memory_ringbuffer_slot * slot = (void *)(shm->data + (writer_cursor % shm->cursor_wrap));
+    struct shared_memory_ringbuffer_slot * slot = slot_at(shm, writer_cursor);
     slot->size = size;
+    slot->time = time;
+
+    /* if the writer has advanced far enough since the last time index entry, add another */
+    const size_t time_index_count = shm->time_index_count;
+    struct shared_memory_ringbuffer_time_index_entry * const newest = shm->time_index + (time_index_count + TIME_INDEX_ENTRIES - 1) % TIME_INDEX_ENTRIES;
+    if (time && (!time_index_count || writer_cursor - newest->cursor >= shm->cursor_wrap / TIME_INDEX_ENTRIES)) {
+        shm->time_index[time_index_count % TIME_INDEX_ENTRIES] = (struct shared_memory_ringbuffer_time_index_entry) {
+            .time = time,
+            .cursor = writer_cursor
+        };
+
+        /* atomic store */
+        shm->time_index_count = time_index_count + 1;
+    }
 
     /* increment the cursor */
-    const size_t size_padded = (sizeof(struct shared_memory_ringbuffer_slot) + slot->size + 15) & ~15;
+    const size_t size_padded = slot_size_padded(slot);
     assert(size_padded <= shm->max_slot_size);
     writer_cursor += size_padded;
 
     /* atomically update the globally visible cursor  */
     shm->writer_cursor = writer_cursor;
+
+    /* advance the oldest-slot cursor past any slots that the next acquired slot could
+     overwrite. this is amortized to about one slot per send, and only the writer ever
+     reads these slot sizes, so they cannot be torn */
+    size_t oldest_cursor = shm->oldest_cursor;
+    while (writer_cursor + shm->max_slot_size - oldest_cursor > shm->cursor_wrap) {
+        const struct shared_memory_ringbuffer_slot * oldest = slot_at(shm, oldest_cursor);
+        oldest_cursor += slot_size_padded(oldest);
+    }
+    shm->oldest_cursor = oldest_cursor;
 }
 
 struct shared_memory_ringbuffer_reader {
     struct shared_memory_ringbuffer * shm;
+    size_t mapped_size;
     size_t reader_cursor;
+
+    /* cursor of the oldest slot returned by the most recent call to recv() or recv_batch(),
+     which is the oldest data the calling code may still be looking at */
+    size_t oldest_returned_cursor;
+
+    /* this reader's entry in the registry, if it was able to register */
+    struct shared_memory_ringbuffer_registry * registry;
+    struct shared_memory_ringbuffer_registry_entry * entry;
 };
 
+/* publish the reader's position to the registry. this is cheap enough to do on every recv */
+static void reader_publish(struct shared_memory_ringbuffer_reader * reader) {
+    if (!reader->entry) return;
+    reader->entry->cursor = reader->oldest_returned_cursor;
+    reader->entry->heartbeat = monotonic_milliseconds();
+}
+
+static void reader_note_lapped(struct shared_memory_ringbuffer_reader * reader) {
+    if (!reader->entry) return;
+    reader->entry->lapped++;
+    reader->registry->readers_lapped++;
+}
+
+static void reader_register(struct shared_memory_ringbuffer_reader * reader, const char * name) {
+    struct shared_memory_ringbuffer_registry * registry = registry_open(name);
+    if (!registry) return;
+
+    const long pid = getpid();
+    for (size_t ientry = 0; ientry < REGISTRY_ENTRIES; ientry++) {
+        struct shared_memory_ringbuffer_registry_entry * entry = &registry->entries[ientry].entry;
+
+        /* claim an unoccupied entry, or one whose occupant has died without unregistering */
+        long occupant = entry->pid;
+        if (occupant && !(-1 == kill(labs(occupant), 0) && ESRCH == errno)) continue;
+        if (!atomic_compare_exchange_strong(&entry->pid, &occupant, -pid)) continue;
+
+        reader->registry = registry;
+        reader->entry = entry;
+        entry->lapped = 0;
+        entry->flags = 0;
+        reader_publish(reader);
+
+        /* atomic store, after everything else in the entry is valid */
+        entry->pid = pid;
+        return;
+    }
+
+    munmap(registry, registry->mapped_size);
+}
+
+static size_t registry_list(const struct shared_memory_ringbuffer * shm, struct shared_memory_ringbuffer_registry * registry,
+                            struct shared_memory_ringbuffer_reader_status * statuses, const size_t max) {
+    if (!registry) return 0;
+
+    const size_t writer_cursor = shm->writer_cursor;
+    const unsigned long now = monotonic_milliseconds();
+
+    size_t count = 0;
+    for (size_t ientry = 0; ientry < REGISTRY_ENTRIES && count < max; ientry++) {
+        const struct shared_memory_ringbuffer_registry_entry * entry = &registry->entries[ientry].entry;
+        const long pid = entry->pid;
+        if (pid <= 0) continue;
+
+        statuses[count++] = (struct shared_memory_ringbuffer_reader_status) {
+            .pid = pid,
+            .lag = writer_cursor - entry->cursor,
+            .capacity = shm->cursor_wrap - shm->max_slot_size,
+            .heartbeat_age_ms = now - entry->heartbeat,
+            .lapped = entry->lapped,
+            .critical = !!(entry->flags & REGISTRY_CRITICAL)
+        };
+    }
+
+    return count;
+}
+
+size_t shared_memory_ringbuffer_writer_list_readers(const struct shared_memory_ringbuffer * shm, struct shared_memory_ringbuffer_reader_status * statuses, const size_t max) {
+    return registry_list(shm, shm->registry, statuses, max);
+}
+
+size_t shared_memory_ringbuffer_reader_list_readers(const struct shared_memory_ringbuffer_reader * reader, struct shared_memory_ringbuffer_reader_status * statuses, const size_t max) {
+    return registry_list(reader->shm, reader->registry, statuses, max);
+}
+
+void shared_memory_ringbuffer_reader_unregister(struct shared_memory_ringbuffer_reader * reader) {
+    if (!reader->entry) return;
+
+    /* atomic store. the registry itself stays mapped, so that readers can still be listed */
+    reader->entry->pid = 0;
+    reader->entry = NULL;
+}
+
+size_t shared_memory_ringbuffer_bytes_sent(const struct shared_memory_ringbuffer_reader * reader) {
+    /* atomic load */
+    return reader->shm->writer_cursor;
+}
+
+unsigned long shared_memory_ringbuffer_readers_lapped(const struct shared_memory_ringbuffer_reader * reader) {
+    return reader->registry ? reader->registry->readers_lapped : 0;
+}
+
+int shared_memory_ringbuffer_reader_set_critical(struct shared_memory_ringbuffer_reader * reader, const int critical) {
+    if (!reader->entry) return -1;
+    if (critical) reader->entry->flags |= REGISTRY_CRITICAL;
+    else reader->entry->flags &= ~REGISTRY_CRITICAL;
+    return 0;
+}
+
+unsigned long shared_memory_ringbuffer_critical_drops(const struct shared_memory_ringbuffer_reader * reader) {
+    return reader->registry ? reader->registry->critical_drops : 0;
+}
+
+size_t shared_memory_ringbuffer_overflow_bytes(const struct shared_memory_ringbuffer_reader * reader) {
+    return reader->registry ? reader->registry->overflow_bytes : 0;
+}
+
+unsigned long shared_memory_ringbuffer_writer_critical_drops(const struct shared_memory_ringbuffer * shm) {
+    return shm->registry ? shm->registry->critical_drops : 0;
+}
+
 int shared_memory_ringbuffer_eof(struct shared_memory_ringbuffer_reader * reader) {
     /* it should be impossible for a reader to call this function on a writer that is not */
     const pid_t writer_pid = reader->shm->writer_pid;
@@ -163,14 +727,19 @@ int shared_memory_ringbuffer_reader_has_kept_up(struct shared_memory_ringbuffer_
      order to deterministically handle the slow-reader condition */
     const size_t writer_cursor = reader->shm->writer_cursor;
 
-    /* well-formed even across wraparound */
-    const size_t lag = writer_cursor - reader->reader_cursor;
+    /* well-formed even across wraparound. measured from the beginning of the oldest slot
+     the calling code may still be using, which in the case of a batch is the first one */
+    const size_t lag = writer_cursor - reader->oldest_returned_cursor;
 
     /* assume the writer could currently be populating a maximum-size packet */
-    return lag + reader->shm->max_slot_size <= reader->shm->cursor_wrap;
+    if (lag + reader->shm->max_slot_size <= reader->shm->cursor_wrap) return 1;
+
+    reader_note_lapped(reader);
+    return 0;
 }
 
-ssize_t shared_memory_ringbuffer_recv(const void ** ret_p, struct shared_memory_ringbuffer_reader * reader) {
+/* as recv(), but without publishing the new position to the registry */
+static ssize_t recv_unpublished(const void ** ret_p, struct shared_memory_ringbuffer_reader * reader) {
     struct shared_memory_ringbuffer * shm = reader->shm;
 
     /* atomic load */
@@ -183,36 +752,160 @@ ssize_t shared_memory_ringbuffer_recv(const void ** ret_p, struct shared_memory_
         return 0;
     };
 
-    const struct shared_memory_ringbuffer_slot * const slot = (void *)(shm->data + (reader->reader_cursor % shm->cursor_wrap));
+    const struct shared_memory_ringbuffer_slot * const slot = slot_at(shm, reader->reader_cursor);
     const size_t slot_size = slot->size;
 
     /* as soon as we've read the size of the packet, we have to verify that we're not a slow
      reader before we do anything with the size we just read. calling code should react to
      -1 by immediately breaking out of the loop */
     const size_t writer_cursor_after_reading_size = shm->writer_cursor;
-    if (writer_cursor_after_reading_size + reader->shm->max_slot_size - reader->reader_cursor - sizeof(struct shared_memory_ringbuffer_slot) > reader->shm->cursor_wrap)
+    if (writer_cursor_after_reading_size + reader->shm->max_slot_size - reader->reader_cursor - sizeof(struct shared_memory_ringbuffer_slot) > reader->shm->cursor_wrap) {
+        reader_note_lapped(reader);
         return -1;
+    }
 
     /* increment the cursor, with possible wraparound */
     const size_t size_padded = (sizeof(struct shared_memory_ringbuffer_slot) + slot_size + 15) & ~15;
+    reader->oldest_returned_cursor = reader->reader_cursor;
     reader->reader_cursor += size_padded;
 
     *ret_p = slot->data;
     return slot_size;
 }
 
+ssize_t shared_memory_ringbuffer_recv(const void ** ret_p, struct shared_memory_ringbuffer_reader * reader) {
+    const ssize_t ret = recv_unpublished(ret_p, reader);
+    if (-1 != ret) reader_publish(reader);
+    return ret;
+}
+
+ssize_t shared_memory_ringbuffer_recv_batch(const void ** ret_p, size_t * ret_sizes, const size_t max_packets, struct shared_memory_ringbuffer_reader * reader) {
+    const size_t cursor_before_batch = reader->reader_cursor;
+
+    size_t ipacket = 0;
+    for (; ipacket < max_packets; ipacket++) {
+        const ssize_t ret = recv_unpublished(ret_p + ipacket, reader);
+        if (-1 == ret) return -1;
+        else if (!ret) break;
+        ret_sizes[ipacket] = ret;
+    }
+
+    /* subsequent calls to has_kept_up() must account for the first slot in the batch. the
+     position is only published now, since a critical reader must not let the writer past
+     the first slot in the batch while the rest of it is being walked */
+    if (ipacket) reader->oldest_returned_cursor = cursor_before_batch;
+    reader_publish(reader);
+    return ipacket;
+}
+
+ssize_t shared_memory_ringbuffer_reader_rewind(struct shared_memory_ringbuffer_reader * reader, const size_t bytes_max) {
+    struct shared_memory_ringbuffer * shm = reader->shm;
+
+    /* walking is restarted from scratch if the writer laps us while walking, which can only
+     plausibly happen a handful of times in a row even with a tiny ring and a busy writer */
+    for (size_t attempt = 0; attempt < 16; attempt++) {
+        const size_t writer_cursor = shm->writer_cursor;
+
+        /* the live head needs no walk, and walking from the oldest slot can fail repeatedly
+         when the writer is about to overwrite it, which would leave a lapped reader stuck */
+        size_t cursor = bytes_max ? shm->oldest_cursor : writer_cursor;
+
+        /* walk forward one slot at a time until we are within bytes_max of the writer */
+        while (writer_cursor - cursor > bytes_max) {
+            const struct shared_memory_ringbuffer_slot * const slot = slot_at(shm, cursor);
+            const size_t slot_size = slot->size;
+
+            /* same check as in recv(), before doing anything with the size we just read */
+            if (shm->writer_cursor + shm->max_slot_size - cursor - sizeof(struct shared_memory_ringbuffer_slot) > shm->cursor_wrap)
+                break;
+
+            cursor += (sizeof(struct shared_memory_ringbuffer_slot) + slot_size + 15) & ~15;
+        }
+
+        /* if the above loop exited early, we were lapped, so try again */
+        if (writer_cursor - cursor > bytes_max) continue;
+
+        reader->reader_cursor = cursor;
+        reader->oldest_returned_cursor = cursor;
+        reader_publish(reader);
+        return writer_cursor - cursor;
+    }
+
+    return -1;
+}
+
+ssize_t shared_memory_ringbuffer_reader_seek_time(struct shared_memory_ringbuffer_reader * reader, const unsigned long long time) {
+    struct shared_memory_ringbuffer * shm = reader->shm;
+
+    for (size_t attempt = 0; attempt < 16; attempt++) {
+        const size_t writer_cursor = shm->writer_cursor;
+        const size_t oldest_cursor = shm->oldest_cursor;
+
+        /* atomic load */
+        const size_t count = shm->time_index_count;
+
+        /* range of usable entries, excluding the one the writer may be overwriting next */
+        const size_t ifirst = count > TIME_INDEX_ENTRIES - 1 ? count - (TIME_INDEX_ENTRIES - 1) : 0;
+        size_t ilo = ifirst, ihi = count;
+
+        /* discard entries referring to slots which are no longer safely readable */
+        while (ilo < ihi && writer_cursor - shm->time_index[ilo % TIME_INDEX_ENTRIES].cursor > writer_cursor - oldest_cursor) ilo++;
+
+        /* binary search for the last entry at or before the requested time. if there is no
+         such entry, start walking from the oldest readable slot */
+        size_t cursor = oldest_cursor;
+        if (ilo < ihi && shm->time_index[ilo % TIME_INDEX_ENTRIES].time <= time) {
+            while (ihi - ilo > 1) {
+                const size_t imid = ilo + (ihi - ilo) / 2;
+                if (shm->time_index[imid % TIME_INDEX_ENTRIES].time <= time) ilo = imid;
+                else ihi = imid;
+            }
+            cursor = shm->time_index[ilo % TIME_INDEX_ENTRIES].cursor;
+        }
+
+        /* if the writer may have started overwriting any of the entries we looked at, retry */
+        if (shm->time_index_count - ifirst >= TIME_INDEX_ENTRIES) continue;
+
+        /* walk forward from there to the first slot at or after the requested time */
+        int lapped = 0;
+        while (cursor != writer_cursor) {
+            const struct shared_memory_ringbuffer_slot * const slot = slot_at(shm, cursor);
+            const size_t slot_size = slot->size;
+            const unsigned long long slot_time = slot->time;
+
+            /* same check as in recv(), before doing anything with what we just read */
+            if (shm->writer_cursor + shm->max_slot_size - cursor - sizeof(struct shared_memory_ringbuffer_slot) > shm->cursor_wrap) {
+                lapped = 1;
+                break;
+            }
+
+            if (slot_time >= time) break;
+            cursor += (sizeof(struct shared_memory_ringbuffer_slot) + slot_size + 15) & ~15;
+        }
+        if (lapped) continue;
+
+        reader->reader_cursor = cursor;
+        reader->oldest_returned_cursor = cursor;
+        reader_publish(reader);
+        return writer_cursor - cursor;
+    }
+
+    return -1;
+}
+
 void shared_memory_ringbuffer_reader_close(struct shared_memory_ringbuffer_reader * reader) {
-    const size_t total_size = offsetof(struct shared_memory_ringbuffer, data) + reader->shm->cursor_wrap + reader->shm->max_slot_size;
-    munmap(reader->shm, total_size);
+    if (reader->entry) reader->entry->pid = 0;
+    if (reader->registry) munmap(reader->registry, reader->registry->mapped_size);
+    munmap(reader->shm, reader->mapped_size);
     free(reader);
 }
 
 struct shared_memory_ringbuffer_reader * shared_memory_ringbuffer_reader_init(const char * name) {
-    const int fd = shm_open(name, O_RDONLY, 0);
+    const int fd = ringbuffer_open(name, O_RDONLY, 0);
     if (-1 == fd) {
         if (errno == ENOENT) return NULL;
         else {
-            fprintf(stderr, "error: %s: shm_open(%s): %s\n", __func__, name, strerror(errno));
+            fprintf(stderr, "error: %s: open(%s): %s\n", __func__, name, strerror(errno));
             return MAP_FAILED;
         }
     }
@@ -224,12 +917,12 @@ struct shared_memory_ringbuffer_reader * shared_memory_ringbuffer_reader_init(co
         return MAP_FAILED;
     }
 
-    struct shared_memory_ringbuffer * shm = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
-    /* done with this */
-    close(fd);
+    struct shared_memory_ringbuffer * shm = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED | MAP_FLAGS_EXTRA, fd, 0);
+    size_t mapped_size = s.st_size;
 
     if (MAP_FAILED == shm) {
         fprintf(stderr, "error: %s: mmap(%s): %s\n", __func__, name, strerror(errno));
+        close(fd);
         return MAP_FAILED;
     }
 
@@ -237,25 +930,48 @@ struct shared_memory_ringbuffer_reader * shared_memory_ringbuffer_reader_init(co
     const pid_t writer_pid = shm->writer_pid;
     if (!writer_pid) {
         /* writer is not yet finished initializing, treat as if writer does not exist yet */
-        munmap(shm, s.st_size);
+        munmap(shm, mapped_size);
+        close(fd);
         return NULL;
     }
 
     if (-1 == kill(writer_pid, 0) && errno != EPERM) {
-        munmap(shm, s.st_size);
-        if (errno != ESRCH) {
-            fprintf(stderr, "error: %s: kill(%ld): %s\n", __func__, shm->writer_pid, strerror(errno));
+        const int errno_kill = errno;
+        munmap(shm, mapped_size);
+        close(fd);
+        if (errno_kill != ESRCH) {
+            fprintf(stderr, "error: %s: kill(%ld): %s\n", __func__, (long)writer_pid, strerror(errno_kill));
             return MAP_FAILED;
         }
         return NULL;
     }
 
+    /* if the writer double mapped the data segment, we must do the same */
+    if (shm->flags & SHARED_MEMORY_RINGBUFFER_DOUBLE_MAPPED) {
+        struct shared_memory_ringbuffer * shm_double = ringbuffer_map(fd, s.st_size, shm->data_offset, shm->cursor_wrap, 1, mapping_granule(name, fd), PROT_READ, &mapped_size);
+        munmap(shm, s.st_size);
+        if (MAP_FAILED == shm_double) {
+            fprintf(stderr, "error: %s: mmap(%s): %s\n", __func__, name, strerror(errno));
+            close(fd);
+            return MAP_FAILED;
+        }
+        shm = shm_double;
+    }
+
+    /* done with this */
+    close(fd);
+
     struct shared_memory_ringbuffer_reader * reader = malloc(sizeof(struct shared_memory_ringbuffer_reader));
     assert(reader);
     *reader = (struct shared_memory_ringbuffer_reader) {
         .shm = shm,
+        .mapped_size = mapped_size,
         .reader_cursor = shm->writer_cursor
     };
+    reader->oldest_returned_cursor = reader->reader_cursor;
+
+    /* if the writer created a registry, announce ourselves in it */
+    reader_register(reader, name);
 
     return reader;
 }
@@ -7,9 +7,27 @@
 
 /* writer functions: */
 
+/* flag for writer_init() which maps the data segment of the ring buffer twice, back to back,
+ such that slots can wrap around its end seamlessly, rather than reserving extra space past
+ the end for the largest possible slot. the ring buffer size must then be a multiple of the
+ page size (or of the huge page size, if backed by hugetlbfs). readers detect this flag and
+ map the segment the same way */
+#define SHARED_MEMORY_RINGBUFFER_DOUBLE_MAPPED 1U
+
+/* flag for writer_init() which makes the writer respect readers which have marked themselves
+ as critical via reader_set_critical(). rather than overwrite data that a critical reader has
+ not yet consumed, the writer queues packets in private memory (up to the size of the ring
+ buffer), and moves them into the ring buffer as soon as the critical reader catches up. if
+ the queue fills, further packets are dropped and counted. ordinary readers are unaffected
+ other than seeing packets late while the queue is non-empty */
+#define SHARED_MEMORY_RINGBUFFER_CRITICAL_READERS 2U
+
 /* writer calls this to create an shm segment. if an error occurs, this function prints to
- stderr and returns MAP_FAILED */
-struct shared_memory_ringbuffer * shared_memory_ringbuffer_writer_init(const char * name, const size_t total_size, const size_t packet_size_max);
+ stderr and returns MAP_FAILED. if the name contains a slash after the leading one, it is
+ treated as a path to a file in some other filesystem, such as a hugetlbfs mount (e.g.
+ "/dev/hugepages/cobs_to_shm"), and readers must be given the same path. the mapping is
+ pre-faulted for both writer and readers where supported */
+struct shared_memory_ringbuffer * shared_memory_ringbuffer_writer_init(const char * name, const size_t total_size, const size_t packet_size_max, const unsigned flags);
 
 /* writer calls this to get a pointer to a memory region into which it can put stuff */
 void * shared_memory_ringbuffer_acquire(struct shared_memory_ringbuffer *);
@@ -17,7 +35,15 @@ void * shared_memory_ringbuffer_acquire(struct shared_memory_ringbuffer *);
 /* and then calls this to actually send it */
 void shared_memory_ringbuffer_send(struct shared_memory_ringbuffer * shm, const size_t size);
 
-/* writer calls this to shut it down, indicating to readers that no more data is coming */
+/* or alternatively this, which also records a nonzero time in microseconds for the packet,
+ and maintains an index allowing readers to seek to a given time via seek_time() */
+void shared_memory_ringbuffer_send_with_time(struct shared_memory_ringbuffer * shm, const size_t size, const unsigned long long time);
+
+/* number of packets the writer has dropped because critical readers were too far behind */
+unsigned long shared_memory_ringbuffer_writer_critical_drops(const struct shared_memory_ringbuffer * shm);
+
+/* writer calls this to shut it down, indicating to readers that no more data is coming. if
+ packets are queued on behalf of critical readers, waits up to a second for them to catch up */
 void shared_memory_ringbuffer_writer_close(struct shared_memory_ringbuffer * shm);
 
 /* reader functions: */
@@ -28,11 +54,29 @@ void shared_memory_ringbuffer_writer_close(struct shared_memory_ringbuffer * shm
  whether this returns MAP_FAILED to indicate an error condition other than the NULL case */
 struct shared_memory_ringbuffer_reader * shared_memory_ringbuffer_reader_init(const char * name);
 
+/* reader may call this immediately after init() to start from up to bytes_max bytes of
+ already-sent packets rather than from the live head, walking forward from the oldest slot
+ that is still safely readable. pass SIZE_MAX to start from the oldest available packet.
+ returns the number of bytes of packets that will be returned by recv() before reaching the
+ point at which rewind() was called, or -1 if the writer kept lapping the walk */
+ssize_t shared_memory_ringbuffer_reader_rewind(struct shared_memory_ringbuffer_reader *, const size_t bytes_max);
+
+/* as above, but starts from the oldest still-readable packet sent with a time at or after
+ the given time in microseconds, using the writer-maintained time index to avoid scanning
+ the whole ring buffer. returns the number of bytes between there and the live head, or -1
+ if the writer kept lapping the search */
+ssize_t shared_memory_ringbuffer_reader_seek_time(struct shared_memory_ringbuffer_reader *, const unsigned long long time);
+
 /* reader calls this to get the next packet. it returns 0 immediately if there is no new
  packet, and the reader should react in some application-specific way. -1 is returned if
  there is an error, including in the slow-reader condition */
 ssize_t shared_memory_ringbuffer_recv(const void **, struct shared_memory_ringbuffer_reader *);
 
+/* as above, but returns up to max_packets packets at once, populating the given arrays of
+ pointers and sizes, and returning the number of packets, or -1 in the slow-reader condition.
+ a subsequent call to has_kept_up() covers every packet in the batch */
+ssize_t shared_memory_ringbuffer_recv_batch(const void ** ret_p, size_t * ret_sizes, const size_t max_packets, struct shared_memory_ringbuffer_reader *);
+
 /* reader should eventually call this upon seeing some application-specific interval in
  which no new packets have arrived, and react by closing down */
 int shared_memory_ringbuffer_eof(struct shared_memory_ringbuffer_reader *);
@@ -41,5 +85,66 @@ int shared_memory_ringbuffer_eof(struct shared_memory_ringbuffer_reader *);
  recent packet, BEFORE releasing the results of such computation further downstream */
 int shared_memory_ringbuffer_reader_has_kept_up(struct shared_memory_ringbuffer_reader *);
 
+/* status of a registered reader, as returned by the list_readers() functions below */
+struct shared_memory_ringbuffer_reader_status {
+    long pid;
+
+    /* bytes between the oldest slot the reader may still be using and the writer cursor */
+    size_t lag;
+
+    /* the lag at which the reader would be lapped */
+    size_t capacity;
+
+    /* time since the reader last called recv() */
+    unsigned long heartbeat_age_ms;
+
+    /* number of times the reader has detected that it was lapped */
+    unsigned long lapped;
+
+    /* whether the reader has marked itself as critical */
+    int critical;
+};
+
+/* readers built against this library register themselves in a table alongside the ring
+ buffer, publishing their pid, position and a heartbeat on every recv(). the writer or any
+ reader can call these to populate up to max statuses, returning the number populated */
+size_t shared_memory_ringbuffer_writer_list_readers(const struct shared_memory_ringbuffer * shm, struct shared_memory_ringbuffer_reader_status * statuses, const size_t max);
+size_t shared_memory_ringbuffer_reader_list_readers(const struct shared_memory_ringbuffer_reader * reader, struct shared_memory_ringbuffer_reader_status * statuses, const size_t max);
+
+/* monitoring tools which never call recv() may call this after init() to remove themselves
+ from the registry, such that they neither appear as a reader falling ever further behind nor
+ count towards the laps below, while still being able to list the other readers */
+void shared_memory_ringbuffer_reader_unregister(struct shared_memory_ringbuffer_reader * reader);
+
+/* total bytes of slots the writer has sent since the ring buffer was created, including the
+ prefix and padding of each, modulo the range of size_t. the difference between two calls
+ gives the data rate without consuming anything, and so without any risk of being lapped */
+size_t shared_memory_ringbuffer_bytes_sent(const struct shared_memory_ringbuffer_reader * reader);
+
+/* total number of times any registered reader has detected that it was lapped */
+unsigned long shared_memory_ringbuffer_readers_lapped(const struct shared_memory_ringbuffer_reader * reader);
+
+/* reader calls this to ask that a writer created with SHARED_MEMORY_RINGBUFFER_CRITICAL_READERS
+ not overwrite anything it has not yet consumed. the protection covers everything after the
+ oldest slot returned by the most recent recv(), so a critical reader which rewinds is only
+ protected once the writer next scans the registry, within half a ring. returns -1 if the
+ reader could not register, in which case it remains an ordinary lossy reader */
+int shared_memory_ringbuffer_reader_set_critical(struct shared_memory_ringbuffer_reader * reader, const int critical);
+
+/* number of packets dropped by the writer on behalf of critical readers, and the number of
+ bytes of packets it currently has queued for the same reason */
+unsigned long shared_memory_ringbuffer_critical_drops(const struct shared_memory_ringbuffer_reader * reader);
+size_t shared_memory_ringbuffer_overflow_bytes(const struct shared_memory_ringbuffer_reader * reader);
+
+/* utility functions for other small shm segments living alongside the ring buffer, named as
+ the ring buffer plus the given suffix (e.g. "/cobs_to_shm.metrics"). the writer creates one,
+ replacing any existing one, with room for at least size_min bytes, readable by all and, only if
+ writable_by_readers is nonzero, writable by the writer's group, which readers running as other
+ users must then belong to. readers open it, getting NULL if it does not exist or is smaller
+ than size_min. both return NULL on failure, and populate the actual mapped size, which should
+ later be passed to munmap() */
+void * shared_memory_ringbuffer_sibling_create(const char * name, const char * suffix, const size_t size_min, const int writable_by_readers, size_t * mapped_size_p);
+void * shared_memory_ringbuffer_sibling_open(const char * name, const char * suffix, const size_t size_min, const int writable, size_t * mapped_size_p);
+
 /* reader calls this to close down */
 void shared_memory_ringbuffer_reader_close(struct shared_memory_ringbuffer_reader * ctx);
@@ -0,0 +1,319 @@
+/* campbell, isc license */
+
+/* python extension module wrapping the c ring buffer reader, such that python readers get
+ zero-copy memoryviews of batches of packets without doing any per-packet struct unpacking
+ or slicing in python. the memoryviews can be handed to numpy.frombuffer() without copying.
+ calling code must still call has_kept_up() after doing whatever it does with a batch, and
+ before pushing the results further downstream, exactly as with the c api */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "shared_memory_ringbuffer.h"
+
+#include <time.h>
+
+/* maximum number of packets returned by a single call to recv_batch() */
+#define BATCH_MAX 256
+
+static PyObject * LappedError;
+
+typedef struct {
+    PyObject_HEAD
+    struct shared_memory_ringbuffer_reader * reader;
+
+    /* region most recently handed out via the buffer protocol. this is set immediately prior
+     to each call to PyMemoryView_FromObject(), such that each resulting memoryview holds a
+     reference to this object and therefore keeps the mapping alive */
+    const void * export_ptr;
+    size_t export_size;
+
+    /* adaptive polling interval used by blocking waits, same logic as the c readers */
+    unsigned long delay;
+} ReaderObject;
+
+static int reader_getbuffer(PyObject * obj, Py_buffer * view, int flags) {
+    ReaderObject * self = (ReaderObject *)obj;
+    return PyBuffer_FillInfo(view, obj, (void *)self->export_ptr, self->export_size, 1, flags);
+}
+
+static PyBufferProcs reader_as_buffer = {
+    .bf_getbuffer = reader_getbuffer,
+};
+
+/* the mapping is only released once every outstanding memoryview has been released */
+static void reader_dealloc(ReaderObject * self) {
+    if (self->reader) shared_memory_ringbuffer_reader_close(self->reader);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static unsigned long long monotonic_microseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000U;
+}
+
+PyDoc_STRVAR(recv_batch_doc,
+"recv_batch(max_packets=256, timeout=0.0) -> list of memoryview\n\n"
+"Returns up to max_packets packets as read-only memoryviews into the ring buffer. If no\n"
+"packets are available, waits up to timeout seconds (forever if None) with the GIL\n"
+"released, returning an empty list if none arrive. Raises EOFError if the writer has\n"
+"exited, and LappedError if the reader has been lapped by the writer.");
+
+static PyObject * reader_recv_batch(ReaderObject * self, PyObject * args, PyObject * kwargs) {
+    static char * kwlist[] = { "max_packets", "timeout", NULL };
+    Py_ssize_t max_packets = BATCH_MAX;
+    PyObject * timeout_obj = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|nO", kwlist, &max_packets, &timeout_obj))
+        return NULL;
+
+    if (max_packets < 1 || max_packets > BATCH_MAX) {
+        PyErr_Format(PyExc_ValueError, "max_packets must be between 1 and %d", BATCH_MAX);
+        return NULL;
+    }
+
+    /* negative timeout means wait forever */
+    double timeout = 0.0;
+    if (timeout_obj == Py_None) timeout = -1.0;
+    else if (timeout_obj && -1.0 == (timeout = PyFloat_AsDouble(timeout_obj)) && PyErr_Occurred())
+        return NULL;
+
+    const unsigned long long time_start = monotonic_microseconds();
+    const void * ptrs[BATCH_MAX];
+    size_t sizes[BATCH_MAX];
+    ssize_t ret;
+    int slept = 0, eof = 0;
+
+    while (1) {
+        /* poll, sleeping in between polls, for not more than 50 ms without the gil */
+        Py_BEGIN_ALLOW_THREADS
+        const unsigned long long time_release = monotonic_microseconds();
+        while (1) {
+            ret = shared_memory_ringbuffer_recv_batch(ptrs, sizes, max_packets, self->reader);
+            if (ret) break;
+
+            /* only check for eof if we've already slept and there are still no packets */
+            if (slept && shared_memory_ringbuffer_eof(self->reader)) {
+                eof = 1;
+                break;
+            }
+
+            const unsigned long long now = monotonic_microseconds();
+            if (timeout >= 0.0 && now - time_start >= timeout * 1e6) break;
+            if (now - time_release >= 50000) break;
+
+            usleep(self->delay);
+            slept = 1;
+        }
+        Py_END_ALLOW_THREADS
+
+        if (ret || eof) break;
+        if (timeout >= 0.0 && monotonic_microseconds() - time_start >= timeout * 1e6) break;
+        if (PyErr_CheckSignals()) return NULL;
+    }
+
+    if (-1 == ret) {
+        PyErr_SetString(LappedError, "reader lapped while reading size of slot");
+        return NULL;
+    }
+
+    if (eof) {
+        PyErr_SetString(PyExc_EOFError, "writer has exited");
+        return NULL;
+    }
+
+    /* maintain a rough estimate of the packet rate for the next blocking wait, which a wait
+     that timed out without any packets says nothing about */
+    if (slept && ret > 0) {
+        self->delay = (3UL * self->delay + (monotonic_microseconds() - time_start) / ret + 2UL) / 4UL;
+        self->delay = self->delay > 1000000UL ? 1000000UL : self->delay < 1000UL ? 1000UL : self->delay;
+    }
+
+    PyObject * list = PyList_New(ret);
+    if (!list) return NULL;
+
+    for (ssize_t ipacket = 0; ipacket < ret; ipacket++) {
+        self->export_ptr = ptrs[ipacket];
+        self->export_size = sizes[ipacket];
+
+        PyObject * view = PyMemoryView_FromObject((PyObject *)self);
+        if (!view) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, ipacket, view);
+    }
+
+    return list;
+}
+
+PyDoc_STRVAR(rewind_doc,
+"rewind(bytes_max) -> int\n\n"
+"Starts from up to bytes_max bytes of already-sent packets rather than the live head,\n"
+"returning the number of bytes actually rewound. Pass sys.maxsize for everything available.");
+
+static PyObject * reader_rewind(ReaderObject * self, PyObject * args) {
+    Py_ssize_t bytes_max;
+    if (!PyArg_ParseTuple(args, "n", &bytes_max)) return NULL;
+    if (bytes_max < 0) {
+        PyErr_SetString(PyExc_ValueError, "bytes_max must not be negative");
+        return NULL;
+    }
+
+    const ssize_t ret = shared_memory_ringbuffer_reader_rewind(self->reader, bytes_max);
+    if (-1 == ret) {
+        PyErr_SetString(LappedError, "reader lapped repeatedly while rewinding");
+        return NULL;
+    }
+    return PyLong_FromSsize_t(ret);
+}
+
+PyDoc_STRVAR(seek_time_doc,
+"seek_time(time_microseconds) -> int\n\n"
+"Starts from the oldest still-available packet sent at or after the given unix time in\n"
+"microseconds, returning the number of bytes between there and the live head.");
+
+static PyObject * reader_seek_time(ReaderObject * self, PyObject * args) {
+    long long time;
+    if (!PyArg_ParseTuple(args, "L", &time)) return NULL;
+    if (time < 0) {
+        PyErr_SetString(PyExc_ValueError, "time_microseconds must not be negative");
+        return NULL;
+    }
+
+    const ssize_t ret = shared_memory_ringbuffer_reader_seek_time(self->reader, time);
+    if (-1 == ret) {
+        PyErr_SetString(LappedError, "reader lapped repeatedly while seeking");
+        return NULL;
+    }
+    return PyLong_FromSsize_t(ret);
+}
+
+PyDoc_STRVAR(has_kept_up_doc,
+"has_kept_up() -> bool\n\n"
+"Returns True if no packet in the most recent batch can have been overwritten by the writer.");
+
+static PyObject * reader_has_kept_up(ReaderObject * self, PyObject * Py_UNUSED(ignored)) {
+    return PyBool_FromLong(shared_memory_ringbuffer_reader_has_kept_up(self->reader));
+}
+
+PyDoc_STRVAR(check_kept_up_doc,
+"check_kept_up()\n\n"
+"Raises LappedError if has_kept_up() would return False.");
+
+static PyObject * reader_check_kept_up(ReaderObject * self, PyObject * Py_UNUSED(ignored)) {
+    if (!shared_memory_ringbuffer_reader_has_kept_up(self->reader)) {
+        PyErr_SetString(LappedError, "reader lapped while reading slot");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(set_critical_doc,
+"set_critical(critical=True)\n\n"
+"Asks a writer which supports it not to overwrite anything this reader has not yet consumed,\n"
+"at the expense of delaying packets for every other reader. Raises OSError if the reader\n"
+"could not register with the writer.");
+
+static PyObject * reader_set_critical(ReaderObject * self, PyObject * args) {
+    int critical = 1;
+    if (!PyArg_ParseTuple(args, "|p", &critical)) return NULL;
+
+    if (-1 == shared_memory_ringbuffer_reader_set_critical(self->reader, critical)) {
+        PyErr_SetString(PyExc_OSError, "reader is not registered");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(eof_doc,
+"eof() -> bool\n\n"
+"Returns True if the writer has exited.");
+
+static PyObject * reader_eof(ReaderObject * self, PyObject * Py_UNUSED(ignored)) {
+    return PyBool_FromLong(0 != shared_memory_ringbuffer_eof(self->reader));
+}
+
+static PyMethodDef reader_methods[] = {
+    { "recv_batch", (PyCFunction)(void(*)(void))reader_recv_batch, METH_VARARGS | METH_KEYWORDS, recv_batch_doc },
+    { "rewind", (PyCFunction)reader_rewind, METH_VARARGS, rewind_doc },
+    { "seek_time", (PyCFunction)reader_seek_time, METH_VARARGS, seek_time_doc },
+    { "has_kept_up", (PyCFunction)reader_has_kept_up, METH_NOARGS, has_kept_up_doc },
+    { "check_kept_up", (PyCFunction)reader_check_kept_up, METH_NOARGS, check_kept_up_doc },
+    { "set_critical", (PyCFunction)reader_set_critical, METH_VARARGS, set_critical_doc },
+    { "eof", (PyCFunction)reader_eof, METH_NOARGS, eof_doc },
+    { NULL, NULL, 0, NULL }
+};
+
+static PyTypeObject ReaderType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_shared_memory_ringbuffer.Reader",
+    .tp_doc = PyDoc_STR("Connection to a shared memory ring buffer, obtained via reader_init()"),
+    .tp_basicsize = sizeof(ReaderObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor)reader_dealloc,
+    .tp_as_buffer = &reader_as_buffer,
+    .tp_methods = reader_methods,
+};
+
+PyDoc_STRVAR(reader_init_doc,
+"reader_init(name) -> Reader or None\n\n"
+"Connects to the named shm segment, returning None if it does not exist or its writer is\n"
+"not alive, such that the caller can sleep and try again.");
+
+static PyObject * module_reader_init(PyObject * Py_UNUSED(module), PyObject * args) {
+    const char * name;
+    if (!PyArg_ParseTuple(args, "s", &name)) return NULL;
+
+    struct shared_memory_ringbuffer_reader * reader = shared_memory_ringbuffer_reader_init(name);
+    if (!reader) Py_RETURN_NONE;
+    if (MAP_FAILED == (void *)reader) {
+        PyErr_Format(PyExc_OSError, "could not connect to %s", name);
+        return NULL;
+    }
+
+    ReaderObject * self = PyObject_New(ReaderObject, &ReaderType);
+    if (!self) {
+        shared_memory_ringbuffer_reader_close(reader);
+        return NULL;
+    }
+
+    self->reader = reader;
+    self->export_ptr = NULL;
+    self->export_size = 0;
+    self->delay = 20000;
+    return (PyObject *)self;
+}
+
+static PyMethodDef module_methods[] = {
+    { "reader_init", module_reader_init, METH_VARARGS, reader_init_doc },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef module_def = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "_shared_memory_ringbuffer",
+    .m_doc = PyDoc_STR("Zero-copy batched reader for the cobs_to_shm shared memory ring buffer"),
+    .m_size = -1,
+    .m_methods = module_methods,
+};
+
+PyMODINIT_FUNC PyInit__shared_memory_ringbuffer(void);
+
+PyMODINIT_FUNC PyInit__shared_memory_ringbuffer(void) {
+    if (PyType_Ready(&ReaderType) < 0) return NULL;
+
+    PyObject * module = PyModule_Create(&module_def);
+    if (!module) return NULL;
+
+    /* subclass of RuntimeError, which is what the pure python reader raises */
+    LappedError = PyErr_NewExceptionWithDoc("_shared_memory_ringbuffer.LappedError",
+                                            "Raised when the writer has lapped a slow reader", PyExc_RuntimeError, NULL);
+    if (!LappedError ||
+        PyModule_AddObjectRef(module, "LappedError", LappedError) < 0 ||
+        PyModule_AddObjectRef(module, "Reader", (PyObject *)&ReaderType) < 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    return module;
+}
@@ -1,9 +1,12 @@
 #!/usr/bin/env python3
 # for context, there is a C struct in a shared memory segment called "/shm", containing
-# an unsigned long writer_cursor after two size_t's, some possible padding for 16-byte
-# alignment, and then a ring buffer with extra space past the end, such that variable-size
-# writes to the ring buffer of less than some maximum size can be written and read
-# contiguously. each slot has a size_t and some padding for 16-byte alignment as a prefix
+# an unsigned long writer_cursor after two size_t's, followed by a long writer_pid, an
+# unsigned long oldest_cursor, some bookkeeping including the offset of the data segment
+# and some flags, a time index used only by the compiled reader, and then a ring buffer with
+# extra space past the end, such that variable-size writes to the ring buffer of less than
+# some maximum size can be written and read contiguously. each slot has a size_t and some
+# padding for 16-byte alignment as a prefix. if the writer double mapped the ring buffer,
+# there is no extra space past the end, and slots may instead wrap around to the beginning
 
 # this is more or less a direct port of the equivalent C code, including copying the API,
 # and accordingly does not use oop stuff
@@ -16,18 +19,34 @@ import time
 from types import SimpleNamespace
 from _posixshmem import shm_open
 
+# compiled extension module providing zero-copy batched reads, built via "make python". if
+# it is not available, the pure python port below is used instead
+try: import _shared_memory_ringbuffer
+except ImportError: _shared_memory_ringbuffer = None
+
+# offsets and sizes within the shm segment, computed once rather than on every packet
+writer_cursor_offset = struct.calcsize('NN')
+writer_cursor_size = struct.calcsize('L')
+oldest_cursor_offset = struct.calcsize('NNLl')
+data_offset_and_flags_offset = struct.calcsize('NNLlLLN')
+flag_double_mapped = 1
+payload_offset_in_slot = (struct.calcsize('N') + 15) & ~15
+size_of_size = struct.calcsize('N')
+
 def pid_is_still_alive(pid):
     try: os.kill(pid, 0)
     except PermissionError: return True
     except: return False
     return True
 
-def shared_memory_ringbuffer_reader_init(name):
-    writer_cursor_offset = struct.calcsize('NN')
-    writer_cursor_size = struct.calcsize('L')
+# names containing a slash after the leading one are paths to files in some other filesystem,
+# such as a hugetlbfs mount, rather than posix shm names
+def ringbuffer_open(name):
+    return os.open(name, os.O_RDONLY) if '/' in name[1:] else shm_open(name, os.O_RDONLY, 0)
 
+def shared_memory_ringbuffer_reader_init(name):
     while True:
-        try: fd = shm_open(name, os.O_RDONLY, 0)
+        try: fd = ringbuffer_open(name)
         except FileNotFoundError: return None
 
         m = mmap.mmap(fd, os.fstat(fd).st_size, prot=mmap.PROT_READ)
@@ -39,27 +58,53 @@ def shared_memory_ringbuffer_reader_init(name):
 
         if 0 == pid or not pid_is_still_alive(pid): return None
         view_of_writer_cursor = view[writer_cursor_offset:(writer_cursor_offset + writer_cursor_size)].cast('L')
+        view_of_oldest_cursor = view[oldest_cursor_offset:(oldest_cursor_offset + writer_cursor_size)].cast('L')
+        data_offset, flags = struct.unpack_from('NI', view, data_offset_and_flags_offset)
 
         return SimpleNamespace(view = view,
                                cursor_wrap = cursor_wrap,
                                max_slot_size = max_slot_size,
+                               data_offset = data_offset,
+                               double_mapped = bool(flags & flag_double_mapped),
                                reader_cursor = reader_cursor,
+                               oldest_returned_cursor = reader_cursor,
                                view_of_writer_cursor = view_of_writer_cursor,
+                               view_of_oldest_cursor = view_of_oldest_cursor,
                                pid = pid)
 
+# start from up to bytes_max bytes of already-sent packets rather than the live head
+def shared_memory_ringbuffer_reader_rewind(shm, bytes_max):
+    for attempt in range(16):
+        writer_cursor = shm.view_of_writer_cursor[0]
+        cursor = shm.view_of_oldest_cursor[0]
+
+        # walk forward one slot at a time until we are within bytes_max of the writer
+        while writer_cursor - cursor > bytes_max:
+            slot_offset = shm.data_offset + (cursor % shm.cursor_wrap)
+            payload_size = shm.view[slot_offset:(slot_offset + size_of_size)].cast('N')[0]
+
+            # same check as in recv, before doing anything with the size we just read
+            if shm.view_of_writer_cursor[0] + shm.max_slot_size - cursor - payload_offset_in_slot > shm.cursor_wrap: break
+            cursor += (payload_offset_in_slot + payload_size + 15) & ~15
+
+        # if the above loop exited early, we were lapped, so try again
+        if writer_cursor - cursor > bytes_max: continue
+
+        shm.reader_cursor = cursor
+        shm.oldest_returned_cursor = cursor
+        return writer_cursor - cursor
+
+    raise RuntimeError('reader lapped repeatedly while rewinding')
+
 def shared_memory_ringbuffer_reader_has_kept_up(shm):
-    return (shm.view_of_writer_cursor[0] - shm.reader_cursor) + shm.max_slot_size <= shm.cursor_wrap
+    return (shm.view_of_writer_cursor[0] - shm.oldest_returned_cursor) + shm.max_slot_size <= shm.cursor_wrap
 
 def shared_memory_ringbuffer_reader_recv(shm):
-    data_offset = (struct.calcsize('NNLl') + 15) & ~15
-    payload_offset_in_slot = (struct.calcsize('N') + 15) & ~15
-    size_of_size = struct.calcsize('N')
-
     writer_cursor_now = shm.view_of_writer_cursor[0]
     if writer_cursor_now == shm.reader_cursor:
         return None
 
-    slot_offset = data_offset + (shm.reader_cursor % shm.cursor_wrap)
+    slot_offset = shm.data_offset + (shm.reader_cursor % shm.cursor_wrap)
     payload_size = shm.view[slot_offset:(slot_offset + size_of_size)].cast('N')[0]
 
     # AFTER reading size, BEFORE doing anything with it, need to make sure it was not lapped
@@ -70,19 +115,72 @@ def shared_memory_ringbuffer_reader_recv(shm):
     payload_offset = slot_offset + payload_offset_in_slot
 
     # advance the reader cursor, with awareness of padding
+    shm.oldest_returned_cursor = shm.reader_cursor
     shm.reader_cursor += (payload_offset_in_slot + payload_size + 15) & ~15
 
+    # if the ring buffer is double mapped, a slot may wrap around the end of the data segment,
+    # in which case we only map it once here, and must reassemble it with a copy
+    data_end = shm.data_offset + shm.cursor_wrap
+    if shm.double_mapped and payload_offset + payload_size > data_end:
+        return memoryview(bytes(shm.view[payload_offset:data_end]) +
+                          bytes(shm.view[shm.data_offset:(shm.data_offset + payload_offset + payload_size - data_end)]))
+
     return shm.view[payload_offset:(payload_offset + payload_size)]
 
 # end direct port of C API stuff, begin utility generator function that can be used as a
 # python iterator by calling code
 
-def shared_memory_ringbuffer_generator(shm_name):
+# given a backfill specification, which is either a number of bytes or a number of seconds
+# with an "s" suffix, return a number of bytes to rewind and a number of seconds to skip to
+def parse_backfill(text):
+    if text is None: return 0, None
+    if text.endswith('s'): return sys.maxsize, float(text[:-1])
+    return int(text), None
+
+# when backfilling by time, skip packets whose logging header predates the cutoff
+def logged_time_is_before(payload, cutoff_microseconds):
+    _, timestamp_lsbs, timestamp_msbs = struct.unpack_from('<HHI', payload)
+    return ((timestamp_msbs << 16) | timestamp_lsbs) * 16 < cutoff_microseconds
+
+def shared_memory_ringbuffer_generator_compiled(shm_name, backfill):
+    while True:
+        reader = _shared_memory_ringbuffer.reader_init(shm_name)
+        if reader is not None: break
+        time.sleep(0.05)
+
+    backfill_bytes, backfill_seconds = parse_backfill(backfill)
+    # anything further back than the epoch just means the oldest packet available
+    if backfill_seconds is not None: reader.seek_time(max(0, round(time.time() * 1e6 - backfill_seconds * 1e6)))
+    elif backfill_bytes: reader.rewind(backfill_bytes)
+
+    while True:
+        try: batch = reader.recv_batch(timeout=None)
+        except EOFError:
+            print('writer has exited', file=sys.stderr)
+            break
+
+        for payload in batch:
+            yield payload
+
+            # has_kept_up() covers every packet in the batch, so this is conservative
+            reader.check_kept_up()
+
+# optional backfill argument is a number of bytes, or a number of seconds with an "s" suffix,
+# of already-sent packets to yield before the live ones, e.g. to prime a restarted detector
+def shared_memory_ringbuffer_generator(shm_name, backfill=None):
+    if _shared_memory_ringbuffer is not None:
+        yield from shared_memory_ringbuffer_generator_compiled(shm_name, backfill)
+        return
+
     while True:
         shm = shared_memory_ringbuffer_reader_init(shm_name)
         if shm is not None: break
         time.sleep(0.05)
 
+    backfill_bytes, backfill_seconds = parse_backfill(backfill)
+    if backfill_bytes: shared_memory_ringbuffer_reader_rewind(shm, backfill_bytes)
+    cutoff = None if backfill_seconds is None else time.time() * 1e6 - backfill_seconds * 1e6
+
     seconds_per_packet_num = 0
     seconds_per_packet_den = 0
     delay = 0.02
@@ -107,6 +205,10 @@ def shared_memory_ringbuffer_generator(shm_name):
         seconds_per_packet_num = 0
         seconds_per_packet_den += 1
 
+        if cutoff is not None:
+            if len(payload) >= 8 and logged_time_is_before(payload, cutoff): continue
+            cutoff = None
+
         yield payload
 
         # we can now detect whether we were lapped while doing something with this slot.
@@ -118,8 +220,9 @@ def shared_memory_ringbuffer_generator(shm_name):
 if __name__ == '__main__':
     def main():
         shm_name = '/shm' if len(sys.argv) < 2 else sys.argv[1]
+        backfill = None if len(sys.argv) < 3 else sys.argv[2]
 
-        for payload in shared_memory_ringbuffer_generator(shm_name):
+        for payload in shared_memory_ringbuffer_generator(shm_name, backfill):
             sys.stdout.buffer.write(payload)
             padding_size = ((len(payload) + 7) & ~7) - len(payload)
             if padding_size:
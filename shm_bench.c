@@ -0,0 +1,305 @@
+/* campbell, isc license */
+
+/* benchmark of the shm ring buffer itself, without any serial input or disk output. measures
+ writer throughput as a function of packet size, reader throughput with increasing numbers
+ of concurrent readers, how often a reader is lapped when it stalls periodically, and the
+ latency between the writer sending a packet and a polling reader receiving it. results are
+ printed to stdout as one json object per line, such that they can be compared across builds,
+ with progress on stderr. invoke as "shm_bench [seconds_per_test] [max_readers]" */
+
+/* needed for sched_setaffinity, must occur prior to any include statements */
+#define _GNU_SOURCE
+
+#include "shared_memory_ringbuffer.h"
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/* useful macros */
+#define WARNING_ANSI "\x1B[35;1mwarning:\x1B[0m"
+#define ERROR_ANSI "\x1B[31;1merror:\x1B[0m"
+#define NOPE(...) do { fprintf(stderr, ERROR_ANSI " " __VA_ARGS__); exit(EXIT_FAILURE); } while(0)
+
+#define RING_SIZE (4U << 20)
+#define PACKET_SIZE_MAX 65536U
+#define READERS_MAX 64
+
+static unsigned long long monotonic_nanoseconds(void) {
+    struct timespec timespec;
+    clock_gettime(CLOCK_MONOTONIC, &timespec);
+    return timespec.tv_sec * 1000000000ULL + timespec.tv_nsec;
+}
+
+static void sleep_nanoseconds(const unsigned long long nanoseconds) {
+    const struct timespec timespec = { .tv_sec = nanoseconds / 1000000000ULL, .tv_nsec = nanoseconds % 1000000000ULL };
+    nanosleep(&timespec, NULL);
+}
+
+/* results written by forked readers, in an anonymous shared mapping */
+struct reader_result {
+    unsigned long packets;
+    unsigned long bytes;
+    unsigned long lapped;
+    double seconds;
+
+    /* nanoseconds from send to receive, for packets carrying a send time */
+    struct metrics_histogram latency;
+};
+
+struct shared {
+    _Atomic unsigned readers_ready;
+    struct reader_result results[READERS_MAX];
+};
+
+/* how each forked reader behaves */
+struct reader_options {
+    /* every stall_interval_ns, sleep for stall_ns, if nonzero */
+    unsigned long long stall_interval_ns, stall_ns;
+
+    /* whether packets carry the monotonic send time in their first eight bytes */
+    int timed;
+};
+
+static long cpu_count;
+
+/* spread processes across cpus, if there is more than one, leaving cpu 0 for the writer */
+static void pin_to_cpu(const unsigned icpu) {
+    if (cpu_count < 2) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(icpu % cpu_count, &set);
+    if (-1 == sched_setaffinity(0, sizeof(set), &set))
+        fprintf(stderr, WARNING_ANSI " %s: sched_setaffinity(): %s\n", __func__, strerror(errno));
+}
+
+static void reader_main(const char * name, struct shared * shared, const unsigned ireader, const struct reader_options options) {
+    pin_to_cpu(ireader + 1);
+
+    struct shared_memory_ringbuffer_reader * shm = shared_memory_ringbuffer_reader_init(name);
+    if (!shm || MAP_FAILED == (void *)shm) NOPE("%s: could not connect to \"%s\"\n", __func__, name);
+
+    struct reader_result * result = shared->results + ireader;
+    shared->readers_ready++;
+
+    const unsigned long long time_start = monotonic_nanoseconds();
+    unsigned long long time_next_stall = time_start + options.stall_interval_ns;
+
+    const void * packets[64];
+    size_t sizes[64];
+
+    while (1) {
+        const ssize_t count = shared_memory_ringbuffer_recv_batch(packets, sizes, 64, shm);
+        const unsigned long long time_received = monotonic_nanoseconds();
+
+        if (-1 == count) {
+            /* start again from the live head, as a lossy reader would */
+            result->lapped++;
+            shared_memory_ringbuffer_reader_rewind(shm, 0);
+            continue;
+        }
+        else if (!count) {
+            if (shared_memory_ringbuffer_eof(shm)) break;
+
+            /* on a single cpu, spinning would only delay the writer */
+            if (cpu_count < 2) sched_yield();
+            continue;
+        }
+
+        unsigned long bytes = 0;
+        for (ssize_t ipacket = 0; ipacket < count; ipacket++) {
+            bytes += sizes[ipacket];
+            if (options.timed && sizes[ipacket] >= sizeof(uint64_t)) {
+                uint64_t time_sent;
+                memcpy(&time_sent, packets[ipacket], sizeof(time_sent));
+                metrics_histogram_record(&result->latency, time_received > time_sent ? time_received - time_sent : 0);
+            }
+        }
+
+        if (!shared_memory_ringbuffer_reader_has_kept_up(shm)) {
+            result->lapped++;
+            shared_memory_ringbuffer_reader_rewind(shm, 0);
+            continue;
+        }
+
+        result->packets += count;
+        result->bytes += bytes;
+
+        if (options.stall_ns && time_received >= time_next_stall) {
+            sleep_nanoseconds(options.stall_ns);
+            time_next_stall = monotonic_nanoseconds() + options.stall_interval_ns;
+        }
+    }
+
+    result->seconds = (monotonic_nanoseconds() - time_start) * 1e-9;
+    shared_memory_ringbuffer_reader_close(shm);
+}
+
+/* forks the given number of readers and waits until all of them have connected */
+static void start_readers(const char * name, struct shared * shared, const unsigned readers, const struct reader_options options) {
+    memset(shared, 0, sizeof(*shared));
+
+    for (unsigned ireader = 0; ireader < readers; ireader++) {
+        const pid_t pid = fork();
+        if (-1 == pid) NOPE("%s: fork(): %s\n", __func__, strerror(errno));
+        else if (!pid) {
+            reader_main(name, shared, ireader, options);
+            _exit(EXIT_SUCCESS);
+        }
+    }
+
+    while (shared->readers_ready < readers) usleep(1000);
+}
+
+static void wait_for_readers(void) {
+    int status;
+    while (wait(&status) > 0)
+        if (!WIFEXITED(status) || WEXITSTATUS(status))
+            NOPE("%s: a reader failed\n", __func__);
+}
+
+/* sends packets of the given size, either as fast as possible or at the given rate in bytes
+ per second, for the given time, returning the number of packets sent */
+static unsigned long write_packets(struct shared_memory_ringbuffer * shm, const size_t packet_size, const double bytes_per_second,
+                                   const double seconds, const int timed) {
+    const unsigned long long time_start = monotonic_nanoseconds(), time_end = time_start + seconds * 1e9;
+    unsigned long packets = 0;
+
+    for (unsigned long long time_now = time_start; time_now < time_end; ) {
+        /* when pacing, send whatever is due in bursts of about 100 us */
+        const unsigned long packets_due = bytes_per_second > 0 ? (time_now - time_start) * 1e-9 * bytes_per_second / packet_size + 1 : packets + 256;
+
+        for (; packets < packets_due; packets++) {
+            unsigned char * slot = shared_memory_ringbuffer_acquire(shm);
+            if (timed) {
+                const uint64_t time_sent = monotonic_nanoseconds();
+                memcpy(slot, &time_sent, sizeof(time_sent));
+            }
+            /* populate the whole packet, as a real writer would */
+            memset(slot + (timed ? sizeof(uint64_t) : 0), (unsigned char)packets, packet_size - (timed ? sizeof(uint64_t) : 0));
+            shared_memory_ringbuffer_send(shm, packet_size);
+        }
+
+        if (bytes_per_second > 0) sleep_nanoseconds(100000);
+        time_now = monotonic_nanoseconds();
+    }
+
+    return packets;
+}
+
+static void print_latency_quantiles(const struct metrics_histogram * histogram) {
+    static const struct metrics_histogram zero;
+    printf("\"latency_ns_p50\": %lu, \"latency_ns_p90\": %lu, \"latency_ns_p99\": %lu, \"latency_ns_p999\": %lu, \"latency_ns_max\": %lu",
+           metrics_histogram_quantile(histogram, &zero, 0.5), metrics_histogram_quantile(histogram, &zero, 0.9),
+           metrics_histogram_quantile(histogram, &zero, 0.99), metrics_histogram_quantile(histogram, &zero, 0.999),
+           (unsigned long)histogram->max);
+}
+
+int main(int argc, char ** const argv) {
+    /* do some silly stuff to get a progname regardless of runtime environment */
+    const char * s, * progname = argc ? ((s = strrchr(argv[0], '/')) ? s + 1 : argv[0]) : __func__;
+
+    const double seconds = argc > 1 ? strtod(argv[1], NULL) : 1.0;
+    cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    const unsigned readers_max = argc > 2 ? strtoul(argv[2], NULL, 10) : (cpu_count > 2 ? (unsigned)cpu_count - 1 : 2);
+    if (!readers_max || readers_max > READERS_MAX) NOPE("%s: max readers must be between 1 and %d\n", progname, READERS_MAX);
+
+    char name[64];
+    snprintf(name, sizeof(name), "/shm_bench.%ld", (long)getpid());
+
+    struct shared * shared = mmap(NULL, sizeof(struct shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == shared) NOPE("%s: mmap(): %s\n", progname, strerror(errno));
+
+    pin_to_cpu(0);
+
+    fprintf(stderr, "%s: %ld cpus, %g s per test, up to %u readers, ring buffer of %u bytes\n", progname, cpu_count, seconds, readers_max, RING_SIZE);
+
+    /* writer throughput vs packet size, with no readers */
+    for (size_t packet_size = 16; packet_size <= PACKET_SIZE_MAX - 16; packet_size *= 4) {
+        struct shared_memory_ringbuffer * shm = shared_memory_ringbuffer_writer_init(name, RING_SIZE, PACKET_SIZE_MAX, 0);
+        if (!shm) NOPE("%s: could not create \"%s\"\n", progname, name);
+
+        const unsigned long long time_start = monotonic_nanoseconds();
+        const unsigned long packets = write_packets(shm, packet_size, 0, seconds, 0);
+        const double elapsed = (monotonic_nanoseconds() - time_start) * 1e-9;
+        shared_memory_ringbuffer_writer_close(shm);
+
+        printf("{\"test\": \"writer_throughput\", \"packet_size\": %zu, \"packets_per_second\": %.0f, \"bytes_per_second\": %.0f, \"ns_per_packet\": %.1f}\n",
+               packet_size, packets / elapsed, packets * packet_size / elapsed, elapsed * 1e9 / packets);
+        fflush(stdout);
+    }
+
+    /* reader throughput and completeness with 1..N readers, writer unpaced */
+    for (unsigned readers = 1; readers <= readers_max; readers++) {
+        const size_t packet_size = 1024;
+        struct shared_memory_ringbuffer * shm = shared_memory_ringbuffer_writer_init(name, RING_SIZE, PACKET_SIZE_MAX, 0);
+        if (!shm) NOPE("%s: could not create \"%s\"\n", progname, name);
+
+        start_readers(name, shared, readers, (struct reader_options) { 0 });
+        const unsigned long long time_start = monotonic_nanoseconds();
+        const unsigned long packets = write_packets(shm, packet_size, 0, seconds, 0);
+        const double elapsed = (monotonic_nanoseconds() - time_start) * 1e-9;
+        shared_memory_ringbuffer_writer_close(shm);
+        wait_for_readers();
+
+        for (unsigned ireader = 0; ireader < readers; ireader++) {
+            const struct reader_result * result = shared->results + ireader;
+            printf("{\"test\": \"reader_throughput\", \"cpus\": %ld, \"readers\": %u, \"reader\": %u, \"packet_size\": %zu, \"writer_packets_per_second\": %.0f, "
+                   "\"packets_per_second\": %.0f, \"bytes_per_second\": %.0f, \"fraction_received\": %.4f, \"lapped\": %lu}\n",
+                   cpu_count, readers, ireader, packet_size, packets / elapsed, result->packets / result->seconds, result->bytes / result->seconds,
+                   (double)result->packets / packets, result->lapped);
+        }
+        fflush(stdout);
+    }
+
+    /* laps per second for one reader which stalls every 100 ms, writer paced at 100 MB/s,
+     such that the 4 MiB ring buffer holds about 40 ms */
+    static const unsigned stalls_ms[] = { 1, 10, 30, 50, 100 };
+    for (size_t istall = 0; istall < sizeof(stalls_ms) / sizeof(stalls_ms[0]); istall++) {
+        const double bytes_per_second = 100e6;
+        struct shared_memory_ringbuffer * shm = shared_memory_ringbuffer_writer_init(name, RING_SIZE, PACKET_SIZE_MAX, 0);
+        if (!shm) NOPE("%s: could not create \"%s\"\n", progname, name);
+
+        start_readers(name, shared, 1, (struct reader_options) { .stall_interval_ns = 100000000ULL, .stall_ns = stalls_ms[istall] * 1000000ULL });
+        const unsigned long packets = write_packets(shm, 1024, bytes_per_second, seconds, 0);
+        shared_memory_ringbuffer_writer_close(shm);
+        wait_for_readers();
+
+        printf("{\"test\": \"stall_laps\", \"stall_ms\": %u, \"stall_interval_ms\": 100, \"writer_bytes_per_second\": %.0f, "
+               "\"laps_per_second\": %.2f, \"fraction_received\": %.4f}\n",
+               stalls_ms[istall], bytes_per_second, shared->results[0].lapped / shared->results[0].seconds, (double)shared->results[0].packets / packets);
+        fflush(stdout);
+    }
+
+    /* latency from send to receive, for a polling reader and a writer sending 64-byte packets
+     every 100 us, with the send time in each packet */
+    {
+        struct shared_memory_ringbuffer * shm = shared_memory_ringbuffer_writer_init(name, RING_SIZE, PACKET_SIZE_MAX, 0);
+        if (!shm) NOPE("%s: could not create \"%s\"\n", progname, name);
+
+        start_readers(name, shared, 1, (struct reader_options) { .timed = 1 });
+        write_packets(shm, 64, 640000.0, seconds, 1);
+        shared_memory_ringbuffer_writer_close(shm);
+        wait_for_readers();
+
+        printf("{\"test\": \"notification_latency\", \"packet_size\": 64, \"packets\": %lu, ", shared->results[0].packets);
+        print_latency_quantiles(&shared->results[0].latency);
+        printf("}\n");
+    }
+
+    shm_unlink(name);
+    char name_readers[80];
+    snprintf(name_readers, sizeof(name_readers), "%s.readers", name);
+    shm_unlink(name_readers);
+    munmap(shared, sizeof(struct shared));
+}
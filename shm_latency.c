@@ -0,0 +1,184 @@
+/* benchmark reader which measures, for each packet, the time between the host timestamp in
+ its logging header and this reader seeing it, and for acoustic packets, the time between the
+ end of the packet according to the device timestamp and the host timestamp, such that usb
+ batching and decoding latency can be distinguished from ring buffer polling latency */
+#include "shared_memory_ringbuffer.h"
+#include "metrics.h"
+#include "acoustic_packet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+/* useful macros */
+#define WARNING_ANSI "\x1B[35;1mwarning:\x1B[0m"
+#define ERROR_ANSI "\x1B[31;1merror:\x1B[0m"
+#define NOPE(...) do { fprintf(stderr, ERROR_ANSI " " __VA_ARGS__); exit(EXIT_FAILURE); } while(0)
+
+static unsigned long long current_time_in_unix_microseconds(void) {
+    struct timespec timespec;
+    clock_gettime(CLOCK_REALTIME, &timespec);
+    return timespec.tv_sec * 1000000ULL + timespec.tv_nsec / 1000UL;
+}
+
+static volatile sig_atomic_t got_sigterm_or_sigint = 0;
+
+static void sigint_handler(int sig) {
+    (void)sig;
+    got_sigterm_or_sigint = 1;
+}
+
+/* the histograms live in this process only, but reuse the layout and quantile logic of the
+ ones published in the metrics segments */
+struct latencies {
+    /* host timestamp to this reader returning from recv(), in microseconds */
+    struct metrics_histogram host_to_reader;
+
+    /* last sample of each acoustic packet according to the device, to host timestamp */
+    struct metrics_histogram device_to_host;
+
+    /* number of packets returned by each wakeup of this reader */
+    struct metrics_histogram packets_per_wakeup;
+
+    /* acoustic packets whose device timestamp was after their host timestamp */
+    unsigned long device_ahead_of_host;
+};
+
+static void print_histogram(const char * name, const char * units, const struct metrics_histogram * now, const struct metrics_histogram * before) {
+    unsigned long count = 0;
+    for (size_t ibucket = 0; ibucket < METRICS_HISTOGRAM_BUCKETS; ibucket++)
+        count += now->count[ibucket] - before->count[ibucket];
+    if (!count) return;
+
+    printf("    %s: %lu samples, mean %.1f, p50 %lu, p90 %lu, p99 %lu, p99.9 %lu %s, max since start %lu %s\n", name, count,
+           (double)(now->sum - before->sum) / count,
+           metrics_histogram_quantile(now, before, 0.5),
+           metrics_histogram_quantile(now, before, 0.9),
+           metrics_histogram_quantile(now, before, 0.99),
+           metrics_histogram_quantile(now, before, 0.999), units,
+           (unsigned long)now->max, units);
+}
+
+static void print_latencies(const struct latencies * now, const struct latencies * before) {
+    print_histogram("host timestamp to reader", "us", &now->host_to_reader, &before->host_to_reader);
+    print_histogram("device timestamp to host timestamp", "us", &now->device_to_host, &before->device_to_host);
+    print_histogram("packets per wakeup", "packets", &now->packets_per_wakeup, &before->packets_per_wakeup);
+    if (now->device_ahead_of_host != before->device_ahead_of_host)
+        printf("    %lu packets with device timestamp ahead of host timestamp\n", now->device_ahead_of_host - before->device_ahead_of_host);
+}
+
+int main(int argc, char ** const argv) {
+    /* do some silly stuff to get a progname regardless of runtime environment */
+    const char * s, * progname = argc ? ((s = strrchr(argv[0], '/')) ? s + 1 : argv[0]) : __func__;
+
+    const char * shm_name = argc > 1 ? argv[1] : "/cobs_to_shm";
+
+    /* how often to print the distributions for the preceding interval */
+    const double interval = argc > 2 ? strtod(argv[2], NULL) : 10.0;
+
+    /* fixed time to sleep between polls of the ring buffer when it is empty, which dominates
+     the host-to-reader latency and can be varied to see how much, or zero to busy-poll */
+    const useconds_t poll_microseconds = argc > 3 ? strtoul(argv[3], NULL, 10) : 1000;
+
+    /* install a signal handler so that we can stop cleanly on sigint or sigterm */
+    if (-1 == sigaction(SIGINT, &(struct sigaction) { .sa_handler = sigint_handler }, NULL) ||
+        -1 == sigaction(SIGTERM, &(struct sigaction) { .sa_handler = sigint_handler }, NULL))
+        NOPE("%s: sigaction(): %s\n", progname, strerror(errno));
+
+    struct shared_memory_ringbuffer_reader * shm = NULL;
+    char printed_not_ready = 0;
+
+    /* loop until the writer exists */
+    while (!(shm = shared_memory_ringbuffer_reader_init(shm_name))) {
+        if (!printed_not_ready) {
+            fprintf(stderr, "%s: waiting for \"%s\"\n", progname, shm_name);
+            printed_not_ready = 1;
+        }
+        usleep(50000);
+        if (got_sigterm_or_sigint) return 0;
+    }
+    if (MAP_FAILED == shm) NOPE("%s: could not open \"%s\"\n", progname, shm_name);
+
+    fprintf(stderr, "%s: connected, polling every %u us\n", progname, (unsigned)poll_microseconds);
+
+    static struct latencies now, before;
+    unsigned long long time_printed = current_time_in_unix_microseconds();
+
+    while (!got_sigterm_or_sigint) {
+        const void * packet_buffer_with_logging_header = NULL;
+        ssize_t status = shared_memory_ringbuffer_recv(&packet_buffer_with_logging_header, shm);
+
+        if (-1 == status) {
+            fprintf(stderr, "%s %s: reader failed to keep up with writer\n", ERROR_ANSI, progname);
+            break;
+        }
+        else if (!status) {
+            if (shared_memory_ringbuffer_eof(shm)) {
+                fprintf(stderr, "%s: writer has exited\n", progname);
+                break;
+            }
+            if (poll_microseconds) usleep(poll_microseconds);
+            continue;
+        }
+
+        /* the time of this wakeup is that of the first packet returned, and all packets which
+         are already available are consumed before sleeping again */
+        const unsigned long long time_woken = current_time_in_unix_microseconds();
+        unsigned long packets_this_wakeup = 0;
+
+        for (; status > 0; status = shared_memory_ringbuffer_recv(&packet_buffer_with_logging_header, shm)) {
+            const size_t packet_size_with_logging_header = status;
+            if (packet_size_with_logging_header < sizeof(uint64_t)) continue;
+
+            uint64_t logging_header;
+            memcpy(&logging_header, packet_buffer_with_logging_header, sizeof(uint64_t));
+
+            /* the logging header has 16 us resolution, so this is quantized accordingly */
+            const unsigned long long host_microseconds = (logging_header >> 16) * 16;
+            packets_this_wakeup++;
+
+            if (time_woken > host_microseconds)
+                metrics_histogram_record(&now.host_to_reader, time_woken - host_microseconds);
+            else
+                metrics_histogram_record(&now.host_to_reader, 0);
+
+            struct acoustic_packet_header header;
+            if (!acoustic_packet_parse(&header, (const unsigned char *)packet_buffer_with_logging_header + sizeof(uint64_t),
+                                       packet_size_with_logging_header - sizeof(uint64_t)) && header.sample_rate > 0) {
+                /* the device timestamp already marks the end of the packet */
+                const unsigned long long device_microseconds = header.timestamp_microseconds;
+
+                if (host_microseconds >= device_microseconds)
+                    metrics_histogram_record(&now.device_to_host, host_microseconds - device_microseconds);
+                else
+                    now.device_ahead_of_host++;
+            }
+        }
+
+        if (-1 == status || !shared_memory_ringbuffer_reader_has_kept_up(shm)) {
+            fprintf(stderr, "%s %s: reader failed to keep up with writer\n", ERROR_ANSI, progname);
+            break;
+        }
+
+        metrics_histogram_record(&now.packets_per_wakeup, packets_this_wakeup);
+
+        if (time_woken - time_printed >= interval * 1e6) {
+            printf("%s: %.1f s:\n", progname, (time_woken - time_printed) * 1e-6);
+            print_latencies(&now, &before);
+            fflush(stdout);
+            memcpy(&before, &now, sizeof(before));
+            time_printed = time_woken;
+        }
+    }
+
+    /* print the distributions over the whole run before exiting */
+    printf("%s: totals:\n", progname);
+    print_latencies(&now, &(struct latencies) { 0 });
+
+    shared_memory_ringbuffer_reader_close(shm);
+}
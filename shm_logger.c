@@ -1,4 +1,9 @@
+#define _GNU_SOURCE
 #include "shared_memory_ringbuffer.h"
+#include "metrics.h"
+#include "chunk_logger.h"
+#include "retention.h"
+#include "acoustic_packet.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,6 +19,12 @@
 #define NOPE(...) do { fprintf(stderr, ERROR_ANSI " " __VA_ARGS__); exit(EXIT_FAILURE); } while(0)
 #define alloc_sprintf(...) ({ char * _tmp; if (asprintf(&_tmp, __VA_ARGS__) <= 0) abort(); _tmp ; })
 
+static unsigned long long current_time_in_unix_microseconds(void) {
+    struct timespec timespec;
+    clock_gettime(CLOCK_REALTIME, &timespec);
+    return timespec.tv_sec * 1000000ULL + timespec.tv_nsec / 1000UL;
+}
+
 volatile sig_atomic_t got_sigterm_or_sigint = 0;
 
 static void sigint_handler(int sig) {
@@ -21,6 +32,30 @@ static void sigint_handler(int sig) {
     got_sigterm_or_sigint = 1;
 }
 
+volatile sig_atomic_t got_sigusr1 = 0;
+
+static void sigusr1_handler(int sig) {
+    (void)sig;
+    got_sigusr1 = 1;
+}
+
+static unsigned long long monotonic_microseconds(void) {
+    struct timespec timespec;
+    clock_gettime(CLOCK_MONOTONIC, &timespec);
+    return timespec.tv_sec * 1000000ULL + timespec.tv_nsec / 1000UL;
+}
+
+/* parse a size given as a plain number of bytes with an optional k, M, or G binary suffix */
+static size_t parse_size(const char * const text) {
+    char * end;
+    const unsigned long long value = strtoull(text, &end, 10);
+    const unsigned long long multiplier = ('k' == *end || 'K' == *end ? 1ULL << 10 :
+                                           'M' == *end ? 1ULL << 20 :
+                                           'G' == *end ? 1ULL << 30 : 1);
+    if (end == text || (*end && end[1]) || (*end && 1 == multiplier) || value * multiplier > SIZE_MAX) return 0;
+    return value * multiplier;
+}
+
 int main(int argc, char ** const argv) {
     /* do some silly stuff to get a progname regardless of runtime environment */
     const char * s, * progname = argc ? ((s = strrchr(argv[0], '/')) ? s + 1 : argv[0]) : __func__;
@@ -40,6 +75,10 @@ int main(int argc, char ** const argv) {
         -1 == sigaction(SIGTERM, &(struct sigaction) { .sa_handler = sigint_handler }, NULL))
         NOPE("%s: sigaction(): %s\n", progname, strerror(errno));
 
+    /* sigusr1 dumps latency histograms to stderr, and must not interrupt blocking reads */
+    if (-1 == sigaction(SIGUSR1, &(struct sigaction) { .sa_handler = sigusr1_handler, .sa_flags = SA_RESTART }, NULL))
+        NOPE("%s: sigaction(): %s\n", progname, strerror(errno));
+
     struct shared_memory_ringbuffer_reader * shm = NULL;
     char printed_not_ready = 0;
 
@@ -55,12 +94,73 @@ int main(int argc, char ** const argv) {
 
     fprintf(stderr, "%s: connected\n", progname);
 
+    /* losing data because the filesystem stalled is worse than delaying other readers, so
+     ask the writer not to overwrite anything we have not yet logged, if it supports that */
+    if (-1 == shared_memory_ringbuffer_reader_set_critical(shm, 1))
+        fprintf(stderr, WARNING_ANSI " %s: could not register as a critical reader\n", progname);
+
+    /* counters and histograms for monitoring via shm_prom. if this fails, carry on without */
+    struct metrics * metrics = metrics_create(shm_name, METRICS_SUFFIX_SHM_LOGGER);
+
+    /* histograms are printed for the values recorded since they were last printed */
+    const unsigned long long stats_interval_microseconds = strtoull(getenv("STATS_INTERVAL") ?: "600", NULL, 10) * 1000000ULL;
+    unsigned long long time_stats_printed = monotonic_microseconds();
+    char * stats_prefix = alloc_sprintf("%s: ", progname);
+    struct metrics * metrics_printed = metrics ? calloc(1, sizeof(*metrics)) : NULL;
+
     unsigned long usec_per_packet_num = 0, usec_per_packet_den = 0;
     unsigned long delay = 20000;
 
-    unsigned long long time_microseconds_file_start = 0;
-    FILE * fh = NULL;
-    char * path = NULL;
+    /* files are written via io_uring where available, unless LOGGING_IO_URING is zero.
+     LOGGING_STAGING_SIZE sets how much may be waiting to be written before this waits for the
+     filesystem, and LOGGING_DIRECT bypasses the page cache, allowing the logging path to be
+     on slow nonvolatile storage */
+    const size_t logging_staging_size = parse_size(getenv("LOGGING_STAGING_SIZE") ?: "16M");
+    if (!logging_staging_size) NOPE("%s: LOGGING_STAGING_SIZE must be a size in bytes\n", progname);
+
+    /* files end at multiples of CHUNK_DURATION seconds since the epoch, and once they would
+     exceed CHUNK_SIZE bytes, either of which may be zero for no limit */
+    const char * const chunk_duration_text = getenv("CHUNK_DURATION") ?: "10", * const chunk_size_text = getenv("CHUNK_SIZE") ?: "0";
+    char * chunk_duration_end;
+    const unsigned long long chunk_duration = strtoull(chunk_duration_text, &chunk_duration_end, 10);
+    const unsigned long long chunk_size = parse_size(chunk_size_text);
+    if (chunk_duration_end == chunk_duration_text || *chunk_duration_end) NOPE("%s: CHUNK_DURATION must be a whole number of seconds\n", progname);
+    if (!chunk_size && strcmp(chunk_size_text, "0")) NOPE("%s: CHUNK_SIZE must be a size in bytes\n", progname);
+    if (!chunk_duration && !chunk_size) NOPE("%s: CHUNK_DURATION and CHUNK_SIZE cannot both be zero\n", progname);
+
+    const unsigned logging_flags = (atoi(getenv("LOGGING_IO_URING") ?: "1") ? 0 : CHUNK_LOGGER_SYNCHRONOUS) |
+                                   (atoi(getenv("LOGGING_DIRECT") ?: "0") ? CHUNK_LOGGER_DIRECT : 0);
+
+    /* with LOGGING_SUMMARY, each file is accompanied by a small summary of its contents, such
+     that weeks of data can be overviewed without reading it */
+    const unsigned logging_summary = atoi(getenv("LOGGING_SUMMARY") ?: "0") ? CHUNK_LOGGER_SUMMARY : 0;
+
+    struct chunk_logger * logger = chunk_logger_open(logging_path, NULL, chunk_duration * 1000000ULL, chunk_size, logging_staging_size, logging_flags | logging_summary, metrics);
+    if (!logger) NOPE("%s: could not start logging to %s\n", progname, logging_path);
+
+    /* with LOGGING_SPLIT, only acoustic packets go to the usual files, and all others go to
+     files named as those but ending in .nonacoustic.bin, with the same chunk boundaries, so
+     that those sparse packets can be found without reading through all the acoustic data */
+    struct chunk_logger * logger_nonacoustic = NULL;
+    if (atoi(getenv("LOGGING_SPLIT") ?: "0") &&
+        !(logger_nonacoustic = chunk_logger_open(logging_path, "nonacoustic", chunk_duration * 1000000ULL, chunk_size, logging_staging_size, logging_flags, metrics)))
+        NOPE("%s: could not start logging to %s\n", progname, logging_path);
+
+    /* with RETENTION_FREE, the oldest completed files are removed as needed to keep that much
+     space free on the filesystem of the logging directory, and of RETENTION_PATH if given,
+     which is typically where completed files are moved to. with RETENTION_THIN, every other
+     file is removed instead, oldest first */
+    const char * const retention_free_text = getenv("RETENTION_FREE") ?: "0", * const retention_path = getenv("RETENTION_PATH");
+    const unsigned long long retention_free = parse_size(retention_free_text);
+    if (!retention_free && strcmp(retention_free_text, "0")) NOPE("%s: RETENTION_FREE must be a size in bytes\n", progname);
+    const unsigned retention_flags = atoi(getenv("RETENTION_THIN") ?: "0") ? RETENTION_THIN : 0;
+    if (retention_free) {
+        if (retention_path && -1 == chunk_logger_retain(logger, retention_path, retention_free, retention_flags))
+            NOPE("%s: cannot keep space free in %s\n", progname, retention_path);
+        if (-1 == chunk_logger_retain(logger, logging_path, retention_free, retention_flags))
+            NOPE("%s: cannot keep space free in %s\n", progname, logging_path);
+        if (logger_nonacoustic) chunk_logger_retain_alongside(logger_nonacoustic, logger);
+    }
 
     while (1) {
         unsigned long long packet_time_microseconds = 0;
@@ -95,6 +195,7 @@ int main(int argc, char ** const argv) {
 
         /* if we broke out of the above loop without a packet, we are eof or error */
         if (!packet_buffer_with_logging_header) break;
+        const unsigned long long time_received = monotonic_microseconds();
 
         if (usec_per_packet_num > 0 && usec_per_packet_den > 0) {
             delay = (3UL * delay + (usec_per_packet_num + usec_per_packet_den / 2UL) / usec_per_packet_den + 2UL) / 4UL;
@@ -122,39 +223,30 @@ int main(int argc, char ** const argv) {
             continue;
         }
 
-        const unsigned long long packet_time_microseconds_rounded_down_to_10s = packet_time_microseconds - (packet_time_microseconds % 10000000ULL);
-
-        /* if rounding down gives a time later than the file start time, we need to close
-         the old file and then create a new one in the next step */
-        if (fh && packet_time_microseconds_rounded_down_to_10s > time_microseconds_file_start) {
-            fclose(fh);
-            printf("%s\n", path);
-            free(path);
-            fh = NULL;
-        }
-
-        /* if we just closed the most recent file or haven't opened one yet, open a new one */
-        if (!fh && logging_path) {
-            /* construct timestamp in ISO 8601 format, no separators, rounded down to seconds */
-            struct tm unixtime_struct;
-            gmtime_r(&(time_t) { packet_time_microseconds / 1000000ULL }, &unixtime_struct);
-            char timestamp[17];
-            strftime(timestamp, 17, "%Y%m%dT%H%M%SZ", &unixtime_struct);
-
-            path = alloc_sprintf("%s/%s.bin", logging_path, timestamp);
-            fh = fopen(path, "w");
-            if (!fh) NOPE("%s: fopen(%s): %s\n", progname, path, strerror(errno));
-            time_microseconds_file_start = packet_time_microseconds;
-            /* would be nice to write to stderr here, but even logged writes to stderr can block */
+        if (metrics) {
+            metrics_add(&metrics->frames, 1);
+            metrics_add(&metrics->frame_bytes, packet_size);
         }
 
         /* round packet size up to the next multiple of 8, and write up to 7 bytes of
          padding, s.t. the next packet will be eight-byte-aligned within the output */
         const size_t packet_size_padded = (packet_size + 7) & ~7;
 
-        /* write the packet to the current output file */
-        if (fh && !fwrite(packet_buffer_with_logging_header, sizeof(uint64_t) + packet_size_padded, 1, fh))
-            NOPE("%s: fwrite(): %s\n", progname, strerror(errno));
+        /* append the packet to the current output file of its stream, starting a new one as
+         necessary, and finish that of the other stream at the same boundary */
+        const unsigned char * packet = (const unsigned char *)packet_buffer_with_logging_header + sizeof(uint64_t);
+        struct chunk_logger * logger_packet = logger_nonacoustic && (!packet_size || ACOUSTIC_PACKET_MAGIC != packet[0]) ? logger_nonacoustic : logger;
+        chunk_logger_write(logger_packet, packet_buffer_with_logging_header, sizeof(uint64_t) + packet_size_padded, packet_time_microseconds);
+        if (logger_nonacoustic) chunk_logger_advance(logger_packet == logger ? logger_nonacoustic : logger, packet_time_microseconds);
+
+        if (metrics) metrics_histogram_record(&metrics->output_latency, current_time_in_unix_microseconds() - packet_time_microseconds);
+
+        if (metrics_printed && (got_sigusr1 || (stats_interval_microseconds && time_received - time_stats_printed >= stats_interval_microseconds))) {
+            got_sigusr1 = 0;
+            time_stats_printed = time_received;
+            metrics_print_latencies(stderr, stats_prefix, metrics, metrics_printed);
+            memcpy(metrics_printed, metrics, sizeof(*metrics));
+        }
 
         /* ideally, call this AFTER doing whatever that reads the packet contents, BEFORE
          pushing any resulting data further downstream */
@@ -164,11 +256,14 @@ int main(int argc, char ** const argv) {
         }
     }
 
-    if (fh) {
-        fclose(fh);
-        printf("%s\n", path);
-        free(path);
-    }
+    /* finish writing and emit the last file, closing the logger which keeps space free last */
+    chunk_logger_close(logger_nonacoustic);
+    chunk_logger_close(logger);
+
+    if (metrics_printed) metrics_print_latencies(stderr, stats_prefix, metrics, metrics_printed);
+    free(metrics_printed);
+    free(stats_prefix);
 
+    metrics_close(metrics);
     shared_memory_ringbuffer_reader_close(shm);
 }
@@ -0,0 +1,320 @@
+/* exporter which periodically writes statistics about cobs_to_shm, shm_logger and the readers
+ of the shm ring buffer to a file in the prometheus text format, suitable for node_exporter's
+ textfile collector. the file is replaced atomically via rename(), so the collector never sees
+ a partially written file. in order to count seqnum gaps, this also consumes every packet from
+ the ring buffer as an ordinary (lossy) reader, looking only at the acoustic packet headers */
+#define _GNU_SOURCE
+#include "shared_memory_ringbuffer.h"
+#include "metrics.h"
+#include "acoustic_packet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <stddef.h>
+
+/* useful macros */
+#define WARNING_ANSI "\x1B[35;1mwarning:\x1B[0m"
+#define ERROR_ANSI "\x1B[31;1merror:\x1B[0m"
+#define NOPE(...) do { fprintf(stderr, ERROR_ANSI " " __VA_ARGS__); exit(EXIT_FAILURE); } while(0)
+
+static volatile sig_atomic_t got_sigterm_or_sigint = 0;
+
+static void sigint_handler(int sig) {
+    (void)sig;
+    got_sigterm_or_sigint = 1;
+}
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* state of the packet stream for each distinct channel count, which identifies the source */
+struct channel_group {
+    unsigned long packets;
+    unsigned long gaps;
+    unsigned long missing;
+    int seqnum_previous;
+};
+
+static void count_packet(struct channel_group groups[256], const unsigned char * packet_with_logging_header, const size_t size) {
+    if (size < sizeof(uint64_t)) return;
+
+    struct acoustic_packet_header header;
+    if (-1 == acoustic_packet_parse(&header, packet_with_logging_header + sizeof(uint64_t), size - sizeof(uint64_t))) return;
+
+    struct channel_group * group = groups + header.channels;
+    group->packets++;
+
+    if (group->seqnum_previous >= 0 && header.seqnum != ((group->seqnum_previous + 1) & 0xFFFF)) {
+        group->gaps++;
+        group->missing += (header.seqnum - group->seqnum_previous - 1) & 0xFFFF;
+    }
+    group->seqnum_previous = header.seqnum;
+}
+
+/* name of the process with the given pid, if it can be determined */
+static void process_name(char * name, const size_t size, const long pid) {
+    snprintf(name, size, "?");
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%ld/comm", pid);
+    FILE * fh = fopen(path, "r");
+    if (!fh) return;
+
+    if (fgets(name, size, fh)) name[strcspn(name, "\n\"\\")] = '\0';
+    fclose(fh);
+}
+
+/* names of the processes which publish metrics, and the corresponding segment suffixes */
+#define PROCESSES 2
+static const char * const process_names[PROCESSES] = { "cobs_to_shm", "shm_logger" };
+static const char * const process_suffixes[PROCESSES] = { METRICS_SUFFIX_COBS_TO_SHM, METRICS_SUFFIX_SHM_LOGGER };
+
+/* the text format requires every sample of a given metric to be contiguous, so each of these
+ writes one metric for all processes which are up */
+static void write_counter(FILE * fh, const char * name, const char * help,
+                          const struct metrics * metrics[PROCESSES], const size_t offset) {
+    fprintf(fh, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    for (size_t iprocess = 0; iprocess < PROCESSES; iprocess++)
+        if (metrics[iprocess])
+            fprintf(fh, "%s{process=\"%s\"} %lu\n", name, process_names[iprocess],
+                    (unsigned long)*(const _Atomic unsigned long *)((const char *)metrics[iprocess] + offset));
+}
+
+static void write_histogram(FILE * fh, const char * name, const char * help,
+                            const struct metrics * metrics[PROCESSES], const size_t offset) {
+    fprintf(fh, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    for (size_t iprocess = 0; iprocess < PROCESSES; iprocess++) {
+        if (!metrics[iprocess]) continue;
+        const struct metrics_histogram * histogram = (const void *)((const char *)metrics[iprocess] + offset);
+
+        unsigned long cumulative = 0;
+        for (size_t ibucket = 0; ibucket < METRICS_HISTOGRAM_BUCKETS; ibucket++) {
+            cumulative += histogram->count[ibucket];
+
+            /* to keep the number of series reasonable, only export the boundaries between
+             powers of two, rather than every log-linear bucket */
+            if (METRICS_HISTOGRAM_SUB_BUCKETS - 1 == ibucket % METRICS_HISTOGRAM_SUB_BUCKETS && ibucket + 1 < METRICS_HISTOGRAM_BUCKETS)
+                fprintf(fh, "%s_bucket{process=\"%s\",le=\"%g\"} %lu\n", name, process_names[iprocess],
+                        metrics_histogram_bucket_upper_bound(ibucket) * 1e-6, cumulative);
+        }
+        fprintf(fh, "%s_bucket{process=\"%s\",le=\"+Inf\"} %lu\n", name, process_names[iprocess], cumulative);
+        fprintf(fh, "%s_sum{process=\"%s\"} %.6f\n", name, process_names[iprocess], histogram->sum * 1e-6);
+        fprintf(fh, "%s_count{process=\"%s\"} %lu\n", name, process_names[iprocess], cumulative);
+    }
+}
+
+static void write_process_metrics(FILE * fh, const char * shm_name) {
+    const struct metrics * metrics[PROCESSES];
+
+    fprintf(fh, "# HELP cobs_to_shm_up Whether the process is running and publishing metrics\n# TYPE cobs_to_shm_up gauge\n");
+    for (size_t iprocess = 0; iprocess < PROCESSES; iprocess++) {
+        metrics[iprocess] = metrics_open(shm_name, process_suffixes[iprocess]);
+        const long pid = metrics[iprocess] ? metrics[iprocess]->writer_pid : 0;
+        const int up = pid && !(-1 == kill(pid, 0) && ESRCH == errno);
+
+        if (!up && metrics[iprocess]) {
+            metrics_unmap(metrics[iprocess]);
+            metrics[iprocess] = NULL;
+        }
+        fprintf(fh, "cobs_to_shm_up{process=\"%s\"} %d\n", process_names[iprocess], up);
+    }
+
+    fprintf(fh, "# HELP cobs_to_shm_start_time_seconds Unix time at which the process started\n# TYPE cobs_to_shm_start_time_seconds gauge\n");
+    for (size_t iprocess = 0; iprocess < PROCESSES; iprocess++)
+        if (metrics[iprocess])
+            fprintf(fh, "cobs_to_shm_start_time_seconds{process=\"%s\"} %.6f\n", process_names[iprocess], metrics[iprocess]->time_started * 1e-6);
+
+    write_counter(fh, "cobs_to_shm_frames_total", "Packets decoded from serial, or consumed from the ring buffer by shm_logger", metrics, offsetof(struct metrics, frames));
+    write_counter(fh, "cobs_to_shm_frame_bytes_total", "Total size of the above packets", metrics, offsetof(struct metrics, frame_bytes));
+    fprintf(fh, "# HELP cobs_to_shm_cobs_errors_total Frames discarded by the COBS decoder\n# TYPE cobs_to_shm_cobs_errors_total counter\n");
+    /* only cobs_to_shm does any decoding */
+    if (metrics[0])
+        fprintf(fh, "cobs_to_shm_cobs_errors_total{process=\"cobs_to_shm\",kind=\"missing_end_byte\"} %lu\n"
+                "cobs_to_shm_cobs_errors_total{process=\"cobs_to_shm\",kind=\"unexpected_zero_byte\"} %lu\n"
+                "cobs_to_shm_cobs_errors_total{process=\"cobs_to_shm\",kind=\"trailer_mismatch\"} %lu\n",
+                (unsigned long)metrics[0]->cobs_missing_end_byte, (unsigned long)metrics[0]->cobs_unexpected_zero_byte,
+                (unsigned long)metrics[0]->cobs_trailer_mismatch);
+    write_counter(fh, "cobs_to_shm_udp_packets_total", "Packets received via UDP", metrics, offsetof(struct metrics, udp_packets));
+    write_counter(fh, "cobs_to_shm_udp_bytes_total", "Total size of packets received via UDP", metrics, offsetof(struct metrics, udp_bytes));
+    write_counter(fh, "cobs_to_shm_logged_bytes_total", "Bytes of records accepted for logging, excluding those dropped", metrics, offsetof(struct metrics, bytes_logged));
+    write_counter(fh, "cobs_to_shm_logged_files_total", "Logged files completed", metrics, offsetof(struct metrics, files_logged));
+    write_counter(fh, "cobs_to_shm_logging_drops_total", "Packets not logged because the filesystem could not keep up", metrics, offsetof(struct metrics, logging_drops));
+    write_counter(fh, "cobs_to_shm_removed_files_total", "Logged files removed to keep space free", metrics, offsetof(struct metrics, files_removed));
+    write_counter(fh, "cobs_to_shm_time_jumps_backwards_total", "Times the system clock was seen to jump backwards", metrics, offsetof(struct metrics, time_jumps_backwards));
+    write_histogram(fh, "cobs_to_shm_output_latency_seconds", "Time between each packet being timestamped and being fully output", metrics, offsetof(struct metrics, output_latency));
+    write_histogram(fh, "cobs_to_shm_receive_to_publish_seconds", "Time between the read of each packet returning and it being sent to the ring buffer", metrics, offsetof(struct metrics, receive_to_publish));
+    write_histogram(fh, "cobs_to_shm_publish_to_disk_seconds", "Time between the host timestamp of the first packet in each staging block and the block having been written to disk", metrics, offsetof(struct metrics, publish_to_disk));
+    write_histogram(fh, "cobs_to_shm_rotation_latency_seconds", "Time taken to close each logged file and open the next", metrics, offsetof(struct metrics, rotation_latency));
+
+    for (size_t iprocess = 0; iprocess < PROCESSES; iprocess++)
+        if (metrics[iprocess]) metrics_unmap(metrics[iprocess]);
+}
+
+static void write_prom_file(const char * path, const char * shm_name, struct shared_memory_ringbuffer_reader * shm,
+                            const struct channel_group groups[256], const unsigned long exporter_lapped) {
+    char * path_tmp = NULL;
+    if (asprintf(&path_tmp, "%s.%ld.tmp", path, (long)getpid()) <= 0) abort();
+
+    FILE * fh = fopen(path_tmp, "w");
+    if (!fh) NOPE("fopen(%s): %s\n", path_tmp, strerror(errno));
+
+    write_process_metrics(fh, shm_name);
+
+    if (shm) {
+        struct shared_memory_ringbuffer_reader_status statuses[64];
+        const size_t count = shared_memory_ringbuffer_reader_list_readers(shm, statuses, 64);
+        const long pid_self = getpid();
+
+        /* this exporter is itself a registered reader, whose laps are reported separately below */
+        unsigned long lapped_self = 0;
+        for (size_t ireader = 0; ireader < count; ireader++)
+            if (statuses[ireader].pid == pid_self) lapped_self = statuses[ireader].lapped;
+
+        fprintf(fh, "# HELP cobs_to_shm_readers_lapped_total Times any registered reader other than this exporter has been lapped by the writer\n# TYPE cobs_to_shm_readers_lapped_total counter\n");
+        fprintf(fh, "cobs_to_shm_readers_lapped_total %lu\n", shared_memory_ringbuffer_readers_lapped(shm) - lapped_self);
+        fprintf(fh, "# HELP cobs_to_shm_critical_drops_total Packets dropped because a critical reader fell too far behind\n# TYPE cobs_to_shm_critical_drops_total counter\n");
+        fprintf(fh, "cobs_to_shm_critical_drops_total %lu\n", shared_memory_ringbuffer_critical_drops(shm));
+        fprintf(fh, "# HELP cobs_to_shm_overflow_bytes Packets currently queued by the writer on behalf of critical readers\n# TYPE cobs_to_shm_overflow_bytes gauge\n");
+        fprintf(fh, "cobs_to_shm_overflow_bytes %zu\n", shared_memory_ringbuffer_overflow_bytes(shm));
+
+        /* each metric for every reader, such that samples of each metric are contiguous */
+        static const char * const reader_metrics[] = { "lag_bytes", "capacity_bytes", "idle_seconds", "lapped_total" };
+        static const char * const reader_helps[] = { "Bytes between the reader and the writer", "Lag at which the reader would be lapped",
+                                                     "Time since the reader last called recv()", "Times the reader has been lapped" };
+        for (size_t imetric = 0; imetric < 4; imetric++) {
+            fprintf(fh, "# HELP cobs_to_shm_reader_%s %s\n# TYPE cobs_to_shm_reader_%s %s\n", reader_metrics[imetric], reader_helps[imetric],
+                    reader_metrics[imetric], 3 == imetric ? "counter" : "gauge");
+
+            for (size_t ireader = 0; ireader < count; ireader++) {
+                const struct shared_memory_ringbuffer_reader_status * status = statuses + ireader;
+                if (status->pid == pid_self) continue;
+
+                char name[32];
+                process_name(name, sizeof(name), status->pid);
+
+                fprintf(fh, "cobs_to_shm_reader_%s{pid=\"%ld\",name=\"%s\"} ", reader_metrics[imetric], status->pid, name);
+                if (0 == imetric) fprintf(fh, "%zu\n", status->lag);
+                else if (1 == imetric) fprintf(fh, "%zu\n", status->capacity);
+                else if (2 == imetric) fprintf(fh, "%.3f\n", status->heartbeat_age_ms * 1e-3);
+                else fprintf(fh, "%lu\n", status->lapped);
+            }
+        }
+    }
+
+    fprintf(fh, "# HELP cobs_to_shm_exporter_lapped_total Times this exporter has been lapped, during which seqnum gaps were not counted\n# TYPE cobs_to_shm_exporter_lapped_total counter\n");
+    fprintf(fh, "cobs_to_shm_exporter_lapped_total %lu\n", exporter_lapped);
+
+    /* packets from each source are distinguished by their channel count */
+    static const char * const group_metrics[] = { "acoustic_packets_total", "seqnum_gaps_total", "seqnum_missing_packets_total" };
+    static const char * const group_helps[] = { "Acoustic packets seen by the exporter", "Discontinuities in the packet sequence number",
+                                                "Packets missing according to the sequence number" };
+    for (size_t imetric = 0; imetric < 3; imetric++) {
+        fprintf(fh, "# HELP cobs_to_shm_%s %s\n# TYPE cobs_to_shm_%s counter\n", group_metrics[imetric], group_helps[imetric], group_metrics[imetric]);
+        for (size_t channels = 1; channels < 256; channels++) {
+            const struct channel_group * group = groups + channels;
+            if (!group->packets) continue;
+            fprintf(fh, "cobs_to_shm_%s{channels=\"%zu\"} %lu\n", group_metrics[imetric], channels,
+                    0 == imetric ? group->packets : 1 == imetric ? group->gaps : group->missing);
+        }
+    }
+
+    if (fclose(fh)) NOPE("fclose(%s): %s\n", path_tmp, strerror(errno));
+    if (-1 == rename(path_tmp, path)) NOPE("rename(%s): %s\n", path, strerror(errno));
+    free(path_tmp);
+}
+
+int main(int argc, char ** const argv) {
+    /* do some silly stuff to get a progname regardless of runtime environment */
+    const char * s, * progname = argc ? ((s = strrchr(argv[0], '/')) ? s + 1 : argv[0]) : __func__;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s /var/lib/node_exporter/textfile_collector/cobs_to_shm.prom [shm_name] [interval_seconds]\n", progname);
+        exit(EXIT_FAILURE);
+    }
+
+    const char * path = argv[1];
+    const char * shm_name = argc > 2 ? argv[2] : "/cobs_to_shm";
+    const double interval = argc > 3 ? strtod(argv[3], NULL) : 15.0;
+
+    /* install a signal handler so that we can stop cleanly on sigint or sigterm */
+    if (-1 == sigaction(SIGINT, &(struct sigaction) { .sa_handler = sigint_handler }, NULL) ||
+        -1 == sigaction(SIGTERM, &(struct sigaction) { .sa_handler = sigint_handler }, NULL))
+        NOPE("%s: sigaction(): %s\n", progname, strerror(errno));
+
+    struct channel_group groups[256];
+    for (size_t channels = 0; channels < 256; channels++)
+        groups[channels] = (struct channel_group) { .seqnum_previous = -1 };
+
+    unsigned long exporter_lapped = 0;
+    struct shared_memory_ringbuffer_reader * shm = NULL;
+    double time_written = 0;
+
+    /* keep exporting across restarts of cobs_to_shm, reporting it as down in between */
+    while (!got_sigterm_or_sigint) {
+        if (!shm) {
+            shm = shared_memory_ringbuffer_reader_init(shm_name);
+            if (MAP_FAILED == (void *)shm) exit(EXIT_FAILURE);
+        }
+
+        if (shm) {
+            /* consume everything sent since the last time, looking only at packet headers */
+            while (1) {
+                const void * ptrs[256];
+                size_t sizes[256];
+                const ssize_t ret = shared_memory_ringbuffer_recv_batch(ptrs, sizes, 256, shm);
+                if (ret <= 0) {
+                    /* if we fell behind, skip to the live head, and forget the previous seqnums
+                     so that packets we did not see are not counted as gaps */
+                    if (-1 == ret) {
+                        exporter_lapped++;
+                        shared_memory_ringbuffer_reader_rewind(shm, 0);
+                        for (size_t channels = 0; channels < 256; channels++)
+                            groups[channels].seqnum_previous = -1;
+                    }
+                    break;
+                }
+
+                struct channel_group groups_batch[256];
+                memcpy(groups_batch, groups, sizeof(groups));
+                for (ssize_t ipacket = 0; ipacket < ret; ipacket++)
+                    count_packet(groups_batch, ptrs[ipacket], sizes[ipacket]);
+
+                /* only accept what we counted if none of it can have been overwritten */
+                if (!shared_memory_ringbuffer_reader_has_kept_up(shm)) {
+                    exporter_lapped++;
+                    shared_memory_ringbuffer_reader_rewind(shm, 0);
+                    for (size_t channels = 0; channels < 256; channels++)
+                        groups[channels].seqnum_previous = -1;
+                    break;
+                }
+                memcpy(groups, groups_batch, sizeof(groups));
+            }
+        }
+
+        const double time_now = monotonic_seconds();
+        if (time_now - time_written >= interval) {
+            write_prom_file(path, shm_name, shm, groups, exporter_lapped);
+            time_written = time_now;
+        }
+
+        if (shm && shared_memory_ringbuffer_eof(shm)) {
+            shared_memory_ringbuffer_reader_close(shm);
+            shm = NULL;
+            for (size_t channels = 0; channels < 256; channels++)
+                groups[channels].seqnum_previous = -1;
+        }
+
+        /* poll often enough to keep up with a ring buffer holding a fraction of a second */
+        usleep(50000);
+    }
+
+    if (shm) shared_memory_ringbuffer_reader_close(shm);
+}
@@ -0,0 +1,112 @@
+/* monitoring tool which lists the readers registered with a shm ring buffer, and how close
+ each is to being lapped by the writer, in bytes and in milliseconds at the current rate */
+#include "shared_memory_ringbuffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+/* useful macros */
+#define WARNING_ANSI "\x1B[35;1mwarning:\x1B[0m"
+#define ERROR_ANSI "\x1B[31;1merror:\x1B[0m"
+#define NOPE(...) do { fprintf(stderr, ERROR_ANSI " " __VA_ARGS__); exit(EXIT_FAILURE); } while(0)
+
+static volatile sig_atomic_t got_sigterm_or_sigint = 0;
+
+static void sigint_handler(int sig) {
+    (void)sig;
+    got_sigterm_or_sigint = 1;
+}
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* name of the process with the given pid, if it can be determined */
+static void process_name(char * name, const size_t size, const long pid) {
+    snprintf(name, size, "?");
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%ld/comm", pid);
+    FILE * fh = fopen(path, "r");
+    if (!fh) return;
+
+    if (fgets(name, size, fh)) name[strcspn(name, "\n")] = '\0';
+    fclose(fh);
+}
+
+int main(int argc, char ** const argv) {
+    /* do some silly stuff to get a progname regardless of runtime environment */
+    const char * s, * progname = argc ? ((s = strrchr(argv[0], '/')) ? s + 1 : argv[0]) : __func__;
+
+    const char * shm_name = argc > 1 ? argv[1] : "/cobs_to_shm";
+    const double interval = argc > 2 ? strtod(argv[2], NULL) : 1.0;
+
+    /* install a signal handler so that we can stop cleanly on sigint or sigterm */
+    if (-1 == sigaction(SIGINT, &(struct sigaction) { .sa_handler = sigint_handler }, NULL) ||
+        -1 == sigaction(SIGTERM, &(struct sigaction) { .sa_handler = sigint_handler }, NULL))
+        NOPE("%s: sigaction(): %s\n", progname, strerror(errno));
+
+    struct shared_memory_ringbuffer_reader * shm = NULL;
+    char printed_not_ready = 0;
+
+    /* loop until the writer exists */
+    while (!(shm = shared_memory_ringbuffer_reader_init(shm_name))) {
+        if (!printed_not_ready) {
+            fprintf(stderr, "%s: waiting for \"%s\"\n", progname, shm_name);
+            printed_not_ready = 1;
+        }
+        usleep(50000);
+        if (got_sigterm_or_sigint) return 0;
+    }
+    if (MAP_FAILED == shm) NOPE("%s: could not open \"%s\"\n", progname, shm_name);
+
+    /* this never consumes anything, so must not appear as a reader, let alone a lapped one */
+    shared_memory_ringbuffer_reader_unregister(shm);
+
+    size_t bytes_prev = shared_memory_ringbuffer_bytes_sent(shm);
+    double time_prev = monotonic_seconds();
+
+    while (!got_sigterm_or_sigint && !shared_memory_ringbuffer_eof(shm)) {
+        usleep(interval * 1e6);
+
+        /* the writer's data rate, from how far its cursor has moved since the last time, which
+         is exact however much the ring buffer has wrapped in between */
+        const size_t bytes_now = shared_memory_ringbuffer_bytes_sent(shm);
+        const size_t bytes = bytes_now - bytes_prev;
+        bytes_prev = bytes_now;
+
+        const double time_now = monotonic_seconds();
+        const double bytes_per_second = bytes / (time_now - time_prev);
+        time_prev = time_now;
+
+        struct shared_memory_ringbuffer_reader_status statuses[64];
+        const size_t count = shared_memory_ringbuffer_reader_list_readers(shm, statuses, 64);
+
+        printf("%.0f bytes/s, %lu laps detected by readers, %lu packets dropped for critical readers, %zu bytes queued\n",
+               bytes_per_second, shared_memory_ringbuffer_readers_lapped(shm),
+               shared_memory_ringbuffer_critical_drops(shm), shared_memory_ringbuffer_overflow_bytes(shm));
+        printf("%8s %-16s %12s %6s %10s %10s %8s\n", "pid", "name", "lag bytes", "lag %", "lag ms", "idle ms", "lapped");
+
+        for (size_t ireader = 0; ireader < count; ireader++) {
+            const struct shared_memory_ringbuffer_reader_status * status = statuses + ireader;
+            char name[32];
+            process_name(name, sizeof(name), status->pid);
+
+            printf("%8ld %-16s %12zu %5.1f%% %10.0f %10lu %8lu%s\n", status->pid, name, status->lag,
+                   100.0 * status->lag / status->capacity,
+                   bytes_per_second > 0 ? status->lag * 1e3 / bytes_per_second : 0.0,
+                   status->heartbeat_age_ms, status->lapped,
+                   status->critical ? " (critical)" : status->lag * 4 > status->capacity * 3 ? " " WARNING_ANSI " close to being lapped" : "");
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    shared_memory_ringbuffer_reader_close(shm);
+}
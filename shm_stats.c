@@ -0,0 +1,102 @@
+/* monitoring tool which periodically prints rates and latency percentiles from the metrics
+ published by cobs_to_shm alongside its shm ring buffer */
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+/* useful macros */
+#define WARNING_ANSI "\x1B[35;1mwarning:\x1B[0m"
+#define ERROR_ANSI "\x1B[31;1merror:\x1B[0m"
+#define NOPE(...) do { fprintf(stderr, ERROR_ANSI " " __VA_ARGS__); exit(EXIT_FAILURE); } while(0)
+
+static volatile sig_atomic_t got_sigterm_or_sigint = 0;
+
+static void sigint_handler(int sig) {
+    (void)sig;
+    got_sigterm_or_sigint = 1;
+}
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int writer_is_alive(const struct metrics * metrics) {
+    const long pid = metrics->writer_pid;
+    return pid && !(-1 == kill(pid, 0) && ESRCH == errno);
+}
+
+int main(int argc, char ** const argv) {
+    /* do some silly stuff to get a progname regardless of runtime environment */
+    const char * s, * progname = argc ? ((s = strrchr(argv[0], '/')) ? s + 1 : argv[0]) : __func__;
+
+    const char * shm_name = argc > 1 ? argv[1] : "/cobs_to_shm";
+    const double interval = argc > 2 ? strtod(argv[2], NULL) : 1.0;
+
+    /* install a signal handler so that we can stop cleanly on sigint or sigterm */
+    if (-1 == sigaction(SIGINT, &(struct sigaction) { .sa_handler = sigint_handler }, NULL) ||
+        -1 == sigaction(SIGTERM, &(struct sigaction) { .sa_handler = sigint_handler }, NULL))
+        NOPE("%s: sigaction(): %s\n", progname, strerror(errno));
+
+    const struct metrics * metrics = NULL;
+    char printed_not_ready = 0;
+
+    /* loop until the writer exists */
+    while (!(metrics = metrics_open(shm_name, METRICS_SUFFIX_COBS_TO_SHM)) || !writer_is_alive(metrics)) {
+        if (metrics) metrics_unmap(metrics);
+        if (!printed_not_ready) {
+            fprintf(stderr, "%s: waiting for \"%s.metrics\"\n", progname, shm_name);
+            printed_not_ready = 1;
+        }
+        usleep(50000);
+        if (got_sigterm_or_sigint) return 0;
+    }
+
+    struct metrics before;
+    memcpy(&before, metrics, sizeof(before));
+    double time_before = monotonic_seconds();
+
+    while (!got_sigterm_or_sigint && writer_is_alive(metrics)) {
+        usleep(interval * 1e6);
+
+        struct metrics now;
+        memcpy(&now, metrics, sizeof(now));
+        const double time_now = monotonic_seconds();
+        const double elapsed = time_now - time_before;
+
+        const unsigned long cobs_errors = (now.cobs_missing_end_byte - before.cobs_missing_end_byte) +
+                                          (now.cobs_unexpected_zero_byte - before.cobs_unexpected_zero_byte) +
+                                          (now.cobs_trailer_mismatch - before.cobs_trailer_mismatch);
+
+        printf("%.1f frames/s, %.0f B/s in, %.1f udp/s, %.0f B/s logged, %lu files, %lu removed, %lu not logged, %lu cobs errors, %lu time jumps\n",
+               (now.frames - before.frames) / elapsed,
+               (now.frame_bytes - before.frame_bytes + now.udp_bytes - before.udp_bytes) / elapsed,
+               (now.udp_packets - before.udp_packets) / elapsed,
+               (now.bytes_logged - before.bytes_logged) / elapsed,
+               now.files_logged - before.files_logged,
+               now.files_removed - before.files_removed,
+               now.logging_drops - before.logging_drops,
+               cobs_errors,
+               now.time_jumps_backwards - before.time_jumps_backwards);
+        metrics_print_latencies(stdout, "    ", &now, &before);
+
+        if (cobs_errors)
+            fprintf(stderr, WARNING_ANSI " %s: %lu missing end bytes, %lu unexpected zero bytes, %lu crc mismatches\n", progname,
+                    now.cobs_missing_end_byte - before.cobs_missing_end_byte,
+                    now.cobs_unexpected_zero_byte - before.cobs_unexpected_zero_byte,
+                    now.cobs_trailer_mismatch - before.cobs_trailer_mismatch);
+
+        fflush(stdout);
+        memcpy(&before, &now, sizeof(before));
+        time_before = time_now;
+    }
+
+    metrics_unmap(metrics);
+}
@@ -8,12 +8,19 @@
 #include <signal.h>
 #include <errno.h>
 #include <stdint.h>
+#include <time.h>
 
 /* useful macros */
 #define WARNING_ANSI "\x1B[35;1mwarning:\x1B[0m"
 #define ERROR_ANSI "\x1B[31;1merror:\x1B[0m"
 #define NOPE(...) do { fprintf(stderr, ERROR_ANSI " " __VA_ARGS__); exit(EXIT_FAILURE); } while(0)
 
+static unsigned long long current_time_in_unix_microseconds(void) {
+    struct timespec timespec;
+    clock_gettime(CLOCK_REALTIME, &timespec);
+    return timespec.tv_sec * 1000000ULL + timespec.tv_nsec / 1000UL;
+}
+
 static volatile sig_atomic_t got_sigterm_or_sigint = 0;
 
 static void sigint_handler(int sig) {
@@ -27,6 +34,11 @@ int main(int argc, char ** const argv) {
 
     const char * shm_name = argc > 1 ? argv[1] : "/cobs_to_shm";
 
+    /* optionally start from already-sent packets rather than the live head, e.g. to prime the
+     filter state of a restarted detector, given as a number of bytes, or a number of seconds
+     with an "s" suffix */
+    const char * backfill = argc > 2 ? argv[2] : NULL;
+
     /* ensure that stdout will be unbuffered */
     setvbuf(stdout, NULL, _IONBF, 0);
 
@@ -50,6 +62,35 @@ int main(int argc, char ** const argv) {
 
     fprintf(stderr, "%s: connected\n", progname);
 
+    if (backfill) {
+        const size_t length = strlen(backfill);
+        const int in_seconds = length && 's' == backfill[length - 1];
+        char * end;
+        ssize_t rewound;
+        errno = 0;
+
+        if (in_seconds) {
+            /* anything further back than the epoch just means the oldest packet available */
+            const double seconds = strtod(backfill, &end);
+            if (end == backfill || end != backfill + length - 1 || !(seconds >= 0) || ERANGE == errno)
+                NOPE("%s: could not parse backfill \"%s\"\n", progname, backfill);
+
+            const unsigned long long now = current_time_in_unix_microseconds();
+            const unsigned long long time = seconds * 1e6 >= now ? 0 : now - (unsigned long long)(seconds * 1e6);
+            rewound = shared_memory_ringbuffer_reader_seek_time(shm, time);
+        } else {
+            /* strtoull() would silently negate a leading minus sign */
+            const unsigned long long bytes = strtoull(backfill, &end, 10);
+            if (end == backfill || *end || strchr(backfill, '-') || ERANGE == errno)
+                NOPE("%s: could not parse backfill \"%s\"\n", progname, backfill);
+
+            rewound = shared_memory_ringbuffer_reader_rewind(shm, bytes > SIZE_MAX ? SIZE_MAX : (size_t)bytes);
+        }
+
+        if (-1 == rewound) NOPE("%s: reader failed to keep up with writer while rewinding\n", progname);
+        fprintf(stderr, "%s: rewound %zd bytes\n", progname, rewound);
+    }
+
     unsigned long usec_per_packet_num = 0, usec_per_packet_den = 0;
     unsigned long delay = 20000;
 
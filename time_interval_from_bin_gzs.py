@@ -1,6 +1,9 @@
 #!/usr/bin/env python3
 # given a directory of .bin.gz files and timestamp range, emit the desired range on stdout
+# optionally given a stream, such as nonacoustic, emit from the .<stream>.bin.gz files instead
+# the files to read are found via chunk_catalog.py, which catalogs their times without decompressing them
 import sys, struct, datetime, gzip, os
+from chunk_catalog import chunks_overlapping
 
 def string_to_unix_time_in_microseconds(s):
     if 'T' in s and 'Z' in s:
@@ -12,10 +15,12 @@ desired_start = None
 desired_stop = None
 duration = None
 path = None
+stream = None
 
 # loop over pairs of arguments
 for key, value in zip(sys.argv[1::2], sys.argv[2::2]):
     if key == 'path': path = value
+    if key == 'stream': stream = value
     if key == 'start': desired_start = string_to_unix_time_in_microseconds(value)
     if key == 'stop': desired_stop = string_to_unix_time_in_microseconds(value)
     if key == 'duration': duration = round(float(value) * 1e6)
@@ -27,37 +32,13 @@ if duration is not None:
         desired_start = desired_stop - duration
     else: desired_stop = desired_start + duration
 
-directory = os.fsencode(path)
-
-files = []
-
-# determine the start times of every .bin.gz file in the directory
-# this can take a long time if the beginnings of every file are not yet in the page cache
-for file in sorted(os.listdir(directory)):
-    filename = os.fsdecode(file)
-    if not '.bin.gz' in filename: continue
-
-    with gzip.open(os.path.join(directory, file), 'r') as f:
-        first_eight_bytes = f.peek(8)[0:8]
-
-    # interpret these eight bytes as a 16-bit packet size and 48-bit timestamp
-    _, timestamp_lsbs, timestamp_msbs = struct.unpack('<HHI', first_eight_bytes)
-
-    first_packet_time = (timestamp_lsbs | (timestamp_msbs << 16)) * 16
-
-    files.append((file, first_packet_time))
-
-# loop over all the files
-for ifile in range(len(files)):
-    file, file_start = files[ifile]
-    file_stop = files[ifile + 1][1] if ifile + 1 < len(files) else None
-
-    # skip files that do not overlap with the desired range
-    if desired_stop is not None and file_start > desired_stop: break
-    if desired_start is not None and file_stop is not None and file_stop < desired_start: continue
+# find the files containing packets in the desired range from the catalog of the directory,
+# which reads only files added since it was last updated
+for chunk in chunks_overlapping(path, desired_start, desired_stop, stream):
+    if not chunk.filename.endswith('.bin.gz'): continue
 
     # for each file that does potentially overlap, loop over packets within it
-    with gzip.open(os.path.join(directory, file), 'r') as f:
+    with gzip.open(os.path.join(path, chunk.filename), 'r') as f:
         while True:
             logging_header_bytes = f.read(8)
             if len(logging_header_bytes) == 0: break